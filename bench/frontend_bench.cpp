@@ -0,0 +1,393 @@
+// Generates Albion programs of a given shape and size, and times scanning, parsing and resolving
+// them separately. The results are printed as a JSON array, with one object per shape, so that
+// they can be compared between builds to catch front-end regressions.
+//
+// Usage: frontend_bench [--shape nesting|tuples|functions|imports|mixed] [--size bytes]
+//                       [--depth n] [--width n] [--repetitions n]
+// Without a shape, every shape is measured.
+
+#include "argagg.hpp"
+#include "ast.h"
+#include "parser.h"
+#include "resolver.h"
+#include "scanner.h"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+struct Options {
+    std::size_t size;
+    std::size_t depth;
+    std::size_t width;
+    int repetitions;
+};
+
+// A generated program, and the files it imports
+struct Program {
+    std::string main;
+    std::map<std::string, std::string> imports;
+};
+
+std::string repeat(std::string_view s, std::size_t n)
+{
+    std::string result;
+    result.reserve(s.size() * n);
+    for (std::size_t i = 0; i < n; ++i) result += s;
+    return result;
+}
+
+// Blocks, ifs and whiles nested inside each other, around an assignment of a deeply nested
+// expression
+std::string nesting(const Options& options)
+{
+    std::string s = "var x = 0;\n";
+    while (s.size() < options.size) {
+        std::string open;
+        std::string close;
+        for (std::size_t i = 0; i < options.depth; ++i) {
+            switch (i % 3) {
+                case 0: open += "{ "; close += " }"; break;
+                case 1: open += "if (x < 1) { "; close += " }"; break;
+                case 2: open += "while (x and !x) { "; close += " }"; break;
+            }
+        }
+        const auto expression = repeat("(x + ", options.depth) + "1" +
+                                repeat(")", options.depth);
+        s += open + "x = " + expression + ";" + close + "\n";
+    }
+    return s;
+}
+
+// Declarations and assignments of long tuples
+std::string tuples(const Options& options)
+{
+    std::string s;
+    for (std::size_t n = 0; s.size() < options.size; ++n) {
+        const auto prefix = "t" + std::to_string(n) + "x";
+
+        std::string variables;
+        std::string values;
+        std::string reversed;
+        for (std::size_t i = 0; i < options.width; ++i) {
+            const auto separator = i == 0 ? "" : ", ";
+            variables += separator + prefix + std::to_string(i);
+            values += separator + std::to_string(i);
+            reversed += separator + prefix + std::to_string(options.width - i - 1);
+        }
+
+        s += "var " + variables + " = " + values + ";\n";
+        s += "(" + variables + ") = (" + reversed + ");\n";
+    }
+    return s;
+}
+
+// Functions that each call the one before, with closures over their inputs
+std::string functions(const Options& options, std::string_view prefix = "f")
+{
+    const auto name = [prefix](std::size_t n) { return std::string{prefix} + std::to_string(n); };
+
+    std::string s = "var " + name(0) + " = fun a b { return a + b; };\n";
+    for (std::size_t n = 1; s.size() < options.size; ++n) {
+        s += "var " + name(n) + " = fun a b {\n"
+             "    var c = a + b;\n"
+             "    var add = fun d { return c + d; };\n"
+             "    if (c > b or c == 0) {\n"
+             "        return c." + name(n - 1) + "(b).add;\n"
+             "    }\n"
+             "    while (c > 0) { c = c - 1; }\n"
+             "    return (a, b, c);\n"
+             "};\n";
+    }
+    return s;
+}
+
+// A program that imports many files of functions, and calls a function from each
+Program imports(const Options& options)
+{
+    constexpr std::size_t file_size = 4096;
+
+    Program program;
+    std::size_t size = 0;
+    for (std::size_t n = 0; size < options.size; ++n) {
+        const auto module = "m" + std::to_string(n);
+        const auto path = module + ".albion";
+
+        Options module_options = options;
+        module_options.size = file_size;
+        auto text = functions(module_options);
+
+        program.main += "import \"" + path + "\" as " + module + ";\n";
+        program.main += "var r" + std::to_string(n) + " = 1." + module + ":f1(2);\n";
+        size += text.size();
+        program.imports.emplace(path, std::move(text));
+    }
+    return program;
+}
+
+Program generate(std::string_view shape, const Options& options)
+{
+    if (shape == "nesting") return {nesting(options), {}};
+    if (shape == "tuples") return {tuples(options), {}};
+    if (shape == "functions") return {functions(options), {}};
+    if (shape == "imports") return imports(options);
+    if (shape == "mixed") {
+        Options part = options;
+        part.size = options.size / 3;
+        return {nesting(part) + tuples(part) + functions(part), {}};
+    }
+    throw std::invalid_argument{"unknown shape '" + std::string{shape} + "'"};
+}
+
+// Counts every node of an ast, including the asts of imported files
+struct NodeCounter : Ast::Expression::Visitor<void>, Ast::Statement::Visitor<void> {
+    std::size_t count = 0;
+
+    void count_all(const Ast::Ast& ast) {
+        for (const auto& statement : ast) statement->accept(*this);
+    }
+
+    void operator()(const Ast::Assign& a) override {
+        ++count;
+        (*this)(*a.variable);
+        a.expression->accept(*this);
+    }
+    void operator()(const Ast::AssignMember& a) override {
+        ++count;
+        a.object->accept(*this);
+        a.expression->accept(*this);
+    }
+    void operator()(const Ast::Binary& b) override {
+        ++count;
+        b.left->accept(*this);
+        b.right->accept(*this);
+    }
+    void operator()(const Ast::Call& c) override {
+        ++count;
+        c.callee->accept(*this);
+        for (std::size_t i = 0; i < c.input.size(); ++i) c.input[i]->accept(*this);
+    }
+    void operator()(const Ast::Function& f) override {
+        ++count;
+        for (std::size_t i = 0; i < f.input.size(); ++i) (*this)(*f.input[i]);
+        (*this)(*f.body);
+    }
+    void operator()(const Ast::Get& g) override {
+        ++count;
+        g.object->accept(*this);
+    }
+    void operator()(const Ast::Grouping& g) override {
+        ++count;
+        g.expression->accept(*this);
+    }
+    void operator()(const Ast::Inlined& i) override {
+        ++count;
+        for (std::size_t j = 0; j < i.arguments.size(); ++j) i.arguments[j]->accept(*this);
+        for (std::size_t j = 0; j < i.input.size(); ++j) (*this)(*i.input[j]);
+        (*this)(*i.body);
+        if (i.result) (*i.result)->accept(*this);
+    }
+    void operator()(const Ast::Literal&) override {
+        ++count;
+    }
+    void operator()(const Ast::Logical& l) override {
+        ++count;
+        l.left->accept(*this);
+        l.right->accept(*this);
+    }
+    void operator()(const Ast::Tuple& t) override {
+        ++count;
+        for (const auto& element : t.elements) element->accept(*this);
+    }
+    void operator()(const Ast::Unary& u) override {
+        ++count;
+        u.right->accept(*this);
+    }
+    void operator()(const Ast::Variable&) override {
+        ++count;
+    }
+    void operator()(const Ast::VariableTuple& vt) override {
+        ++count;
+        Ast::for_each_variable(vt, [this](const Ast::Variable& v) { (*this)(v); });
+    }
+
+    void operator()(const Ast::Block& b) override {
+        ++count;
+        this->count_all(b.statements);
+    }
+    void operator()(const Ast::ExpressionStatement& es) override {
+        ++count;
+        if (es.expression) (*es.expression)->accept(*this);
+    }
+    void operator()(const Ast::If& i) override {
+        ++count;
+        i.condition->accept(*this);
+        i.then_branch->accept(*this);
+        if (i.else_branch) (*i.else_branch)->accept(*this);
+    }
+    void operator()(const Ast::Return& r) override {
+        ++count;
+        if (r.expression) (*r.expression)->accept(*this);
+    }
+    void operator()(const Ast::While& w) override {
+        ++count;
+        w.condition->accept(*this);
+        w.body->accept(*this);
+    }
+    void operator()(const Ast::Declaration& d) override {
+        ++count;
+        (*this)(*d.variable);
+        if (d.initializer) (*d.initializer)->accept(*this);
+    }
+    void operator()(const Ast::Import& i) override {
+        ++count;
+        if (i.variable) (*this)(**i.variable);
+        if (i.ast) this->count_all(*i.ast);
+    }
+};
+
+// The fastest of several runs, in seconds
+double time_best(int repetitions, const std::function<void()>& f)
+{
+    double best = 1e9;
+    for (int i = 0; i < repetitions; ++i) {
+        const auto start = std::chrono::steady_clock::now();
+        f();
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count());
+    }
+    return best;
+}
+
+void report_error(const Error& e)
+{
+    throw std::runtime_error{std::string{"generated program has an error: "} + e.what()};
+}
+
+struct Stage {
+    const char* name;
+    double seconds;
+    const char* count_name;
+    std::size_t count;
+};
+
+std::string to_json(std::string_view shape, std::size_t bytes, std::size_t files,
+                    std::size_t tokens, std::size_t nodes, const std::vector<Stage>& stages)
+{
+    std::ostringstream json;
+    json.precision(6);
+    json << "  {\"shape\": \"" << shape << "\", \"bytes\": " << bytes << ", \"files\": " << files
+         << ", \"tokens\": " << tokens << ", \"nodes\": " << nodes;
+    for (const auto& stage : stages) {
+        json << ",\n   \"" << stage.name << "\": {\"seconds\": " << stage.seconds
+             << ", \"mb_per_s\": " << bytes / stage.seconds / (1 << 20)
+             << ", \"" << stage.count_name << "_per_s\": " << stage.count / stage.seconds << "}";
+    }
+    json << "}";
+    return json.str();
+}
+
+std::string measure(std::string_view shape, const Options& options)
+{
+    // Imported files are never written, the import loader parses them from memory
+    const auto program = generate(shape, options);
+
+    std::size_t bytes = program.main.size();
+    for (const auto& import : program.imports) bytes += import.second.size();
+
+    std::vector<Token> main_tokens;
+    std::unordered_map<std::string, std::vector<Token>> import_tokens;
+    const auto scan_seconds = time_best(options.repetitions, [&] {
+        main_tokens = scan(program.main, report_error);
+        for (const auto& [path, text] : program.imports) {
+            import_tokens[path] = scan(text, report_error);
+        }
+    });
+
+    std::size_t token_count = main_tokens.size();
+    for (const auto& import : import_tokens) token_count += import.second.size();
+
+    // Each file is parsed once, however many times it's imported
+    std::unordered_map<std::string, std::shared_ptr<const Ast::Ast>> parsed;
+    ImportLoader load_import = [&](const std::string& filepath, const Token&) {
+        auto& ast = parsed[filepath];
+        if (!ast) {
+            ast = std::make_shared<const Ast::Ast>(
+                parse(import_tokens.at(filepath), report_error, load_import));
+        }
+        return ast;
+    };
+
+    Ast::Ast ast;
+    const auto parse_seconds = time_best(options.repetitions, [&] {
+        parsed.clear();
+        ast = parse(main_tokens, report_error, load_import);
+    });
+
+    NodeCounter counter;
+    counter.count_all(ast);
+
+    const auto resolve_seconds = time_best(options.repetitions, [&ast] {
+        Globals globals;
+        ScopeStack scopes{globals};
+        Locations locations;
+        resolve(ast, scopes, locations);
+    });
+
+    return to_json(shape, bytes, 1 + program.imports.size(), token_count, counter.count, {
+        {"scan", scan_seconds, "tokens", token_count},
+        {"parse", parse_seconds, "nodes", counter.count},
+        {"resolve", resolve_seconds, "nodes", counter.count},
+    });
+}
+
+}
+
+int main(int argc, char** argv)
+try {
+    argagg::parser arg_parser{{
+        {"shape",       {"--shape"},       "nesting, tuples, functions, imports or mixed", 1},
+        {"size",        {"--size"},        "Approximate size of each program in bytes", 1},
+        {"depth",       {"--depth"},       "How deeply statements and expressions nest", 1},
+        {"width",       {"--width"},       "How many elements tuples have", 1},
+        {"repetitions", {"--repetitions"}, "Times each stage is run, the fastest is kept", 1},
+    }};
+
+    const auto args = arg_parser.parse(argc, argv);
+
+    Options options;
+    options.size = args["size"].as<std::size_t>(4 << 20);
+    options.depth = args["depth"].as<std::size_t>(32);
+    options.width = args["width"].as<std::size_t>(64);
+    options.repetitions = std::max(args["repetitions"].as<int>(5), 1);
+
+    const std::vector<std::string> shapes = args["shape"]
+        ? std::vector<std::string>{args["shape"].as<std::string>()}
+        : std::vector<std::string>{"nesting", "tuples", "functions", "imports", "mixed"};
+
+    std::cout << "[\n";
+    for (std::size_t i = 0; i < shapes.size(); ++i) {
+        std::cout << measure(shapes[i], options) << (i + 1 < shapes.size() ? ",\n" : "\n")
+                  << std::flush;
+    }
+    std::cout << "]\n";
+}
+catch (const argagg::error& e) {
+    std::cerr << e.what() << '\n';
+    return 1;
+}
+catch (const std::exception& e) {
+    std::cerr << e.what() << '\n';
+    return 1;
+}
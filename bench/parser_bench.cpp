@@ -0,0 +1,129 @@
+// Measures how parsing time grows with the size of assignments: long chains, deeply nested
+// assignments and targets, and wide tuples. Parsing should take linear time, so the time per
+// token should stay about the same as the sizes double.
+//
+// Usage: parser_bench
+
+#include "parser.h"
+#include "scanner.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+namespace {
+
+constexpr int repetitions = 5;
+
+// Each program is made of copies of a statement, so that there are enough tokens to time
+constexpr std::size_t tokens_per_program = 1 << 20;
+
+struct ProgramShape {
+    std::string_view name;
+    std::function<std::string(std::size_t)> statement;
+    std::size_t tokens_per_size;
+};
+
+std::string repeat(std::string_view s, std::size_t n)
+{
+    std::string result;
+    result.reserve(s.size() * n);
+    for (std::size_t i = 0; i < n; ++i) result += s;
+    return result;
+}
+
+// a = a = ... = 1;
+std::string chain(std::size_t n)
+{
+    return repeat("a = ", n) + "1;\n";
+}
+
+// a = (a = (... (a = 1)));
+std::string nested(std::size_t n)
+{
+    return repeat("a = (", n) + "1" + repeat(")", n) + ";\n";
+}
+
+// ((... (a))) = 1;
+std::string nested_target(std::size_t n)
+{
+    return repeat("(", n) + "a" + repeat(")", n) + " = 1;\n";
+}
+
+// a, a, ..., a = 1, 1, ..., 1;
+std::string wide(std::size_t n)
+{
+    return "a" + repeat(", a", n - 1) + " = 1" + repeat(", 1", n - 1) + ";\n";
+}
+
+// The fastest of several runs, in seconds
+double time_best(const std::function<void()>& f)
+{
+    double best = 1e9;
+    for (int i = 0; i < repetitions; ++i) {
+        const auto start = std::chrono::steady_clock::now();
+        f();
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count());
+    }
+    return best;
+}
+
+}
+
+int main()
+{
+    const ProgramShape shapes[] = {
+        {"chain", chain, 2},
+        {"nested", nested, 4},
+        {"target", nested_target, 2},
+        {"wide", wide, 4},
+    };
+
+    // Nesting is limited by the stack, since the parser is recursive
+    const std::size_t sizes[] = {64, 128, 256, 512, 1024, 2048};
+
+    const auto report_error = [](const Error& e) { throw std::runtime_error{e.what()}; };
+    const ImportLoader load_import = [](const std::string&, const Token&) {
+        throw std::logic_error{"benchmarks don't import files"};
+        return std::shared_ptr<const Ast::Ast>{};
+    };
+
+    std::cout << std::left << std::setw(8) << "shape" << std::right << std::setw(8) << "size"
+              << std::setw(10) << "tokens" << std::setw(12) << "parse ms" << std::setw(12)
+              << "ns/token" << '\n';
+
+    for (const auto& shape : shapes) {
+        for (const auto size : sizes) {
+            const auto statement = shape.statement(size);
+            const auto copies = std::max<std::size_t>(
+                tokens_per_program / (size * shape.tokens_per_size), 1);
+            const auto source = repeat(statement, copies);
+            const auto tokens = scan(source, report_error);
+
+            std::cout << std::left << std::setw(8) << shape.name << std::right << std::setw(8)
+                      << size << std::setw(10) << tokens.size();
+
+            double seconds;
+            try {
+                seconds = time_best([&tokens, &report_error, &load_import] {
+                    parse(tokens, report_error, load_import);
+                });
+            }
+            catch (const std::runtime_error& e) {
+                std::cout << "  " << e.what() << '\n';
+                continue;
+            }
+
+            std::cout << std::fixed << std::setprecision(2) << std::setw(12) << seconds * 1000
+                      << std::setw(12) << seconds * 1e9 / tokens.size() << '\n';
+        }
+    }
+}
@@ -0,0 +1,104 @@
+// Measures how fast the scanner gets through source text, compared with just reading the text.
+// Scanning is meant to be bound by memory bandwidth, so the closer the two are the better.
+//
+// Usage: scanner_bench [file]
+// Without a file, an identifier and keyword heavy program is generated to scan.
+
+#include "mapped_file.h"
+#include "scanner.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+
+namespace {
+
+constexpr int repetitions = 7;
+constexpr std::size_t generated_size = 16 << 20;
+
+std::string generate_source()
+{
+    // Mostly statements like the ones in real programs, with some identifiers that are almost
+    // keywords, which is the worst case for keyword recognition
+    const std::string_view lines[] = {
+        "var total = 0;\n",
+        "var classification = fun value other { return value.add(other); };\n",
+        "while (index < length and !done) { index = index + 1; }\n",
+        "if (this.isnil or that == nil) { returned = false; } else { returned = true; }\n",
+        "for (var item = first; item != last; item = item.next) { visit(item); }\n",
+        "fun lazyload path { import \"module.albion\" as module; return module; }\n",
+        "// A comment about the function below, which is not very long\n",
+        "var message = \"a string with some words in it\";\n",
+        "superclass = fork.fund(iff, ass, variable, whiles, imported, truthy, els);\n",
+    };
+
+    std::mt19937 random{42};
+    std::uniform_int_distribution<std::size_t> pick{0, std::size(lines) - 1};
+
+    std::string source;
+    source.reserve(generated_size + 128);
+    while (source.size() < generated_size) {
+        source += lines[pick(random)];
+    }
+    return source;
+}
+
+// The fastest of several runs, in seconds
+double time_best(const std::function<void()>& f)
+{
+    double best = 1e9;
+    for (int i = 0; i < repetitions; ++i) {
+        const auto start = std::chrono::steady_clock::now();
+        f();
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count());
+    }
+    return best;
+}
+
+void report(std::string_view name, double seconds, std::size_t bytes)
+{
+    std::cout << std::left << std::setw(10) << name << std::right << std::fixed
+              << std::setprecision(2) << std::setw(10) << seconds * 1000 << " ms"
+              << std::setw(10) << bytes / seconds / (1 << 20) << " MB/s\n";
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 2) {
+        std::cerr << "Usage: " << argv[0] << " [file]\n";
+        return 1;
+    }
+
+    const auto generated = argc == 2 ? std::string{} : generate_source();
+    const auto file = argc == 2 ? std::make_unique<MappedFile>(argv[1]) : nullptr;
+    const std::string_view source = file ? file->data() : generated;
+
+    std::size_t newlines = 0;
+    const auto read_seconds = time_best([&source, &newlines] {
+        newlines = static_cast<std::size_t>(std::count(source.begin(), source.end(), '\n'));
+    });
+
+    std::size_t token_count = 0;
+    std::size_t errors = 0;
+    const auto scan_seconds = time_best([&source, &token_count, &errors] {
+        errors = 0;
+        token_count = scan(source, [&errors](const ScanError&) { ++errors; }).size();
+    });
+
+    std::cout << source.size() << " bytes, " << newlines + 1 << " lines, " << token_count
+              << " tokens, " << errors << " errors\n";
+    report("read", read_seconds, source.size());
+    report("scan", scan_seconds, source.size());
+    std::cout << "scan takes " << std::setprecision(1) << scan_seconds / read_seconds
+              << "x as long as reading\n";
+}
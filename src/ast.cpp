@@ -1,4 +1,4 @@
 #include "ast.h"
 
-std::uint64_t Ast::Variable::count = 0;
+std::atomic<std::uint64_t> Ast::Variable::count{0};
 
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include <vector>
 #include <memory>
 #include <optional>
@@ -23,10 +25,13 @@ struct Import;
 
 // Expressions forward declarations
 struct Assign;
+struct AssignMember;
 struct Binary;
 struct Call;
 struct Function;
+struct Get;
 struct Grouping;
+struct Inlined;
 struct Literal;
 struct Logical;
 struct Tuple;
@@ -47,19 +52,38 @@ struct Statement {
         virtual ~Visitor() noexcept {}
     };
 
+    // For the passes that rewrite the ast in place
+    struct MutableVisitor {
+        virtual void operator()(Block&) = 0;
+        virtual void operator()(ExpressionStatement&) = 0;
+        virtual void operator()(If&) = 0;
+        virtual void operator()(Return&) = 0;
+        virtual void operator()(While&) = 0;
+        virtual void operator()(Declaration&) = 0;
+        virtual void operator()(Import&) = 0;
+        virtual ~MutableVisitor() noexcept {}
+    };
+
     virtual void accept(Visitor<void>&) const = 0;
     virtual std::string accept(Visitor<std::string>&) const = 0;
+    virtual void accept(MutableVisitor&) = 0;
     virtual ~Statement() noexcept {}
 };
 
+// The type an expression's value is proven to have every time it's evaluated, by infer_types
+enum class Type : std::uint8_t { unknown, number, boolean, string };
+
 struct Expression {
     template <typename ReturnType>
     struct Visitor {
         virtual ReturnType operator()(const Assign&) = 0;
+        virtual ReturnType operator()(const AssignMember&) = 0;
         virtual ReturnType operator()(const Binary&) = 0;
         virtual ReturnType operator()(const Call&) = 0;
         virtual ReturnType operator()(const Function&) = 0;
+        virtual ReturnType operator()(const Get&) = 0;
         virtual ReturnType operator()(const Grouping&) = 0;
+        virtual ReturnType operator()(const Inlined&) = 0;
         virtual ReturnType operator()(const Literal&) = 0;
         virtual ReturnType operator()(const Logical&) = 0;
         virtual ReturnType operator()(const Tuple&) = 0;
@@ -69,10 +93,33 @@ struct Expression {
         virtual ~Visitor() noexcept {}
     };
 
+    // For the passes that rewrite the ast in place
+    struct MutableVisitor {
+        virtual void operator()(Assign&) = 0;
+        virtual void operator()(AssignMember&) = 0;
+        virtual void operator()(Binary&) = 0;
+        virtual void operator()(Call&) = 0;
+        virtual void operator()(Function&) = 0;
+        virtual void operator()(Get&) = 0;
+        virtual void operator()(Grouping&) = 0;
+        virtual void operator()(Inlined&) = 0;
+        virtual void operator()(Literal&) = 0;
+        virtual void operator()(Logical&) = 0;
+        virtual void operator()(Tuple&) = 0;
+        virtual void operator()(Unary&) = 0;
+        virtual void operator()(Variable&) = 0;
+        virtual void operator()(VariableTuple&) = 0;
+        virtual ~MutableVisitor() noexcept {}
+    };
+
     virtual void accept(Visitor<void>&) const = 0;
     virtual ObjectReference accept(Visitor<ObjectReference>&) const = 0;
+    virtual double accept(Visitor<double>&) const = 0;
     virtual std::string accept(Visitor<std::string>&) const = 0;
+    virtual void accept(MutableVisitor&) = 0;
     virtual ~Expression() noexcept {}
+
+    mutable Type type = Type::unknown;
 };
 
 // Statements -------------------------------------------------------------------------------------
@@ -83,17 +130,22 @@ struct Expression {
     }\
     std::string accept(Statement::Visitor<std::string>& v) const override {\
         return v(*this);\
+    }\
+    void accept(Statement::MutableVisitor& v) override {\
+        return v(*this);\
     }
 
 struct If : Statement {
-    If(std::unique_ptr<Expression>&& condition, std::unique_ptr<Statement>&& then_branch,
+    If(Token keyword, std::unique_ptr<Expression>&& condition,
+       std::unique_ptr<Statement>&& then_branch,
        std::optional<std::unique_ptr<Statement>>&& else_branch)
-        : condition{std::move(condition)}, then_branch{std::move(then_branch)},
-          else_branch{std::move(else_branch)}
+        : keyword{std::move(keyword)}, condition{std::move(condition)},
+          then_branch{std::move(then_branch)}, else_branch{std::move(else_branch)}
     {}
 
     ACCEPT_STATEMENT_VISITORS
 
+    Token keyword;
     std::unique_ptr<Expression> condition;
     std::unique_ptr<Statement> then_branch;
     std::optional<std::unique_ptr<Statement>> else_branch;
@@ -159,19 +211,22 @@ struct Declaration : Statement {
     std::optional<std::unique_ptr<Expression>> initializer;
 };
 
+// The ast of an imported file is shared between every import statement that names the same file.
+// A lazy import has no ast, the file is only loaded once a member of the module is accessed.
 struct Import : Statement {
-    Import(Token token, std::string filepath, Ast&& ast,
-           std::optional<std::unique_ptr<Variable>>&& variable)
+    Import(Token token, std::string filepath, std::shared_ptr<const Ast> ast,
+           std::optional<std::unique_ptr<Variable>>&& variable, bool lazy = false)
         : token{std::move(token)}, filepath{std::move(filepath)}, ast{std::move(ast)},
-          variable{std::move(variable)}
+          variable{std::move(variable)}, lazy{lazy}
     {}
 
     ACCEPT_STATEMENT_VISITORS
 
     Token token;
     std::string filepath;
-    Ast ast;
+    std::shared_ptr<const Ast> ast;
     std::optional<std::unique_ptr<Variable>> variable;
+    bool lazy;
 };
 
 // Expressions ------------------------------------------------------------------------------------
@@ -183,13 +238,19 @@ struct Import : Statement {
     ObjectReference accept(Expression::Visitor<ObjectReference>& v) const override {\
         return v(*this);\
     }\
+    double accept(Expression::Visitor<double>& v) const override {\
+        return v(*this);\
+    }\
     std::string accept(Expression::Visitor<std::string>& v) const override {\
         return v(*this);\
+    }\
+    void accept(Expression::MutableVisitor& v) override {\
+        return v(*this);\
     }
 
 struct Variable : Expression {
     Variable(Token t)
-        : name{std::move(t)}, id{Variable::count++}
+        : name{std::move(t)}, id{Variable::count.fetch_add(1, std::memory_order_relaxed)}
     {}
 
     ACCEPT_EXPRESSION_VISITORS
@@ -197,7 +258,8 @@ struct Variable : Expression {
     Token name;
     std::uint64_t id;
 
-    static std::uint64_t count;
+    // Atomic, since files may be parsed concurrently
+    static std::atomic<std::uint64_t> count;
 };
 
 struct VariableTuple : Expression {
@@ -226,6 +288,15 @@ void for_each_variable(const VariableTuple& vt, F&& f) {
     }
 }
 
+// A variable from an enclosing scope that a function uses, which is copied into the function when
+// it's created. The location is where the variable is found from the scope the function is
+// created in (see Locations), which is either a depth or the index of one of the captures of the
+// function it's created inside.
+struct Capture {
+    Token name;
+    int location;
+};
+
 // Function expressions need to be copyable, since they are represented in the ast, and the
 // environment (within objects)
 struct Function : Expression {
@@ -238,6 +309,13 @@ struct Function : Expression {
 
     FunctionInput<std::shared_ptr<VariableTuple>> input;
     std::shared_ptr<Block> body;
+
+    // Filled in by the resolver, and shared by the copies made each time the function is created
+    mutable std::shared_ptr<const std::vector<Capture>> captures;
+
+    // Set by infer_purity if calling the function can't change anything, or depend on anything
+    // but its inputs and the variables it captures
+    mutable bool pure = false;
 };
 
 struct Assign : Expression {
@@ -253,6 +331,22 @@ struct Assign : Expression {
     std::unique_ptr<Expression> expression;
 };
 
+// Assignment to a field of a record, object:name = value
+struct AssignMember : Expression {
+    AssignMember(std::unique_ptr<Expression>&& object, Token name,
+                 std::unique_ptr<Expression>&& value)
+        : object{std::move(object)}, name{std::move(name)}, expression{std::move(value)}
+    {}
+
+    ACCEPT_EXPRESSION_VISITORS
+
+    std::unique_ptr<Expression> object;
+    Token name;
+    std::unique_ptr<Expression> expression;
+    // See Get::cache
+    mutable MemberCache cache;
+};
+
 struct Binary : Expression {
     Binary(std::unique_ptr<Expression>&& left, Token op, std::unique_ptr<Expression>&& right)
         : left{std::move(left)}, op{std::move(op)}, right{std::move(right)}
@@ -293,6 +387,21 @@ struct Call : Expression {
     FunctionInput<std::unique_ptr<Expression>> input;
 };
 
+// Member access, object:name
+struct Get : Expression {
+    Get(std::unique_ptr<Expression>&& object, Token name)
+        : object{std::move(object)}, name{std::move(name)}
+    {}
+
+    ACCEPT_EXPRESSION_VISITORS
+
+    std::unique_ptr<Expression> object;
+    Token name;
+    // Set by the interpreter each time it finds the member in a set or a record of another shape,
+    // or by resolve_field_offsets beforehand if only one record type has a field with the name
+    mutable MemberCache cache;
+};
+
 struct Grouping : Expression {
     Grouping(std::unique_ptr<Expression>&& e)
         : expression{std::move(e)}
@@ -303,6 +412,28 @@ struct Grouping : Expression {
     std::unique_ptr<Expression> expression;
 };
 
+// A call to a small function that the inliner replaced with a copy of the function's body. The
+// inputs are bound to the arguments in a scope of their own, the same way a call binds them, and
+// the body's statements are run in that scope. The value is that of the result, the expression the
+// function returned at the end of its body, or nil if there is none.
+struct Inlined : Expression {
+    Inlined(Token token, FunctionInput<std::unique_ptr<Expression>>&& arguments,
+            FunctionInput<std::unique_ptr<VariableTuple>>&& input, std::unique_ptr<Block>&& body,
+            std::optional<std::unique_ptr<Expression>>&& result)
+        : token{std::move(token)}, arguments{std::move(arguments)}, input{std::move(input)},
+          body{std::move(body)}, result{std::move(result)}
+    {}
+
+    ACCEPT_EXPRESSION_VISITORS
+
+    // The token of the call, for errors binding the arguments
+    Token token;
+    FunctionInput<std::unique_ptr<Expression>> arguments;
+    FunctionInput<std::unique_ptr<VariableTuple>> input;
+    std::unique_ptr<Block> body;
+    std::optional<std::unique_ptr<Expression>> result;
+};
+
 struct Literal : Expression {
     Literal(const ObjectReference& o)
         : value{o}
@@ -14,9 +14,18 @@ struct Printer : Ast::Expression::Visitor<std::string>, Ast::Statement::Visitor<
         s += ") ";
         return s;
     }
+    std::string operator()(const Ast::AssignMember& a) override {
+        std::string s;
+        s += "(assign : ";
+        s += a.object->accept(*this);
+        s += std::string{a.name.lexeme()} + " ";
+        s += a.expression->accept(*this);
+        s += ") ";
+        return s;
+    }
     std::string operator()(const Ast::Binary& b) override {
         std::string s;
-        s += "(" + b.op.lexeme + " ";
+        s += "(" + std::string{b.op.lexeme()} + " ";
         s += b.left->accept(*this);
         s += b.right->accept(*this);
         s += ") ";
@@ -42,6 +51,14 @@ struct Printer : Ast::Expression::Visitor<std::string>, Ast::Statement::Visitor<
         s += ") ";
         return s;
     }
+    std::string operator()(const Ast::Get& g) override {
+        std::string s;
+        s += "(: ";
+        s += g.object->accept(*this);
+        s += std::string{g.name.lexeme()} + " ";
+        s += ") ";
+        return s;
+    }
     std::string operator()(const Ast::Grouping& g) override {
         std::string s;
         s += "(group ";
@@ -49,6 +66,21 @@ struct Printer : Ast::Expression::Visitor<std::string>, Ast::Statement::Visitor<
         s += ") ";
         return s;
     }
+    std::string operator()(const Ast::Inlined& i) override {
+        std::string s;
+        s += "(inlined (";
+        for (std::size_t j = 0; j < i.input.size(); ++j) {
+            s += i.input[j]->accept(*this);
+        }
+        s += ") ";
+        for (std::size_t j = 0; j < i.arguments.size(); ++j) {
+            s += i.arguments[j]->accept(*this);
+        }
+        s += i.body->accept(*this);
+        if (i.result) s += (*i.result)->accept(*this);
+        s += ") ";
+        return s;
+    }
     std::string operator()(const Ast::Literal& l) override {
         std::string s;
         const bool is_string = l.value.holds<std::string>();
@@ -60,7 +92,7 @@ struct Printer : Ast::Expression::Visitor<std::string>, Ast::Statement::Visitor<
     }
     std::string operator()(const Ast::Logical& l) override {
         std::string s;
-        s += "(" + l.op.lexeme + " ";
+        s += "(" + std::string{l.op.lexeme()} + " ";
         s += l.left->accept(*this);
         s += l.right->accept(*this);
         s += ") ";
@@ -77,14 +109,14 @@ struct Printer : Ast::Expression::Visitor<std::string>, Ast::Statement::Visitor<
     }
     std::string operator()(const Ast::Unary& u) override {
         std::string s;
-        s += "(" + u.op.lexeme + " ";
+        s += "(" + std::string{u.op.lexeme()} + " ";
         s += u.right->accept(*this);
         s += ") ";
         return s;
     }
     std::string operator()(const Ast::Variable& v) override {
         std::string s;
-        s += v.name.lexeme + " ";
+        s += std::string{v.name.lexeme()} + " ";
         return s;
     }
     std::string operator()(const Ast::VariableTuple& vt) override {
@@ -156,6 +188,7 @@ struct Printer : Ast::Expression::Visitor<std::string>, Ast::Statement::Visitor<
     std::string operator()(const Ast::Import& i) override {
         std::string s;
         s += "(import ";
+        if (i.lazy) s += "lazy ";
         s += "\"" + i.filepath + "\" ";
         if (i.variable) {
             s += " as " + (*i.variable)->accept(*this);
@@ -0,0 +1,599 @@
+#include "common_subexpressions.h"
+#include "pass_helpers.h"
+#include "object.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <deque>
+#include <iterator>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace {
+
+// Temporaries can't clash with the program's variables, whose names can't start with a '$', nor
+// with the loop hoister's, which are just numbered. The tokens of the temporaries refer to the
+// names, so they're kept for as long as the program runs.
+std::string_view temporary_name(std::size_t index)
+{
+    static std::deque<std::string> names;
+    while (names.size() <= index) names.push_back("$c" + std::to_string(names.size()));
+    return names[index];
+}
+
+// Larger expressions aren't compared, so that long chains of operators don't take quadratic time
+constexpr int max_size = 32;
+
+// An expression of operators, literals and local variables that can't fail. Expressions with the
+// same key have the same value, as long as their variables don't change.
+struct Pure {
+    std::string key;
+    std::vector<std::string_view> names;
+    int size = 0;
+};
+
+std::optional<std::string> literal_key(const ObjectReference& o)
+{
+    if (o.holds<std::nullptr_t>()) return "nil";
+    if (o.holds<bool>()) return o.get<bool>() ? "true" : "false";
+    if (o.holds<double>()) {
+        // Exact, so that numbers that print the same aren't mistaken for each other
+        char buffer[32];
+        std::snprintf(buffer, sizeof buffer, "%a", o.get<double>());
+        return buffer;
+    }
+    if (o.holds<std::string>()) {
+        const auto& s = o.get<std::string>();
+        return std::to_string(s.size()) + '"' + s;
+    }
+    return {};
+}
+
+Ast::Type operand_type(const Ast::Expression& e)
+{
+    if (const auto l = dynamic_cast<const Ast::Literal*>(&ungrouped(e))) {
+        if (l->value.holds<double>()) return Ast::Type::number;
+        if (l->value.holds<bool>()) return Ast::Type::boolean;
+        if (l->value.holds<std::string>()) return Ast::Type::string;
+        return Ast::Type::unknown;
+    }
+    return e.type;
+}
+
+// Whether the operator can't fail on operands of the given types
+bool cannot_fail(Token::Type op, Ast::Type left, Ast::Type right)
+{
+    const bool numbers = left == Ast::Type::number && right == Ast::Type::number;
+    switch (op) {
+        case Token::Type::minus:
+        case Token::Type::slash:
+        case Token::Type::star:
+        case Token::Type::greater:
+        case Token::Type::greater_equal:
+        case Token::Type::less:
+        case Token::Type::less_equal:
+            return numbers;
+        case Token::Type::plus:
+            return numbers || (left == Ast::Type::string && right == Ast::Type::string);
+        case Token::Type::bang_equal:
+        case Token::Type::equal_equal:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool is_operator(const Ast::Expression& e)
+{
+    return dynamic_cast<const Ast::Binary*>(&e) || dynamic_cast<const Ast::Unary*>(&e);
+}
+
+// Collects the names of the variables that functions assign through their captures, which are the
+// only local variables that calls can change
+struct CapturedAssignments : Ast::Expression::Visitor<void>, Ast::Statement::Visitor<void> {
+    CapturedAssignments(const Locations& l)
+        : locations_{l}
+    {}
+
+    void add(const Ast::Statement& s) { s.accept(*this); }
+    void add(const Ast::Expression& e) { e.accept(*this); }
+
+    void operator()(const Ast::Assign& a) override {
+        this->add(*a.expression);
+        Ast::for_each_variable(*a.variable, [this](const Ast::Variable& v) {
+            const auto location = locations_.find(v.id);
+            if (location != locations_.end() && is_captured(location->second)) {
+                names.insert(v.name.lexeme());
+            }
+        });
+    }
+    void operator()(const Ast::AssignMember& a) override {
+        this->add(*a.object);
+        this->add(*a.expression);
+    }
+    void operator()(const Ast::Binary& b) override {
+        this->add(*b.left);
+        this->add(*b.right);
+    }
+    void operator()(const Ast::Call& c) override {
+        this->add(*c.callee);
+        for (std::size_t i = 0; i < c.input.size(); ++i) this->add(*c.input[i]);
+    }
+    void operator()(const Ast::Function& f) override {
+        this->add(*f.body);
+    }
+    void operator()(const Ast::Get& g) override {
+        this->add(*g.object);
+    }
+    void operator()(const Ast::Grouping& g) override {
+        this->add(*g.expression);
+    }
+    void operator()(const Ast::Inlined& i) override {
+        for (std::size_t j = 0; j < i.arguments.size(); ++j) this->add(*i.arguments[j]);
+        this->add(*i.body);
+        if (i.result) this->add(**i.result);
+    }
+    void operator()(const Ast::Literal&) override {}
+    void operator()(const Ast::Logical& l) override {
+        this->add(*l.left);
+        this->add(*l.right);
+    }
+    void operator()(const Ast::Tuple& t) override {
+        for (const auto& element : t.elements) this->add(*element);
+    }
+    void operator()(const Ast::Unary& u) override {
+        this->add(*u.right);
+    }
+    void operator()(const Ast::Variable&) override {}
+    void operator()(const Ast::VariableTuple&) override {}
+
+    void operator()(const Ast::Block& b) override {
+        for (const auto& statement : b.statements) this->add(*statement);
+    }
+    void operator()(const Ast::ExpressionStatement& es) override {
+        if (es.expression) this->add(**es.expression);
+    }
+    void operator()(const Ast::If& i) override {
+        this->add(*i.condition);
+        this->add(*i.then_branch);
+        if (i.else_branch) this->add(**i.else_branch);
+    }
+    void operator()(const Ast::Return& r) override {
+        if (r.expression) this->add(**r.expression);
+    }
+    void operator()(const Ast::While& w) override {
+        this->add(*w.condition);
+        this->add(*w.body);
+    }
+    void operator()(const Ast::Declaration& d) override {
+        if (d.initializer) this->add(**d.initializer);
+    }
+    void operator()(const Ast::Import&) override {}
+
+    std::unordered_set<std::string_view> names;
+private:
+    const Locations& locations_;
+};
+
+struct Eliminator : Ast::Expression::MutableVisitor, Ast::Statement::MutableVisitor {
+    Eliminator(Locations& l, const std::unordered_set<std::string_view>& changed_by_calls,
+               std::vector<std::string>* r)
+        : locations_{l}, changed_by_calls_{changed_by_calls}, report_{r}
+    {}
+
+    // The statements are those of a block, or of the top level, where variables aren't local
+    void walk(Ast::Ast& statements, bool block);
+
+    bool eliminated() const { return eliminated_; }
+
+    void operator()(Ast::Assign&) override;
+    void operator()(Ast::AssignMember&) override;
+    void operator()(Ast::Binary&) override;
+    void operator()(Ast::Call&) override;
+    void operator()(Ast::Function&) override;
+    void operator()(Ast::Get&) override;
+    void operator()(Ast::Grouping&) override;
+    void operator()(Ast::Inlined&) override;
+    void operator()(Ast::Literal&) override;
+    void operator()(Ast::Logical&) override;
+    void operator()(Ast::Tuple&) override;
+    void operator()(Ast::Unary&) override;
+    void operator()(Ast::Variable&) override;
+    void operator()(Ast::VariableTuple&) override;
+
+    void operator()(Ast::Block&) override;
+    void operator()(Ast::ExpressionStatement&) override;
+    void operator()(Ast::If&) override;
+    void operator()(Ast::Return&) override;
+    void operator()(Ast::While&) override;
+    void operator()(Ast::Declaration&) override;
+    void operator()(Ast::Import&) override;
+private:
+    // An expression found in the run, and each place it's found until its variables change
+    struct Candidate {
+        std::vector<std::string_view> names;
+        std::vector<std::unique_ptr<Ast::Expression>*> occurrences;
+        // The statement its temporary is declared before
+        std::size_t statement;
+    };
+
+    // What's known about the run of statements being walked
+    struct Run {
+        // Only set in blocks, since the temporaries are declared in them
+        bool local = false;
+        std::vector<Candidate> candidates;
+        // The candidates that can still be reused, by key
+        std::unordered_map<std::string, std::size_t> available;
+
+        std::size_t statement = 0;
+        // Whether anything the statement has evaluated so far could fail or change anything, in
+        // which case a temporary declared before it could see different variables, or fail first
+        bool eventful = false;
+    };
+
+    void walk(std::unique_ptr<Ast::Statement>&);
+    // For statements and expressions that aren't part of the run, such as the branches of ifs
+    void walk_apart(std::unique_ptr<Ast::Statement>&);
+    void scan_apart(std::unique_ptr<Ast::Expression>&);
+
+    void scan(std::unique_ptr<Ast::Expression>&);
+    std::optional<Pure> pure(const Ast::Expression&) const;
+
+    void change(std::string_view name);
+    void call();
+
+    // Declares a temporary for each candidate found more than once
+    void rewrite(Ast::Ast& statements);
+
+    Locations& locations_;
+    const std::unordered_set<std::string_view>& changed_by_calls_;
+    std::vector<std::string>* report_;
+    bool eliminated_ = false;
+
+    Run run_;
+};
+
+void Eliminator::walk(Ast::Ast& statements, bool block)
+{
+    auto outer = std::move(run_);
+    run_ = Run{};
+    run_.local = block;
+
+    for (std::size_t i = 0; i < statements.size(); ++i) {
+        run_.statement = i;
+        run_.eventful = false;
+        this->walk(statements[i]);
+    }
+    if (block) this->rewrite(statements);
+
+    run_ = std::move(outer);
+}
+
+void Eliminator::walk(std::unique_ptr<Ast::Statement>& statement)
+{
+    statement->accept(*this);
+}
+
+void Eliminator::operator()(Ast::Block& b)
+{
+    run_.available.clear();
+    this->walk(b.statements, true);
+}
+
+void Eliminator::operator()(Ast::ExpressionStatement& es)
+{
+    if (es.expression) this->scan(*es.expression);
+}
+
+void Eliminator::operator()(Ast::If& i)
+{
+    this->scan(i.condition);
+    run_.available.clear();
+    this->walk_apart(i.then_branch);
+    if (i.else_branch) this->walk_apart(*i.else_branch);
+}
+
+void Eliminator::operator()(Ast::Return& r)
+{
+    if (r.expression) this->scan(*r.expression);
+}
+
+void Eliminator::operator()(Ast::While& w)
+{
+    // The condition is evaluated again after the body
+    run_.available.clear();
+    this->scan_apart(w.condition);
+    this->walk_apart(w.body);
+}
+
+void Eliminator::operator()(Ast::Declaration& d)
+{
+    if (d.initializer) this->scan(*d.initializer);
+    Ast::for_each_variable(*d.variable, [this](const Ast::Variable& v) {
+        this->change(v.name.lexeme());
+    });
+}
+
+void Eliminator::operator()(Ast::Import&)
+{
+    // Imported files are shared between importers, so they're left as they are
+    run_.available.clear();
+}
+
+void Eliminator::walk_apart(std::unique_ptr<Ast::Statement>& statement)
+{
+    if (const auto b = dynamic_cast<Ast::Block*>(statement.get())) {
+        this->walk(b->statements, true);
+        return;
+    }
+    auto outer = std::move(run_);
+    run_ = Run{};
+    this->walk(statement);
+    run_ = std::move(outer);
+}
+
+void Eliminator::scan_apart(std::unique_ptr<Ast::Expression>& expression)
+{
+    auto outer = std::move(run_);
+    run_ = Run{};
+    this->scan(expression);
+    run_ = std::move(outer);
+}
+
+void Eliminator::scan(std::unique_ptr<Ast::Expression>& expression)
+{
+    const auto e = expression.get();
+
+    if (is_operator(ungrouped(*e))) {
+        if (auto p = this->pure(*e)) {
+            // Operators on literals are as quick to evaluate as a temporary is to read
+            if (!run_.local || p->names.empty()) return;
+
+            if (const auto a = run_.available.find(p->key); a != run_.available.end()) {
+                run_.candidates[a->second].occurrences.push_back(&expression);
+                return;
+            }
+
+            // Its parts might have been found before
+            auto& operation = ungrouped(*e);
+            if (const auto b = dynamic_cast<Ast::Binary*>(&operation)) {
+                this->scan(b->left);
+                this->scan(b->right);
+            } else {
+                this->scan(dynamic_cast<Ast::Unary&>(operation).right);
+            }
+
+            if (run_.eventful) return;
+            run_.available.emplace(std::move(p->key), run_.candidates.size());
+            run_.candidates.push_back({std::move(p->names), {&expression}, run_.statement});
+            return;
+        }
+    }
+
+    e->accept(*this);
+}
+
+// Tuples, functions, logical operators and literals can't fail nor change anything, but anything
+// else might, apart from the operators that scan() finds and local variables
+
+void Eliminator::operator()(Ast::Assign& a)
+{
+    this->scan(a.expression);
+    Ast::for_each_variable(*a.variable, [this](const Ast::Variable& v) {
+        this->change(v.name.lexeme());
+    });
+    run_.eventful = true;
+}
+
+void Eliminator::operator()(Ast::AssignMember& a)
+{
+    // Fields aren't variables, so no variable changes
+    this->scan(a.object);
+    this->scan(a.expression);
+    run_.eventful = true;
+}
+
+void Eliminator::operator()(Ast::Binary& b)
+{
+    this->scan(b.left);
+    this->scan(b.right);
+    run_.eventful = true;
+}
+
+void Eliminator::operator()(Ast::Call& c)
+{
+    this->scan(c.callee);
+    for (std::size_t i = 0; i < c.input.size(); ++i) this->scan(c.input[i]);
+    this->call();
+}
+
+void Eliminator::operator()(Ast::Function& f)
+{
+    this->walk(f.body->statements, true);
+}
+
+void Eliminator::operator()(Ast::Get& g)
+{
+    // Loading a lazy module runs its file
+    this->scan(g.object);
+    this->call();
+}
+
+void Eliminator::operator()(Ast::Grouping& g)
+{
+    this->scan(g.expression);
+}
+
+void Eliminator::operator()(Ast::Inlined& i)
+{
+    for (std::size_t j = 0; j < i.arguments.size(); ++j) this->scan(i.arguments[j]);
+    // The body's statements are run in a scope of their own, like a block's
+    this->walk(i.body->statements, true);
+    if (i.result) this->scan_apart(*i.result);
+    this->call();
+}
+
+void Eliminator::operator()(Ast::Literal&)
+{
+}
+
+void Eliminator::operator()(Ast::Logical& l)
+{
+    // A temporary for the right operand can be evaluated even if the operand isn't, since it can't
+    // fail
+    this->scan(l.left);
+    this->scan(l.right);
+}
+
+void Eliminator::operator()(Ast::Tuple& t)
+{
+    for (auto& element : t.elements) this->scan(element);
+}
+
+void Eliminator::operator()(Ast::Unary& u)
+{
+    this->scan(u.right);
+    run_.eventful = true;
+}
+
+void Eliminator::operator()(Ast::Variable& v)
+{
+    // Globals might not be defined
+    if (!this->pure(v)) run_.eventful = true;
+}
+
+void Eliminator::operator()(Ast::VariableTuple&)
+{
+}
+
+std::optional<Pure> Eliminator::pure(const Ast::Expression& e) const
+{
+    if (const auto g = dynamic_cast<const Ast::Grouping*>(&e)) return this->pure(*g->expression);
+
+    if (const auto l = dynamic_cast<const Ast::Literal*>(&e)) {
+        auto key = literal_key(l->value);
+        if (!key) return {};
+        return Pure{std::move(*key), {}, 1};
+    }
+
+    if (const auto v = dynamic_cast<const Ast::Variable*>(&e)) {
+        const auto location = locations_.find(v->id);
+        if (location == locations_.end() || is_global(location->second) ||
+            is_captured(location->second))
+        {
+            return {};
+        }
+        const auto name = v->name.lexeme();
+        return Pure{std::string{name} + '@' + std::to_string(location->second), {name}, 1};
+    }
+
+    if (const auto u = dynamic_cast<const Ast::Unary*>(&e)) {
+        if (u->op.type == Token::Type::minus && operand_type(*u->right) != Ast::Type::number) {
+            return {};
+        }
+        auto right = this->pure(*u->right);
+        if (!right || right->size == max_size) return {};
+        right->key = "(" + std::string{u->op.lexeme()} + right->key + ")";
+        ++right->size;
+        return right;
+    }
+
+    if (const auto b = dynamic_cast<const Ast::Binary*>(&e)) {
+        if (!cannot_fail(b->op.type, operand_type(*b->left), operand_type(*b->right))) return {};
+        auto left = this->pure(*b->left);
+        if (!left) return {};
+        auto right = this->pure(*b->right);
+        if (!right || left->size + right->size >= max_size) return {};
+
+        left->key = "(" + left->key + " " + std::string{b->op.lexeme()} + " " + right->key + ")";
+        left->names.insert(left->names.end(), right->names.begin(), right->names.end());
+        left->size += right->size + 1;
+        return left;
+    }
+
+    return {};
+}
+
+void Eliminator::change(std::string_view name)
+{
+    for (auto a = run_.available.begin(); a != run_.available.end(); ) {
+        const auto& names = run_.candidates[a->second].names;
+        if (std::find(names.begin(), names.end(), name) != names.end()) {
+            a = run_.available.erase(a);
+        } else {
+            ++a;
+        }
+    }
+}
+
+void Eliminator::call()
+{
+    run_.eventful = true;
+    if (changed_by_calls_.empty()) return;
+
+    for (auto a = run_.available.begin(); a != run_.available.end(); ) {
+        const auto& names = run_.candidates[a->second].names;
+        const auto changed = std::any_of(names.begin(), names.end(), [this](auto name) {
+            return changed_by_calls_.count(name) > 0;
+        });
+        a = changed ? run_.available.erase(a) : std::next(a);
+    }
+}
+
+void Eliminator::rewrite(Ast::Ast& statements)
+{
+    std::vector<Ast::Ast> declarations(statements.size());
+    std::size_t temporaries = 0;
+
+    for (auto& candidate : run_.candidates) {
+        if (candidate.occurrences.size() < 2) continue;
+
+        auto& first = *candidate.occurrences.front();
+        const auto& operation = ungrouped(*first);
+        const auto b = dynamic_cast<const Ast::Binary*>(&operation);
+        const auto& op = b ? b->op : dynamic_cast<const Ast::Unary&>(operation).op;
+        // Candidates are operators, so there's always the operator's own line to fall back on
+        const auto line = line_of(*first).value_or(op.line);
+        add_to_report(report_, "[line " + std::to_string(line) + "] computed '" +
+                               std::string{op.lexeme()} + "' once for " +
+                               std::to_string(candidate.occurrences.size()) + " uses");
+
+        // Declared in the same block the expression is found in, so its variables stay where
+        // they are
+        const Token name{Token::Type::identifier, temporary_name(temporaries++), line};
+        auto value = std::move(first);
+        for (const auto occurrence : candidate.occurrences) {
+            auto temporary = std::make_unique<Ast::Variable>(name);
+            locations_[temporary->id] = 0;
+            *occurrence = std::move(temporary);
+        }
+
+        declarations[candidate.statement].push_back(std::make_unique<Ast::Declaration>(
+            std::make_unique<Ast::VariableTuple>(Ast::Variable{name}),
+            Token{Token::Type::semicolon, ";", line}, std::move(value)));
+    }
+    if (temporaries == 0) return;
+
+    Ast::Ast rewritten;
+    for (std::size_t i = 0; i < statements.size(); ++i) {
+        for (auto& declaration : declarations[i]) rewritten.push_back(std::move(declaration));
+        rewritten.push_back(std::move(statements[i]));
+    }
+    statements = std::move(rewritten);
+    eliminated_ = true;
+}
+
+}  // Namespace
+
+bool eliminate_common_subexpressions(Ast::Ast& ast, Locations& locations,
+                                     std::vector<std::string>* report)
+{
+    CapturedAssignments captured{locations};
+    for (const auto& statement : ast) captured.add(*statement);
+
+    Eliminator eliminator{locations, captured.names, report};
+    eliminator.walk(ast, false);
+    return eliminator.eliminated();
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "ast.h"
+#include "resolver.h"
+
+#include <string>
+#include <vector>
+
+// Computes the operators that a run of statements in a block applies more than once to the same
+// local variables just once, into a temporary declared before the statement that first applies
+// them, once the ast's types have been inferred. Only operators that can neither fail nor change
+// anything, given the types inferred for their operands, are reused, and only until one of their
+// variables is assigned or declared again. Calls only end the runs of the variables that closures
+// assign, since no others can change in a call. Ifs, loops and blocks end the run.
+//
+// Each reused operator is described by a line in the report, if there is one. Returns whether
+// anything was reused, in which case the types need inferring again.
+bool eliminate_common_subexpressions(Ast::Ast&, Locations&,
+                                     std::vector<std::string>* report = nullptr);
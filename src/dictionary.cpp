@@ -0,0 +1,153 @@
+#include "dictionary.h"
+#include "object.h"
+
+#include <vector>
+
+namespace {
+
+// Hashes of numbers can be their bits, whose low bits are mostly zero, so hashes are mixed before
+// their low bits pick a slot
+std::uint64_t mix(std::uint64_t h)
+{
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ull;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebull;
+    h ^= h >> 31;
+    return h;
+}
+
+}  // Namespace
+
+struct Dictionary::Table {
+    struct Entry {
+        std::uint64_t hash;
+        ObjectReference key;
+        ObjectReference value;
+    };
+    // An empty slot's entry is 0, otherwise it's the index of the entry plus one, and the hash is
+    // the high half of the entry's hash
+    struct Slot {
+        std::uint32_t hash = 0;
+        std::uint32_t entry = 0;
+    };
+
+    static constexpr std::size_t initial_slots = 8;
+
+    std::vector<Entry> entries;
+    // A power of two in size, and never more than three quarters full
+    std::vector<Slot> slots = std::vector<Slot>(initial_slots);
+
+    std::size_t mask() const { return slots.size() - 1; }
+
+    // The slot that holds the key's entry, or the empty slot it would go in
+    std::size_t find(const ObjectReference& key, std::uint64_t hash) const
+    {
+        const auto high = static_cast<std::uint32_t>(hash >> 32);
+        for (auto i = hash & this->mask(); ; i = (i + 1) & this->mask()) {
+            const auto& slot = slots[i];
+            if (slot.entry == 0) return i;
+            if (slot.hash == high) {
+                const auto& entry = entries[slot.entry - 1];
+                if (entry.hash == hash && same_value(entry.key, key)) return i;
+            }
+        }
+    }
+
+    void grow()
+    {
+        slots.assign(slots.size() * 2, Slot{});
+        for (std::size_t e = 0; e < entries.size(); ++e) {
+            auto i = entries[e].hash & this->mask();
+            while (slots[i].entry != 0) i = (i + 1) & this->mask();
+            slots[i] = {static_cast<std::uint32_t>(entries[e].hash >> 32),
+                        static_cast<std::uint32_t>(e + 1)};
+        }
+    }
+
+    // Empties the slot, and moves the slots after it that would be found sooner back, so that no
+    // probe for them passes the empty slot
+    void empty(std::size_t i)
+    {
+        for (auto j = (i + 1) & this->mask(); slots[j].entry != 0; j = (j + 1) & this->mask()) {
+            const auto home = entries[slots[j].entry - 1].hash & this->mask();
+            // Whether the home of the entry in j is cyclically outside (i, j]
+            if (((j - home) & this->mask()) >= ((j - i) & this->mask())) {
+                slots[i] = slots[j];
+                i = j;
+            }
+        }
+        slots[i] = Slot{};
+    }
+};
+
+Dictionary::Dictionary()
+    : table_{std::make_shared<Table>()}
+{}
+
+std::size_t Dictionary::size() const
+{
+    return table_->entries.size();
+}
+
+const ObjectReference* Dictionary::find(const ObjectReference& key, std::size_t hash) const
+{
+    const auto& slot = table_->slots[table_->find(key, mix(hash))];
+    if (slot.entry == 0) return nullptr;
+    return &table_->entries[slot.entry - 1].value;
+}
+
+void Dictionary::put(ObjectReference key, std::size_t hash, ObjectReference value) const
+{
+    auto& table = *table_;
+    const auto mixed = mix(hash);
+    auto i = table.find(key, mixed);
+    if (table.slots[i].entry != 0) {
+        table.entries[table.slots[i].entry - 1].value = std::move(value);
+        return;
+    }
+
+    if ((table.entries.size() + 1) * 4 > table.slots.size() * 3) {
+        table.grow();
+        i = table.find(key, mixed);
+    }
+    table.entries.push_back({mixed, std::move(key), std::move(value)});
+    table.slots[i] = {static_cast<std::uint32_t>(mixed >> 32),
+                      static_cast<std::uint32_t>(table.entries.size())};
+}
+
+bool Dictionary::remove(const ObjectReference& key, std::size_t hash) const
+{
+    auto& table = *table_;
+    const auto i = table.find(key, mix(hash));
+    if (table.slots[i].entry == 0) return false;
+
+    const auto removed = table.slots[i].entry - 1;
+    table.empty(i);
+
+    // Move the last entry into the removed one's place, and point its slot there
+    const auto last = table.entries.size() - 1;
+    if (removed != last) {
+        auto& moved = table.entries[last];
+        auto& slot = table.slots[table.find(moved.key, moved.hash)];
+        slot.entry = static_cast<std::uint32_t>(removed + 1);
+        table.entries[removed] = std::move(moved);
+    }
+    table.entries.pop_back();
+    return true;
+}
+
+const ObjectReference& Dictionary::key(std::size_t index) const
+{
+    return table_->entries[index].key;
+}
+
+const ObjectReference& Dictionary::value(std::size_t index) const
+{
+    return table_->entries[index].value;
+}
+
+bool operator==(const Dictionary& a, const Dictionary& b)
+{
+    return a.table_ == b.table_;
+}
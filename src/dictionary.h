@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+
+struct ObjectReference;
+
+// A mutable map from values to objects, which, like a list, every copy of the dictionary shares,
+// so a dictionary is only equal to itself. Keys must be values hash_value can hash, and are
+// compared with same_value. The builtins store -0 as 0 and reject NaN, so that keys match when
+// == says they're equal.
+//
+// The entries are kept next to each other, each with its key's hash, and are found through an
+// open-addressing table of small slots, probed linearly, that hold the index of an entry and part
+// of its hash, so most probes that don't match never touch the entry. Removing an entry moves the
+// last one into its place, so the order of the entries is only kept until something is removed.
+struct Dictionary {
+    Dictionary();
+
+    std::size_t size() const;
+
+    // Null if the key isn't in the dictionary. The hash must be hash_value's hash of the key.
+    const ObjectReference* find(const ObjectReference& key, std::size_t hash) const;
+    void put(ObjectReference key, std::size_t hash, ObjectReference value) const;
+    // Whether the key was in the dictionary
+    bool remove(const ObjectReference& key, std::size_t hash) const;
+
+    // The entries in order, for the index less than the size
+    const ObjectReference& key(std::size_t index) const;
+    const ObjectReference& value(std::size_t index) const;
+
+    friend bool operator==(const Dictionary&, const Dictionary&);
+private:
+    struct Table;
+    std::shared_ptr<Table> table_;
+};
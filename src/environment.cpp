@@ -5,25 +5,82 @@
 #include "token.h"
 #include "function_input.h"
 
+#include <cassert>
 #include <string>
 #include <cmath>
 
-void Environment::define(std::string name, ObjectReference value)
+Cell::Cell(ObjectReference value, bool boxed)
+    : contents_{std::move(value)}
 {
-    values_.insert_or_assign(std::move(name), std::move(value));
+    if (!boxed) return;
+    auto& value_to_box = std::get<ObjectReference>(contents_);
+    contents_ = std::make_shared<ObjectReference>(std::move(value_to_box));
+}
+
+Cell Cell::undefined()
+{
+    return Cell{std::shared_ptr<ObjectReference>{}};
+}
+
+const ObjectReference* Cell::get() const
+{
+    if (const auto value = std::get_if<ObjectReference>(&contents_)) return value;
+    return std::get<std::shared_ptr<ObjectReference>>(contents_).get();
+}
+
+void Cell::define(ObjectReference value, bool boxed)
+{
+    if (const auto box = std::get_if<std::shared_ptr<ObjectReference>>(&contents_)) {
+        assert(*box && "Only captured variables are undefined");
+        **box = std::move(value);
+    } else {
+        *this = Cell{std::move(value), boxed};
+    }
+}
+
+void Cell::assign(ObjectReference value)
+{
+    if (const auto box = std::get_if<std::shared_ptr<ObjectReference>>(&contents_)) {
+        assert(*box && "Only captured variables are undefined");
+        **box = std::move(value);
+    } else {
+        std::get<ObjectReference>(contents_) = std::move(value);
+    }
+}
+
+bool Cell::assign_boxed(ObjectReference value) const
+{
+    const auto& box = std::get<std::shared_ptr<ObjectReference>>(contents_);
+    if (!box) return false;
+    *box = std::move(value);
+    return true;
+}
+
+bool Cell::boxed() const
+{
+    return std::holds_alternative<std::shared_ptr<ObjectReference>>(contents_);
+}
+
+void Environment::define(std::string_view name, ObjectReference value, bool boxed)
+{
+    if (globals_) return globals_->define(name, std::move(value));
+
+    const auto [it, inserted] = values_.try_emplace(std::string{name}, value, boxed);
+    if (!inserted) it->second.define(std::move(value), boxed);
 }
 
 void Environment::assign(const Token& token, ObjectReference value) {
-    const auto it = values_.find(token.lexeme);
-    if (it == values_.end()) {
-        if (enclosing_) {
-            enclosing_->assign(token, std::move(value));
-        } else {
-            throw RuntimeError(token, "undefined variable '" + token.lexeme + "'");
+    const std::string name{token.lexeme()};
+    for (auto* environment = this; environment; environment = environment->enclosing_.get()) {
+        if (environment->globals_) return environment->globals_->assign(token, std::move(value));
+
+        const auto it = environment->values_.find(name);
+        if (it != environment->values_.end()) {
+            it->second.assign(std::move(value));
+            return;
         }
-    } else {
-        values_.insert_or_assign(token.lexeme, std::move(value));
     }
+    throw RuntimeError(token, "undefined variable '" + name + "'");
 }
 
 void Environment::assign_at(const Token& token, ObjectReference value, int depth)
@@ -32,22 +89,48 @@ void Environment::assign_at(const Token& token, ObjectReference value, int depth
 }
 
 const ObjectReference& Environment::get(const Token& token) const {
-    const auto it = values_.find(token.lexeme);
-    if (it == values_.end()) {
-        if (enclosing_) return enclosing_->get(token);
-        throw RuntimeError(token, "undefined variable '" + token.lexeme + "'");
+    const std::string name{token.lexeme()};
+    for (auto* environment = this; environment; environment = environment->enclosing_.get()) {
+        if (environment->globals_) return environment->globals_->get(token);
+
+        const auto it = environment->values_.find(name);
+        if (it != environment->values_.end()) return *it->second.get();
     }
-    return it->second;
+    throw RuntimeError(token, "undefined variable '" + name + "'");
 }
 
 const ObjectReference& Environment::get_at(const Token& token, int depth) const
 {
     auto* relevant_environment = this->ancestor(depth);
-    auto x = relevant_environment->values_.find(token.lexeme);
+    if (relevant_environment->globals_) return relevant_environment->globals_->get(token);
+
+    const std::string name{token.lexeme()};
+    auto x = relevant_environment->values_.find(name);
     if (x == relevant_environment->values_.end()) {
-        throw RuntimeError(token, "undefined variable '" + token.lexeme + "'");
+        throw RuntimeError(token, "undefined variable '" + name + "'");
+    }
+    return *x->second.get();
+}
+
+Cell Environment::capture(std::string_view name, int depth) const
+{
+    const auto* environment = this->ancestor(depth);
+    assert(!environment->globals_ && "Globals are never captured");
+
+    const auto it = environment->values_.find(std::string{name});
+    return it == environment->values_.end() ? Cell::undefined() : it->second;
+}
+
+Set Environment::set() const
+{
+    if (globals_) return globals_->set();
+
+    Set::Members members;
+    members.reserve(values_.size());
+    for (const auto& [name, cell] : values_) {
+        members.emplace_back(name, *cell.get());
     }
-    return x->second;
+    return Set{std::move(members)};
 }
 
 const Environment* Environment::ancestor(int distance) const
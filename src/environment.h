@@ -1,20 +1,56 @@
 #pragma once
 
+#include "globals.h"
 #include "object.h"
 #include "token.h"
 
 #include <unordered_map>
 #include <string>
+#include <string_view>
 #include <memory>
+#include <variant>
 
-extern std::shared_ptr<Environment> global_environment;
+// Holds a variable's value. A variable that closures capture is copied into them, unless it can
+// change afterwards, in which case it's kept in a box that the closures share with the scope it's
+// defined in.
+struct Cell {
+    Cell(ObjectReference value, bool boxed = false);
+
+    // A box with nothing in it, for a variable that wasn't defined when it was captured
+    static Cell undefined();
+
+    // Null if the variable is undefined
+    const ObjectReference* get() const;
+
+    // Defining a variable again keeps its box, so that closures sharing it see the new value
+    void define(ObjectReference value, bool boxed);
+    void assign(ObjectReference value);
+
+    // Only a variable in a box can be assigned through a closure. Returns false if it's undefined.
+    bool assign_boxed(ObjectReference value) const;
+
+    // Whether the variable is in a box, so that it can change after it's captured
+    bool boxed() const;
+private:
+    Cell(std::shared_ptr<ObjectReference> box)
+        : contents_{std::move(box)}
+    {}
+
+    std::variant<ObjectReference, std::shared_ptr<ObjectReference>> contents_;
+};
 
 struct Environment {
     Environment(std::shared_ptr<Environment> enclosing = nullptr)
         : enclosing_{std::move(enclosing)}
     {}
 
-    void define(std::string name, ObjectReference value);
+    // The environment of a program's or a module's top level, whose variables live in the global
+    // table
+    explicit Environment(Globals& globals)
+        : globals_{&globals}
+    {}
+
+    void define(std::string_view name, ObjectReference value, bool boxed = false);
 
     void assign(const Token& token, ObjectReference value);
     void assign_at(const Token& token, ObjectReference value, int depth);
@@ -22,13 +58,17 @@ struct Environment {
     const ObjectReference& get(const Token& token) const;
     const ObjectReference& get_at(const Token& token, int depth) const;
 
-    const Set& set() const { return values_; }
-    Set& set() { return values_; }
+    // The variable's cell, to be copied into a closure
+    Cell capture(std::string_view name, int depth) const;
+
+    // The values of the variables, which is what a module is made of
+    Set set() const;
 private:
     const Environment* ancestor(int distance) const;
     Environment* ancestor(int distance);
 
     std::shared_ptr<Environment> enclosing_;
-    std::unordered_map<std::string, ObjectReference> values_;
+    std::unordered_map<std::string, Cell> values_;
+    Globals* globals_ = nullptr;
 };
 
@@ -0,0 +1,198 @@
+#include "field_offsets.h"
+#include "object.h"
+
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// Collects the slots of the fields of the record types declared anywhere in the ast, including in
+// imported files, and the caches of the ast's own field accesses
+struct Collector : Ast::Expression::Visitor<void>, Ast::Statement::Visitor<void> {
+    void collect(const Ast::Ast& statements, bool imported = false);
+    void collect(const Ast::Statement& s) { s.accept(*this); }
+    void collect(const Ast::Expression& e) { e.accept(*this); }
+
+    // A null shape if the field is in more than one shape
+    std::unordered_map<std::string_view, MemberCache> fields;
+    std::vector<std::pair<std::string_view, MemberCache*>> accesses;
+
+    void operator()(const Ast::Assign&) override;
+    void operator()(const Ast::AssignMember&) override;
+    void operator()(const Ast::Binary&) override;
+    void operator()(const Ast::Call&) override;
+    void operator()(const Ast::Function&) override;
+    void operator()(const Ast::Get&) override;
+    void operator()(const Ast::Grouping&) override;
+    void operator()(const Ast::Inlined&) override;
+    void operator()(const Ast::Literal&) override;
+    void operator()(const Ast::Logical&) override;
+    void operator()(const Ast::Tuple&) override;
+    void operator()(const Ast::Unary&) override;
+    void operator()(const Ast::Variable&) override;
+    void operator()(const Ast::VariableTuple&) override;
+
+    void operator()(const Ast::Block&) override;
+    void operator()(const Ast::ExpressionStatement&) override;
+    void operator()(const Ast::If&) override;
+    void operator()(const Ast::Return&) override;
+    void operator()(const Ast::While&) override;
+    void operator()(const Ast::Declaration&) override;
+    void operator()(const Ast::Import&) override;
+private:
+    void add(const RecordType&);
+    void add(const Token& name, MemberCache& cache);
+
+    bool imported_ = false;
+};
+
+void Collector::collect(const Ast::Ast& statements, bool imported)
+{
+    const auto was_imported = imported_;
+    imported_ = imported;
+    for (const auto& statement : statements) this->collect(*statement);
+    imported_ = was_imported;
+}
+
+void Collector::add(const RecordType& type)
+{
+    const auto& shape = type.shape();
+    for (std::uint32_t slot = 0; slot < shape.names.size(); ++slot) {
+        const auto [field, added] = fields.emplace(shape.names[slot], MemberCache{&shape, slot});
+        if (!added && field->second.shape != &shape) field->second = {};
+    }
+}
+
+void Collector::add(const Token& name, MemberCache& cache)
+{
+    if (!imported_) accesses.emplace_back(name.lexeme(), &cache);
+}
+
+void Collector::operator()(const Ast::Block& b)
+{
+    for (const auto& statement : b.statements) this->collect(*statement);
+}
+
+void Collector::operator()(const Ast::ExpressionStatement& es)
+{
+    if (es.expression) this->collect(**es.expression);
+}
+
+void Collector::operator()(const Ast::If& i)
+{
+    this->collect(*i.condition);
+    this->collect(*i.then_branch);
+    if (i.else_branch) this->collect(**i.else_branch);
+}
+
+void Collector::operator()(const Ast::Return& r)
+{
+    if (r.expression) this->collect(**r.expression);
+}
+
+void Collector::operator()(const Ast::While& w)
+{
+    this->collect(*w.condition);
+    this->collect(*w.body);
+}
+
+void Collector::operator()(const Ast::Declaration& d)
+{
+    if (d.initializer) this->collect(**d.initializer);
+}
+
+void Collector::operator()(const Ast::Import& i)
+{
+    if (i.ast) this->collect(*i.ast, true);
+}
+
+void Collector::operator()(const Ast::Assign& a)
+{
+    this->collect(*a.expression);
+}
+
+void Collector::operator()(const Ast::AssignMember& a)
+{
+    this->collect(*a.object);
+    this->collect(*a.expression);
+    this->add(a.name, a.cache);
+}
+
+void Collector::operator()(const Ast::Binary& b)
+{
+    this->collect(*b.left);
+    this->collect(*b.right);
+}
+
+void Collector::operator()(const Ast::Call& c)
+{
+    this->collect(*c.callee);
+    for (std::size_t i = 0; i < c.input.size(); ++i) this->collect(*c.input[i]);
+}
+
+void Collector::operator()(const Ast::Function& f)
+{
+    this->collect(*f.body);
+}
+
+void Collector::operator()(const Ast::Get& g)
+{
+    this->collect(*g.object);
+    this->add(g.name, g.cache);
+}
+
+void Collector::operator()(const Ast::Grouping& g)
+{
+    this->collect(*g.expression);
+}
+
+void Collector::operator()(const Ast::Inlined& i)
+{
+    for (std::size_t j = 0; j < i.arguments.size(); ++j) this->collect(*i.arguments[j]);
+    this->collect(*i.body);
+    if (i.result) this->collect(**i.result);
+}
+
+void Collector::operator()(const Ast::Literal& l)
+{
+    if (l.value.holds<RecordType>()) this->add(l.value.get_unchecked<RecordType>());
+}
+
+void Collector::operator()(const Ast::Logical& l)
+{
+    this->collect(*l.left);
+    this->collect(*l.right);
+}
+
+void Collector::operator()(const Ast::Tuple& t)
+{
+    for (const auto& element : t.elements) this->collect(*element);
+}
+
+void Collector::operator()(const Ast::Unary& u)
+{
+    this->collect(*u.right);
+}
+
+void Collector::operator()(const Ast::Variable&)
+{
+}
+
+void Collector::operator()(const Ast::VariableTuple&)
+{
+}
+
+}  // Namespace
+
+void resolve_field_offsets(const Ast::Ast& ast)
+{
+    Collector collector;
+    collector.collect(ast);
+
+    for (const auto& [name, cache] : collector.accesses) {
+        const auto field = collector.fields.find(name);
+        if (field != collector.fields.end() && field->second.shape) *cache = field->second;
+    }
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include "ast.h"
+
+// Sets the member caches of the field accesses and assignments in the ast, u:x and u:x = v, to the
+// slots of their fields, so that they're found without looking their names up, even the first
+// time. The type of a record isn't followed through variables, so a field's slot is only known if
+// every record type declared in the ast, or in the files it imports, that has a field with the
+// name has it in the same slot of the same shape. Other accesses, and those of records of types
+// declared elsewhere, find their slots when they're first evaluated, like accesses of modules'
+// members.
+void resolve_field_offsets(const Ast::Ast&);
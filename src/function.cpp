@@ -2,15 +2,16 @@
 #include "token.h"
 #include "ast.h"
 #include "environment.h"
+#include "resolver.h"
+#include "memo.h"
 
+#include <cassert>
 #include <memory>
 
-Function::Function(const Ast::Function& f, std::shared_ptr<Environment> e)
-    : expression_{std::make_unique<Ast::Function>(f)}, closure_{std::move(e)}
-{}
-
-Function::Function(Ast::Function&& f, std::shared_ptr<Environment> e)
-    : expression_{std::make_unique<Ast::Function>(std::move(f))}, closure_{std::move(e)}
+Function::Function(const Ast::Function& f, std::shared_ptr<Environment> e,
+                   std::vector<Cell> captures, std::shared_ptr<Globals> globals)
+    : expression_{std::make_unique<Ast::Function>(f)}, closure_{std::move(e)},
+      captures_{std::move(captures)}, globals_{std::move(globals)}
 {}
 
 const Ast::Function& Function::expression() const
@@ -23,6 +24,29 @@ const std::shared_ptr<Environment>& Function::closure() const
     return closure_;
 }
 
+const std::vector<Cell>& Function::captures() const
+{
+    return captures_;
+}
+
+const std::shared_ptr<Globals>& Function::globals() const
+{
+    return globals_;
+}
+
+Function Function::memoized(std::size_t capacity) const
+{
+    Function plain{*expression_, closure_, captures_, globals_};
+    Function f{*expression_, closure_, captures_, globals_};
+    f.memo_ = std::make_shared<MemoCache>(std::move(plain), capacity);
+    return f;
+}
+
+const std::shared_ptr<MemoCache>& Function::memo() const
+{
+    return memo_;
+}
+
 std::size_t Function::id() const
 {
     return reinterpret_cast<std::size_t>(this->expression().body.get());
@@ -37,3 +61,20 @@ bool operator==(const Function& a, const Function& b)
     return a.id() == b.id();
 }
 
+std::vector<Cell> capture(const Ast::Function& f, const Environment& environment,
+                          const std::vector<Cell>* enclosing_captures)
+{
+    assert(f.captures && "Functions are resolved before they're created");
+
+    std::vector<Cell> captures;
+    captures.reserve(f.captures->size());
+    for (const auto& capture : *f.captures) {
+        if (is_captured(capture.location)) {
+            assert(enclosing_captures);
+            captures.push_back((*enclosing_captures)[captured_index(capture.location)]);
+        } else {
+            captures.push_back(environment.capture(capture.name.lexeme(), capture.location));
+        }
+    }
+    return captures;
+}
@@ -7,13 +7,16 @@
 struct Statement;
 struct Token;
 struct Environment;
+struct Cell;
+struct Globals;
 namespace Ast {
     struct Function;
 }
+struct MemoCache;
 
 struct Function {
-    Function(const Ast::Function&, std::shared_ptr<Environment>);
-    Function(Ast::Function&&, std::shared_ptr<Environment>);
+    Function(const Ast::Function&, std::shared_ptr<Environment>, std::vector<Cell> captures,
+             std::shared_ptr<Globals>);
 
     Function(const Function&) = delete;
     Function& operator=(const Function&) = delete;
@@ -25,25 +28,52 @@ struct Function {
     ~Function();
 
     const Ast::Function& expression() const;
+    // The top level of the file the function was defined in, which encloses its calls
     const std::shared_ptr<Environment>& closure() const;
+    // The variables the function uses from the other scopes it was defined in, in the order of
+    // Ast::Function::captures
+    const std::vector<Cell>& captures() const;
+    // The global table of the file the function was defined in, which its calls use
+    const std::shared_ptr<Globals>& globals() const;
     std::size_t id() const;
+
+    // A copy of the function that keeps the results of up to capacity of its calls, see MemoCache
+    Function memoized(std::size_t capacity) const;
+    // Null unless the function is memoized
+    const std::shared_ptr<MemoCache>& memo() const;
 private:
     // This is only a pointer because of a circular dependency C++ issue meaning it can't be a
     // concrete type
     std::unique_ptr<Ast::Function> expression_;
 
     std::shared_ptr<Environment> closure_;
+    std::vector<Cell> captures_;
+    std::shared_ptr<Globals> globals_;
+
+    std::shared_ptr<MemoCache> memo_;
 };
 
 bool operator==(const Function&, const Function&);
 
+// Copies the variables a function captures out of the environment it's being created in and the
+// captures of the function it's created inside of, if any
+std::vector<Cell> capture(const Ast::Function&, const Environment&,
+                          const std::vector<Cell>* enclosing_captures);
+
 #include <functional>
 #include <string>
 
 struct ObjectReference;
 
+// Calls a function, builtin or record type, for builtins that are given something to call
+using Caller = std::function<ObjectReference(const ObjectReference& callee,
+                                             const FunctionInput<ObjectReference>&, const Token&)>;
+
 struct BuiltInFunction {
     std::string name;
     std::function<ObjectReference(const FunctionInput<ObjectReference>&, const Token&)> call;
+    // Used instead of call by builtins that call back into the program
+    std::function<ObjectReference(const FunctionInput<ObjectReference>&, const Token&,
+                                  const Caller&)> call_back = nullptr;
 };
 
@@ -49,6 +49,10 @@ struct FunctionInput {
         assert(this->size() > i);
         return *reinterpret_cast<const T*>(this->get_aligned_buffer(i));
     }
+    T& operator[](std::size_t i) noexcept {
+        assert(this->size() > i);
+        return *reinterpret_cast<T*>(this->get_aligned_buffer(i));
+    }
     const T& at(std::size_t i) const noexcept {
         assert(this->size() > i);
         return *reinterpret_cast<const T*>(this->get_aligned_buffer(i));
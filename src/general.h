@@ -1,10 +1,5 @@
 #pragma once
 
-#include <fstream>
-#include <string>
-#include <sstream>
-#include <string_view>
-
 template <typename... F>
 inline auto combine(F... f) {
     struct S : F... {
@@ -13,11 +8,3 @@ inline auto combine(F... f) {
     return S{f...};
 }
 
-inline std::string read_file(std::string_view filepath)
-{
-    const auto file = std::ifstream{filepath.data()};
-    std::stringstream buffer;
-    buffer << file.rdbuf();
-    return buffer.str();
-}
-
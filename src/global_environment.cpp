@@ -1,17 +1,91 @@
+#include "globals.h"
+#include "ast.h"
 #include "environment.h"
+#include "error.h"
+#include "mapped_file.h"
+#include "memo.h"
 
+#include <algorithm>
 #include <chrono>
+#include <cmath>
 #include <iostream>
-#include <iterator>
-#include <fstream>
 
-std::shared_ptr<Environment> global_environment = [] {
-    auto ge = std::make_shared<Environment>(nullptr);
+namespace {
+
+const List& list_input(const FunctionInput<ObjectReference>& input, const Token& token,
+                       const char* error)
+{
+    if (input.size() == 0 || !input[0].holds<List>()) throw RuntimeError(token, error);
+    return input[0].get_unchecked<List>();
+}
+
+std::size_t list_index(const List& list, const ObjectReference& index, const Token& token)
+{
+    const auto i = index.holds<double>() ? index.get_unchecked<double>() : -1.0;
+    if (!(i >= 0) || i != std::floor(i) || i >= static_cast<double>(list.size())) {
+        throw RuntimeError(token, "list index out of range");
+    }
+    return static_cast<std::size_t>(i);
+}
+
+// Keys are compared like == compares them, so -0 is the same key as 0, and NaN, which isn't equal
+// to anything, can't be a key. Tuples are only copied if they hold a -0.
+std::optional<ObjectReference> normalized_key(const ObjectReference& key, const Token& token)
+{
+    if (key.holds<double>()) {
+        const auto x = key.get_unchecked<double>();
+        if (std::isnan(x)) throw RuntimeError(token, "dictionary keys can't be NaN");
+        if (x == 0 && std::signbit(x)) return ObjectReference{0.0};
+        return {};
+    }
+    if (!key.holds<Tuple>()) return {};
+
+    const auto& elements = key.get_unchecked<Tuple>();
+    std::optional<Tuple> normalized;
+    for (std::size_t i = 0; i < elements.size(); ++i) {
+        auto element = normalized_key(elements[i], token);
+        if (!element) continue;
+        if (!normalized) normalized = elements;
+        (*normalized)[i] = std::move(*element);
+    }
+    if (!normalized) return {};
+    return ObjectReference{std::move(*normalized)};
+}
+
+struct Key {
+    ObjectReference value;
+    std::size_t hash;
+};
+
+Key dictionary_key(const ObjectReference& key, const Token& token)
+{
+    auto normalized = normalized_key(key, token);
+    const auto& value = normalized ? *normalized : key;
+    const auto hash = hash_value(value);
+    if (!hash) {
+        throw RuntimeError(token, "dictionary keys can only be nil, booleans, numbers, strings or "
+                                  "tuples of those");
+    }
+    return {value, *hash};
+}
+
+const Dictionary& dictionary_input(const FunctionInput<ObjectReference>& input,
+                                   const Token& token, const char* error)
+{
+    if (input.size() == 0 || !input[0].holds<Dictionary>()) throw RuntimeError(token, error);
+    return input[0].get_unchecked<Dictionary>();
+}
+
+}  // Namespace
+
+Globals builtin_globals()
+{
+    Globals globals;
     const auto begin = std::chrono::high_resolution_clock::now();
 
     auto clock = BuiltInFunction{
         "clock",
-        [&begin](const FunctionInput<ObjectReference>&, const Token&) -> ObjectReference {
+        [begin](const FunctionInput<ObjectReference>&, const Token&) -> ObjectReference {
             auto now = std::chrono::high_resolution_clock::now();
             return static_cast<double>(
                 std::chrono::duration_cast<std::chrono::milliseconds>(now - begin).count());
@@ -27,10 +101,9 @@ std::shared_ptr<Environment> global_environment = [] {
             } else {
                 if (!input[0].holds<std::string>()) return nullptr;
 
-                const auto& s = input[0].get<std::string>();
-                std::ifstream ifs{s};
-                std::string text(std::istreambuf_iterator<char>{ifs}, {});
-                return text;
+                // Copied once, straight out of the mapping if the file could be mapped
+                const MappedFile file{input[0].get<std::string>()};
+                return std::string{file.data()};
             }
         }
     };
@@ -43,9 +116,236 @@ std::shared_ptr<Environment> global_environment = [] {
         }
     };
 
-    ge->define("clock", std::move(clock));
-    ge->define("read", std::move(read));
-    ge->define("print", std::move(print));
-    return ge;
-}();
+    // f.memo or f.memo(capacity), for a function that infer_purity found to be pure
+    auto memo = BuiltInFunction{
+        "memo",
+        [](const FunctionInput<ObjectReference>& input, const Token& token) -> ObjectReference {
+            if (input.size() == 0 || !input[0].holds<Function>()) {
+                throw RuntimeError(token, "can only memoize functions");
+            }
+            const auto& f = input[0].get<Function>();
+            const auto& captures = f.captures();
+            const auto boxed = std::any_of(captures.begin(), captures.end(),
+                                           [](const Cell& c) { return c.boxed(); });
+            if (!f.expression().pure || boxed) {
+                throw RuntimeError(token, "can only memoize pure functions");
+            }
+
+            auto capacity = MemoCache::default_capacity;
+            if (input.size() == 2) {
+                const auto n = input[1].holds<double>() ? input[1].get<double>() : 0.0;
+                if (!(n >= 1) || n != std::floor(n) || n > 1e15) {
+                    throw RuntimeError(token, "the capacity of a memo must be a positive whole "
+                                              "number");
+                }
+                capacity = static_cast<std::size_t>(n);
+            }
+            return f.memoized(capacity);
+        }
+    };
+    // How well a memoized function's cache is doing, as a module
+    auto memostats = BuiltInFunction{
+        "memostats",
+        [](const FunctionInput<ObjectReference>& input, const Token& token) -> ObjectReference {
+            if (input.size() == 0 || !input[0].holds<Function>() ||
+                !input[0].get<Function>().memo())
+            {
+                throw RuntimeError(token, "can only get the statistics of memoized functions");
+            }
+            const auto& cache = *input[0].get<Function>().memo();
+            return Set{{
+                {"hits", static_cast<double>(cache.hits())},
+                {"misses", static_cast<double>(cache.misses())},
+                {"entries", static_cast<double>(cache.size())},
+                {"capacity", static_cast<double>(cache.capacity())},
+            }};
+        }
+    };
+
+    // .list, (a, b, c).list, n.list(x) for n copies of x, or l.list for a copy of the list l
+    auto list = BuiltInFunction{
+        "list",
+        [](const FunctionInput<ObjectReference>& input, const Token& token) -> ObjectReference {
+            List l;
+            if (input.size() == 2) {
+                const auto n = input[0].holds<double>() ? input[0].get_unchecked<double>() : -1.0;
+                if (!(n >= 0) || n != std::floor(n) || n > 1e15) {
+                    throw RuntimeError(token, "the length of a list must be a whole number");
+                }
+                l.resize(static_cast<std::size_t>(n), input[1]);
+            } else if (input.size() == 1 && input[0].holds<Tuple>()) {
+                for (const auto& element : input[0].get_unchecked<Tuple>()) l.push(element);
+            } else if (input.size() == 1 && input[0].holds<List>()) {
+                const auto& other = input[0].get_unchecked<List>();
+                for (std::size_t i = 0; i < other.size(); ++i) l.push(other.get(i));
+            } else if (input.size() == 1) {
+                l.push(input[0]);
+            }
+            return l;
+        }
+    };
+    auto size = BuiltInFunction{
+        "size",
+        [](const FunctionInput<ObjectReference>& input, const Token& token) -> ObjectReference {
+            if (input.size() > 0 && input[0].holds<Dictionary>()) {
+                return static_cast<double>(input[0].get_unchecked<Dictionary>().size());
+            }
+            const auto& l = list_input(input, token,
+                                       "can only get the size of lists and dictionaries");
+            return static_cast<double>(l.size());
+        }
+    };
+    // l.get(i), or d.get(key), which is nil if the key isn't in the dictionary d
+    auto get = BuiltInFunction{
+        "get",
+        [](const FunctionInput<ObjectReference>& input, const Token& token) -> ObjectReference {
+            if (input.size() == 2 && input[0].holds<Dictionary>()) {
+                const auto& d = input[0].get_unchecked<Dictionary>();
+                const auto key = dictionary_key(input[1], token);
+                const auto value = d.find(key.value, key.hash);
+                return value ? *value : nullptr;
+            }
+            const auto& l = list_input(input, token,
+                                       "can only get elements of lists and dictionaries");
+            if (input.size() != 2) throw RuntimeError(token, "get needs an index");
+            return l.get(list_index(l, input[1], token));
+        }
+    };
+    // l.put(i, x), or d.put(key, x)
+    auto put = BuiltInFunction{
+        "put",
+        [](const FunctionInput<ObjectReference>& input, const Token& token) -> ObjectReference {
+            if (input.size() != 2 || !input[1].holds<Tuple>() ||
+                input[1].get_unchecked<Tuple>().size() != 2)
+            {
+                throw RuntimeError(token, "put needs an index or a key, and a value");
+            }
+            const auto& arguments = input[1].get_unchecked<Tuple>();
+            if (input[0].holds<Dictionary>()) {
+                const auto& d = input[0].get_unchecked<Dictionary>();
+                auto key = dictionary_key(arguments[0], token);
+                d.put(std::move(key.value), key.hash, arguments[1]);
+                return nullptr;
+            }
+            const auto& l = list_input(input, token,
+                                       "can only put elements in lists and dictionaries");
+            l.put(list_index(l, arguments[0], token), arguments[1]);
+            return nullptr;
+        }
+    };
+    // l.push(x)
+    auto push = BuiltInFunction{
+        "push",
+        [](const FunctionInput<ObjectReference>& input, const Token& token) -> ObjectReference {
+            const auto& l = list_input(input, token, "can only push onto lists");
+            if (input.size() != 2) throw RuntimeError(token, "push needs a value");
+            l.push(input[1]);
+            return nullptr;
+        }
+    };
+    auto pop = BuiltInFunction{
+        "pop",
+        [](const FunctionInput<ObjectReference>& input, const Token& token) -> ObjectReference {
+            const auto& l = list_input(input, token, "can only pop from lists");
+            if (l.size() == 0) throw RuntimeError(token, "can't pop from an empty list");
+            return l.pop();
+        }
+    };
+    // The elements of a list, as a tuple
+    auto tuple = BuiltInFunction{
+        "tuple",
+        [](const FunctionInput<ObjectReference>& input, const Token& token) -> ObjectReference {
+            const auto& l = list_input(input, token, "can only make tuples of lists");
+            Tuple t;
+            t.reserve(l.size());
+            for (std::size_t i = 0; i < l.size(); ++i) t.push_back(l.get(i));
+            return t;
+        }
+    };
+    // l.each(f) calls f with every element of l in order. Elements pushed while it runs are
+    // visited too, and popping them ends it early.
+    auto each = BuiltInFunction{
+        "each",
+        nullptr,
+        [](const FunctionInput<ObjectReference>& input, const Token& token,
+           const Caller& call) -> ObjectReference {
+            const auto& l = list_input(input, token, "can only go through the elements of lists");
+            if (input.size() != 2) throw RuntimeError(token, "each needs a function");
+            const auto& f = input[1];
+            for (std::size_t i = 0; i < l.size(); ++i) {
+                call(f, FunctionInput<ObjectReference>(l.get(i)), token);
+            }
+            return nullptr;
+        }
+    };
+
+    auto dictionary = BuiltInFunction{
+        "dictionary",
+        [](const FunctionInput<ObjectReference>&, const Token&) -> ObjectReference {
+            return Dictionary{};
+        }
+    };
+    // d.has(key)
+    auto has = BuiltInFunction{
+        "has",
+        [](const FunctionInput<ObjectReference>& input, const Token& token) -> ObjectReference {
+            const auto& d = dictionary_input(input, token, "can only look keys up in dictionaries");
+            if (input.size() != 2) throw RuntimeError(token, "has needs a key");
+            const auto key = dictionary_key(input[1], token);
+            return d.find(key.value, key.hash) != nullptr;
+        }
+    };
+    // d.remove(key), which is whether the key was in the dictionary
+    auto remove = BuiltInFunction{
+        "remove",
+        [](const FunctionInput<ObjectReference>& input, const Token& token) -> ObjectReference {
+            const auto& d = dictionary_input(input, token,
+                                             "can only remove keys from dictionaries");
+            if (input.size() != 2) throw RuntimeError(token, "remove needs a key");
+            const auto key = dictionary_key(input[1], token);
+            return d.remove(key.value, key.hash);
+        }
+    };
+    // The keys and the values of a dictionary, as lists in the same order
+    auto keys = BuiltInFunction{
+        "keys",
+        [](const FunctionInput<ObjectReference>& input, const Token& token) -> ObjectReference {
+            const auto& d = dictionary_input(input, token, "can only get the keys of dictionaries");
+            List l;
+            for (std::size_t i = 0; i < d.size(); ++i) l.push(d.key(i));
+            return l;
+        }
+    };
+    auto values = BuiltInFunction{
+        "values",
+        [](const FunctionInput<ObjectReference>& input, const Token& token) -> ObjectReference {
+            const auto& d = dictionary_input(input, token,
+                                             "can only get the values of dictionaries");
+            List l;
+            for (std::size_t i = 0; i < d.size(); ++i) l.push(d.value(i));
+            return l;
+        }
+    };
+
+    globals.define("clock", std::move(clock));
+    globals.define("read", std::move(read));
+    globals.define("print", std::move(print));
+    globals.define("memo", std::move(memo));
+    globals.define("memostats", std::move(memostats));
+    globals.define("list", std::move(list));
+    globals.define("size", std::move(size));
+    globals.define("get", std::move(get));
+    globals.define("put", std::move(put));
+    globals.define("push", std::move(push));
+    globals.define("pop", std::move(pop));
+    globals.define("tuple", std::move(tuple));
+    globals.define("each", std::move(each));
+    globals.define("dictionary", std::move(dictionary));
+    globals.define("has", std::move(has));
+    globals.define("remove", std::move(remove));
+    globals.define("keys", std::move(keys));
+    globals.define("values", std::move(values));
+    globals.mark_builtins();
+    return globals;
+}
 
@@ -0,0 +1,87 @@
+#include "globals.h"
+#include "error.h"
+
+#include <cassert>
+
+std::size_t Globals::slot(std::string_view name)
+{
+    auto& [names, slots] = *slots_;
+    if (const auto it = slots.find(name); it != slots.end()) return it->second;
+
+    names.emplace_back(name);
+    return slots.emplace(names.back(), names.size() - 1).first->second;
+}
+
+void Globals::define(std::size_t slot, ObjectReference value)
+{
+    assert(slot < slots_->names.size());
+    if (slot >= values_.size()) {
+        values_.resize(slot + 1);
+        defined_.resize(slot + 1);
+    }
+    values_[slot] = std::move(value);
+    defined_[slot] = true;
+}
+
+void Globals::assign(std::size_t slot, const Token& token, ObjectReference value)
+{
+    if (slot >= values_.size() || !values_[slot]) {
+        throw RuntimeError(token, "undefined variable '" + slots_->names[slot] + "'");
+    }
+    *values_[slot] = std::move(value);
+}
+
+const ObjectReference& Globals::get(std::size_t slot, const Token& token) const
+{
+    if (slot >= values_.size() || !values_[slot]) {
+        throw RuntimeError(token, "undefined variable '" + slots_->names[slot] + "'");
+    }
+    return *values_[slot];
+}
+
+void Globals::define(std::string_view name, ObjectReference value)
+{
+    this->define(this->slot(name), std::move(value));
+}
+
+void Globals::assign(const Token& token, ObjectReference value)
+{
+    const auto it = slots_->slots.find(token.lexeme());
+    if (it == slots_->slots.end()) {
+        throw RuntimeError(token, "undefined variable '" + std::string{token.lexeme()} + "'");
+    }
+    this->assign(it->second, token, std::move(value));
+}
+
+const ObjectReference& Globals::get(const Token& token) const
+{
+    const auto it = slots_->slots.find(token.lexeme());
+    if (it == slots_->slots.end()) {
+        throw RuntimeError(token, "undefined variable '" + std::string{token.lexeme()} + "'");
+    }
+    return this->get(it->second, token);
+}
+
+void Globals::mark_builtins()
+{
+    builtins_ = std::make_shared<const std::vector<std::optional<ObjectReference>>>(values_);
+}
+
+Globals Globals::module() const
+{
+    Globals globals;
+    globals.slots_ = slots_;
+    if (builtins_) globals.values_ = *builtins_;
+    globals.defined_.resize(globals.values_.size());
+    globals.builtins_ = builtins_;
+    return globals;
+}
+
+Set Globals::set() const
+{
+    Set::Members members;
+    for (std::size_t slot = 0; slot < values_.size(); ++slot) {
+        if (defined_[slot]) members.emplace_back(slots_->names[slot], *values_[slot]);
+    }
+    return Set{std::move(members)};
+}
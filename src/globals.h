@@ -0,0 +1,68 @@
+#pragma once
+
+#include "object.h"
+#include "token.h"
+
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// The builtins, the variables a program defines at its top level, and the names it uses without
+// defining anywhere. The resolver gives each name a slot the first time it sees it, so that they're
+// reached by index rather than by name. Slots are never reused, so a variable keeps its slot across
+// lines of the prompt, and a name used before it's defined is bound once it is.
+//
+// A file imported under a name is run with a table of its own, which shares the program's slots
+// but starts with just the builtins, so that it can't reach the program's variables. Its top level
+// is defined into the table by name, so names it uses before defining them are bound once it does.
+struct Globals {
+    Globals() = default;
+
+    // A table sharing the slots of another is made with module()
+    Globals(const Globals&) = delete;
+    Globals& operator=(const Globals&) = delete;
+    Globals(Globals&&) = default;
+    Globals& operator=(Globals&&) = default;
+
+    // The slot of the name, which is added if it doesn't have one yet
+    std::size_t slot(std::string_view name);
+
+    void define(std::size_t slot, ObjectReference value);
+    void assign(std::size_t slot, const Token&, ObjectReference value);
+    const ObjectReference& get(std::size_t slot, const Token&) const;
+
+    // For code that isn't resolved against the table, such as a file imported into the top level
+    void define(std::string_view name, ObjectReference value);
+    void assign(const Token&, ObjectReference value);
+    const ObjectReference& get(const Token&) const;
+
+    // The variables defined so far are the builtins, which modules' tables start with
+    void mark_builtins();
+    // A table for a file imported under a name
+    Globals module() const;
+    // The variables defined in a module's table, which is what the module is made of
+    Set set() const;
+private:
+    struct Slots {
+        // The names are copied, since the table outlives the sources of some of the names in it
+        std::deque<std::string> names;
+        std::unordered_map<std::string_view, std::size_t> slots;
+    };
+    std::shared_ptr<Slots> slots_ = std::make_shared<Slots>();
+
+    // Empty until the variable is defined. A module's table doesn't grow until it defines a
+    // variable, so it can be shorter than the number of slots.
+    std::vector<std::optional<ObjectReference>> values_;
+    // The slots defined in this table rather than copied from the builtins
+    std::vector<bool> defined_;
+    // As they were defined, in case the program redefines any
+    std::shared_ptr<const std::vector<std::optional<ObjectReference>>> builtins_;
+};
+
+// A table holding just the builtin functions, which every program starts with
+Globals builtin_globals();
@@ -0,0 +1,831 @@
+#include "inliner.h"
+#include "pass_helpers.h"
+
+#include <cassert>
+#include <deque>
+#include <optional>
+#include <string_view>
+#include <unordered_set>
+#include <utility>
+
+namespace {
+
+// The most nodes a function can have to be inlined, since every call gets a copy of it
+constexpr std::size_t max_inlined_size = 32;
+
+// Makes the inputs of a call or a function from those of another, in order
+template <typename T, typename U, typename F>
+FunctionInput<T> map_input(const FunctionInput<U>& input, F&& f)
+{
+    switch (input.size()) {
+        case 0: return {};
+        case 1: return {f(input[0])};
+        default: {
+            auto input_0 = f(input[0]);
+            return {std::move(input_0), f(input[1])};
+        }
+    }
+}
+
+// Copies the parts of a function that are inlined. The copies have variables of their own, which
+// are resolved where they're copied to.
+struct Copier : Ast::Expression::Visitor<void>, Ast::Statement::Visitor<void> {
+    std::unique_ptr<Ast::Expression> copy(const Ast::Expression& e) {
+        e.accept(*this);
+        return std::move(expression_);
+    }
+    std::unique_ptr<Ast::Statement> copy(const Ast::Statement& s) {
+        s.accept(*this);
+        return std::move(statement_);
+    }
+    template <typename T>
+    std::optional<std::unique_ptr<T>> copy(const std::optional<std::unique_ptr<T>>& o) {
+        if (!o) return {};
+        return this->copy(**o);
+    }
+    Ast::VariableTuple copy(const Ast::VariableTuple&);
+    Ast::Ast copy(const Ast::Ast&);
+
+    void operator()(const Ast::Assign&) override;
+    void operator()(const Ast::AssignMember&) override;
+    void operator()(const Ast::Binary&) override;
+    void operator()(const Ast::Call&) override;
+    void operator()(const Ast::Function&) override;
+    void operator()(const Ast::Get&) override;
+    void operator()(const Ast::Grouping&) override;
+    void operator()(const Ast::Inlined&) override;
+    void operator()(const Ast::Literal&) override;
+    void operator()(const Ast::Logical&) override;
+    void operator()(const Ast::Tuple&) override;
+    void operator()(const Ast::Unary&) override;
+    void operator()(const Ast::Variable&) override;
+    void operator()(const Ast::VariableTuple&) override;
+
+    void operator()(const Ast::Block&) override;
+    void operator()(const Ast::ExpressionStatement&) override;
+    void operator()(const Ast::If&) override;
+    void operator()(const Ast::Return&) override;
+    void operator()(const Ast::While&) override;
+    void operator()(const Ast::Declaration&) override;
+    void operator()(const Ast::Import&) override;
+
+private:
+    std::unique_ptr<Ast::Expression> expression_;
+    std::unique_ptr<Ast::Statement> statement_;
+};
+
+Ast::VariableTuple Copier::copy(const Ast::VariableTuple& vt)
+{
+    if (const auto v = std::get_if<Ast::Variable>(&vt.contents)) {
+        return Ast::VariableTuple{Ast::Variable{v->name}};
+    }
+
+    std::vector<Ast::VariableTuple> vvt;
+    for (const auto& element : std::get<std::vector<Ast::VariableTuple>>(vt.contents)) {
+        vvt.push_back(this->copy(element));
+    }
+    return Ast::VariableTuple{std::move(vvt)};
+}
+
+Ast::Ast Copier::copy(const Ast::Ast& statements)
+{
+    Ast::Ast copies;
+    for (const auto& statement : statements) {
+        copies.push_back(this->copy(*statement));
+    }
+    return copies;
+}
+
+void Copier::operator()(const Ast::Assign& a)
+{
+    auto variable = std::make_unique<Ast::VariableTuple>(this->copy(*a.variable));
+    auto expression = this->copy(*a.expression);
+    expression_ = std::make_unique<Ast::Assign>(std::move(variable), a.token,
+                                                std::move(expression));
+}
+
+void Copier::operator()(const Ast::AssignMember& a)
+{
+    auto object = this->copy(*a.object);
+    auto expression = this->copy(*a.expression);
+    expression_ = std::make_unique<Ast::AssignMember>(std::move(object), a.name,
+                                                      std::move(expression));
+}
+
+void Copier::operator()(const Ast::Binary& b)
+{
+    auto left = this->copy(*b.left);
+    auto right = this->copy(*b.right);
+    expression_ = std::make_unique<Ast::Binary>(std::move(left), b.op, std::move(right));
+}
+
+void Copier::operator()(const Ast::Call& c)
+{
+    auto callee = this->copy(*c.callee);
+    auto input = map_input<std::unique_ptr<Ast::Expression>>(c.input, [this](const auto& e) {
+        return this->copy(*e);
+    });
+    expression_ = std::make_unique<Ast::Call>(std::move(callee), c.token, std::move(input));
+}
+
+void Copier::operator()(const Ast::Function& f)
+{
+    auto input = map_input<std::shared_ptr<Ast::VariableTuple>>(f.input, [this](const auto& vt) {
+        return std::make_shared<Ast::VariableTuple>(this->copy(*vt));
+    });
+    auto body = std::make_shared<Ast::Block>(this->copy(f.body->statements));
+    expression_ = std::make_unique<Ast::Function>(std::move(input), std::move(body));
+}
+
+void Copier::operator()(const Ast::Get& g)
+{
+    expression_ = std::make_unique<Ast::Get>(this->copy(*g.object), g.name);
+}
+
+void Copier::operator()(const Ast::Grouping& g)
+{
+    expression_ = std::make_unique<Ast::Grouping>(this->copy(*g.expression));
+}
+
+void Copier::operator()(const Ast::Inlined& i)
+{
+    auto arguments = map_input<std::unique_ptr<Ast::Expression>>(i.arguments,
+                                                                 [this](const auto& e) {
+        return this->copy(*e);
+    });
+    auto input = map_input<std::unique_ptr<Ast::VariableTuple>>(i.input, [this](const auto& vt) {
+        return std::make_unique<Ast::VariableTuple>(this->copy(*vt));
+    });
+    auto body = std::make_unique<Ast::Block>(this->copy(i.body->statements));
+    auto result = this->copy(i.result);
+    expression_ = std::make_unique<Ast::Inlined>(i.token, std::move(arguments), std::move(input),
+                                                 std::move(body), std::move(result));
+}
+
+void Copier::operator()(const Ast::Literal& l)
+{
+    expression_ = std::make_unique<Ast::Literal>(l.value);
+}
+
+void Copier::operator()(const Ast::Logical& l)
+{
+    auto left = this->copy(*l.left);
+    auto right = this->copy(*l.right);
+    expression_ = std::make_unique<Ast::Logical>(std::move(left), l.op, std::move(right));
+}
+
+void Copier::operator()(const Ast::Tuple& t)
+{
+    std::vector<std::unique_ptr<Ast::Expression>> elements;
+    for (const auto& element : t.elements) {
+        elements.push_back(this->copy(*element));
+    }
+    expression_ = std::make_unique<Ast::Tuple>(std::move(elements));
+}
+
+void Copier::operator()(const Ast::Unary& u)
+{
+    expression_ = std::make_unique<Ast::Unary>(u.op, this->copy(*u.right));
+}
+
+void Copier::operator()(const Ast::Variable& v)
+{
+    expression_ = std::make_unique<Ast::Variable>(v.name);
+}
+
+void Copier::operator()(const Ast::VariableTuple&)
+{
+    assert(false && "Variable tuples are copied as part of assignments and declarations");
+}
+
+void Copier::operator()(const Ast::Block& b)
+{
+    statement_ = std::make_unique<Ast::Block>(this->copy(b.statements));
+}
+
+void Copier::operator()(const Ast::ExpressionStatement& es)
+{
+    statement_ = std::make_unique<Ast::ExpressionStatement>(this->copy(es.expression));
+}
+
+void Copier::operator()(const Ast::If& i)
+{
+    auto condition = this->copy(*i.condition);
+    auto then_branch = this->copy(*i.then_branch);
+    auto else_branch = this->copy(i.else_branch);
+    statement_ = std::make_unique<Ast::If>(i.keyword, std::move(condition), std::move(then_branch),
+                                           std::move(else_branch));
+}
+
+void Copier::operator()(const Ast::Return& r)
+{
+    statement_ = std::make_unique<Ast::Return>(r.keyword, this->copy(r.expression));
+}
+
+void Copier::operator()(const Ast::While& w)
+{
+    auto condition = this->copy(*w.condition);
+    auto body = this->copy(*w.body);
+    statement_ = std::make_unique<Ast::While>(std::move(condition), std::move(body));
+}
+
+void Copier::operator()(const Ast::Declaration& d)
+{
+    auto variable = std::make_unique<Ast::VariableTuple>(this->copy(*d.variable));
+    auto initializer = this->copy(d.initializer);
+    statement_ = std::make_unique<Ast::Declaration>(std::move(variable), d.token,
+                                                    std::move(initializer));
+}
+
+void Copier::operator()(const Ast::Import&)
+{
+    assert(false && "Functions that import files aren't inlined");
+}
+
+// Measures a function, and counts what stops it from being inlined
+struct Summary : Ast::Expression::Visitor<void>, Ast::Statement::Visitor<void> {
+    std::size_t size = 0;
+    // Only the returns of the function itself, not of the functions it defines
+    std::size_t returns = 0;
+    std::size_t imports = 0;
+
+    void add(const Ast::Ast& statements) {
+        for (const auto& statement : statements) statement->accept(*this);
+    }
+
+    void operator()(const Ast::Assign& a) override {
+        ++size;
+        (*this)(*a.variable);
+        a.expression->accept(*this);
+    }
+    void operator()(const Ast::AssignMember& a) override {
+        ++size;
+        a.object->accept(*this);
+        a.expression->accept(*this);
+    }
+    void operator()(const Ast::Binary& b) override {
+        ++size;
+        b.left->accept(*this);
+        b.right->accept(*this);
+    }
+    void operator()(const Ast::Call& c) override {
+        ++size;
+        c.callee->accept(*this);
+        for (std::size_t i = 0; i < c.input.size(); ++i) c.input[i]->accept(*this);
+    }
+    void operator()(const Ast::Function& f) override {
+        ++size;
+        for (std::size_t i = 0; i < f.input.size(); ++i) (*this)(*f.input[i]);
+        const auto returns = this->returns;
+        this->add(f.body->statements);
+        this->returns = returns;
+    }
+    void operator()(const Ast::Get& g) override {
+        ++size;
+        g.object->accept(*this);
+    }
+    void operator()(const Ast::Grouping& g) override {
+        ++size;
+        g.expression->accept(*this);
+    }
+    void operator()(const Ast::Inlined& i) override {
+        ++size;
+        for (std::size_t j = 0; j < i.arguments.size(); ++j) i.arguments[j]->accept(*this);
+        for (std::size_t j = 0; j < i.input.size(); ++j) (*this)(*i.input[j]);
+        this->add(i.body->statements);
+        if (i.result) (*i.result)->accept(*this);
+    }
+    void operator()(const Ast::Literal&) override {
+        ++size;
+    }
+    void operator()(const Ast::Logical& l) override {
+        ++size;
+        l.left->accept(*this);
+        l.right->accept(*this);
+    }
+    void operator()(const Ast::Tuple& t) override {
+        ++size;
+        for (const auto& element : t.elements) element->accept(*this);
+    }
+    void operator()(const Ast::Unary& u) override {
+        ++size;
+        u.right->accept(*this);
+    }
+    void operator()(const Ast::Variable&) override {
+        ++size;
+    }
+    void operator()(const Ast::VariableTuple& vt) override {
+        Ast::for_each_variable(vt, [this](const Ast::Variable&) { ++size; });
+    }
+
+    void operator()(const Ast::Block& b) override {
+        ++size;
+        this->add(b.statements);
+    }
+    void operator()(const Ast::ExpressionStatement& es) override {
+        ++size;
+        if (es.expression) (*es.expression)->accept(*this);
+    }
+    void operator()(const Ast::If& i) override {
+        ++size;
+        i.condition->accept(*this);
+        i.then_branch->accept(*this);
+        if (i.else_branch) (*i.else_branch)->accept(*this);
+    }
+    void operator()(const Ast::Return& r) override {
+        ++size;
+        ++returns;
+        if (r.expression) (*r.expression)->accept(*this);
+    }
+    void operator()(const Ast::While& w) override {
+        ++size;
+        w.condition->accept(*this);
+        w.body->accept(*this);
+    }
+    void operator()(const Ast::Declaration& d) override {
+        ++size;
+        (*this)(*d.variable);
+        if (d.initializer) (*d.initializer)->accept(*this);
+    }
+    void operator()(const Ast::Import&) override {
+        ++size;
+        ++imports;
+    }
+};
+
+// Whether the function's body can be run in the scope its inputs are bound in, as the value of an
+// expression
+bool is_simple(const Ast::Function& f)
+{
+    // The function's own returns are counted, unlike those of the functions it defines
+    Summary summary;
+    for (std::size_t i = 0; i < f.input.size(); ++i) summary(*f.input[i]);
+    summary.add(f.body->statements);
+    if (summary.size > max_inlined_size || summary.imports > 0) return false;
+
+    const auto& statements = f.body->statements;
+    if (summary.returns > 0) {
+        const bool returns_at_end = summary.returns == 1 &&
+            dynamic_cast<const Ast::Return*>(statements.back().get());
+        if (!returns_at_end) return false;
+    }
+
+    // The body is no longer a scope of its own, so it can't declare the inputs again
+    std::unordered_set<std::string_view> inputs;
+    for (std::size_t i = 0; i < f.input.size(); ++i) {
+        Ast::for_each_variable(*f.input[i], [&inputs](const Ast::Variable& v) {
+            inputs.insert(v.name.lexeme());
+        });
+    }
+    bool declares_input = false;
+    for (const auto& statement : statements) {
+        const auto d = dynamic_cast<const Ast::Declaration*>(statement.get());
+        if (!d) continue;
+        Ast::for_each_variable(*d->variable, [&](const Ast::Variable& v) {
+            declares_input = declares_input || inputs.count(v.name.lexeme()) > 0;
+        });
+    }
+    return !declares_input;
+}
+
+// A local variable declared with a function, whose calls can be inlined
+struct Candidate {
+    Candidate(const Ast::Variable& variable, const Ast::Function& function, std::size_t scope)
+        : variable{variable}, function{function}, scope{scope}
+    {}
+
+    const Ast::Variable& variable;
+    const Ast::Function& function;
+    // The scope of the function's inputs
+    std::size_t scope;
+
+    // Set if the variable is assigned, declared again in its scope, or could have been by a file
+    // imported into its scope
+    bool changed = false;
+
+    // Set if the function uses variables of enclosing scopes, other than to call them
+    bool uses_enclosing = false;
+    // The calls the function makes through variables of enclosing scopes, which it no longer
+    // uses if they're inlined
+    std::vector<std::size_t> enclosing_calls;
+
+    // The globals the function uses, including those of the functions inlined into it
+    std::unordered_set<std::string_view> globals;
+
+    // Worked out when the first call is inlined, once the calls in the function have been
+    std::optional<bool> inlinable;
+};
+
+// Variables are bound by name, the same way the resolver binds them, to find out which calls are
+// through candidates. The calls are only inlined once the whole ast has been seen, since candidates
+// can be assigned anywhere in their scope.
+struct Inliner : Ast::Expression::MutableVisitor, Ast::Statement::MutableVisitor {
+    explicit Inliner(std::vector<std::string>* report)
+        : report_{report}
+    {
+        this->push();
+    }
+
+    void walk(Ast::Ast& statements);
+    void inline_calls();
+
+    void operator()(Ast::Assign&) override;
+    void operator()(Ast::AssignMember&) override;
+    void operator()(Ast::Binary&) override;
+    void operator()(Ast::Call&) override;
+    void operator()(Ast::Function&) override;
+    void operator()(Ast::Get&) override;
+    void operator()(Ast::Grouping&) override;
+    void operator()(Ast::Inlined&) override;
+    void operator()(Ast::Literal&) override;
+    void operator()(Ast::Logical&) override;
+    void operator()(Ast::Tuple&) override;
+    void operator()(Ast::Unary&) override;
+    void operator()(Ast::Variable&) override;
+    void operator()(Ast::VariableTuple&) override;
+
+    void operator()(Ast::Block&) override;
+    void operator()(Ast::ExpressionStatement&) override;
+    void operator()(Ast::If&) override;
+    void operator()(Ast::Return&) override;
+    void operator()(Ast::While&) override;
+    void operator()(Ast::Declaration&) override;
+    void operator()(Ast::Import&) override;
+
+private:
+    struct Binding {
+        std::string_view name;
+        Candidate* candidate;
+    };
+
+    struct Scope {
+        std::size_t first_binding;
+        // A file imported into the scope without a name can have defined any name in it
+        bool opaque;
+    };
+
+    struct Call {
+        std::unique_ptr<Ast::Expression>* call;
+        Candidate* callee;
+        bool inlined = false;
+    };
+
+    void walk(std::unique_ptr<Ast::Statement>&);
+    void walk(std::unique_ptr<Ast::Expression>&);
+
+    void push() { scopes_.push_back({bindings_.size(), false}); }
+    void pop();
+
+    void define(std::string_view, Candidate* = nullptr);
+    void define(const Ast::VariableTuple&);
+
+    // The innermost binding of the name and its scope, or null and 0 for a global
+    std::pair<Binding*, std::size_t> find(std::string_view);
+    // Whether a file imported into a scope inside the given one could have bound the name instead
+    bool could_be_hidden(std::size_t scope) const;
+    // The name is read or assigned by the functions being walked
+    void use(std::string_view);
+
+    bool inlinable(Candidate&);
+    std::vector<Binding> bindings_;
+    std::vector<Scope> scopes_;
+
+    // Candidates are never moved, since bindings and calls point to them
+    std::deque<Candidate> candidates_;
+    // The candidates whose functions are being walked, outermost first
+    std::vector<Candidate*> enclosing_;
+    // In the order they're to be inlined, which is the order they end in, so that calls in the
+    // arguments and functions of others are inlined before those are moved or copied
+    std::vector<Call> calls_;
+
+    // The expression being walked, which a call that's inlined is replaced in
+    std::unique_ptr<Ast::Expression>* expression_ = nullptr;
+
+    std::vector<std::string>* report_;
+};
+
+void Inliner::walk(Ast::Ast& statements)
+{
+    for (auto& statement : statements) this->walk(statement);
+}
+
+void Inliner::walk(std::unique_ptr<Ast::Statement>& statement)
+{
+    statement->accept(*this);
+}
+
+void Inliner::walk(std::unique_ptr<Ast::Expression>& expression)
+{
+    expression_ = &expression;
+    expression->accept(*this);
+}
+
+void Inliner::operator()(Ast::Assign& a)
+{
+    this->walk(a.expression);
+    Ast::for_each_variable(*a.variable, [this](const Ast::Variable& v) {
+        this->use(v.name.lexeme());
+        const auto binding = this->find(v.name.lexeme()).first;
+        if (binding && binding->candidate) binding->candidate->changed = true;
+    });
+}
+
+void Inliner::operator()(Ast::AssignMember& a)
+{
+    this->walk(a.object);
+    this->walk(a.expression);
+}
+
+void Inliner::operator()(Ast::Binary& b)
+{
+    this->walk(b.left);
+    this->walk(b.right);
+}
+
+void Inliner::operator()(Ast::Call& c)
+{
+    auto& expression = *expression_;
+
+    for (std::size_t i = 0; i < c.input.size(); ++i) {
+        this->walk(c.input[i]);
+    }
+
+    const auto callee = dynamic_cast<const Ast::Variable*>(&ungrouped(*c.callee));
+    const auto [binding, scope] = callee ? this->find(callee->name.lexeme())
+                                         : std::pair<Binding*, std::size_t>{nullptr, 0};
+    const auto candidate = binding ? binding->candidate : nullptr;
+
+    // Missing inputs are nil, but too many inputs are an error the call has to report
+    bool inlinable = candidate && !this->could_be_hidden(scope) &&
+                     c.input.size() <= candidate->function.input.size();
+    if (inlinable) {
+        for (const auto global : candidate->globals) {
+            inlinable = inlinable && this->find(global).second == 0 &&
+                        !this->could_be_hidden(0);
+        }
+    }
+    if (!inlinable) {
+        this->walk(c.callee);
+        return;
+    }
+
+    for (const auto enclosing : enclosing_) {
+        if (scope < enclosing->scope) enclosing->enclosing_calls.push_back(calls_.size());
+        enclosing->globals.insert(candidate->globals.begin(), candidate->globals.end());
+    }
+    calls_.push_back({&expression, candidate});
+}
+
+void Inliner::operator()(Ast::Function& f)
+{
+    this->push();
+    for (std::size_t i = 0; i < f.input.size(); ++i) {
+        this->define(*f.input[i]);
+    }
+    this->push();
+    this->walk(f.body->statements);
+    this->pop();
+    this->pop();
+}
+
+void Inliner::operator()(Ast::Get& g)
+{
+    this->walk(g.object);
+}
+
+void Inliner::operator()(Ast::Grouping& g)
+{
+    this->walk(g.expression);
+}
+
+void Inliner::operator()(Ast::Inlined& i)
+{
+    for (std::size_t j = 0; j < i.arguments.size(); ++j) {
+        this->walk(i.arguments[j]);
+    }
+
+    this->push();
+    for (std::size_t j = 0; j < i.input.size(); ++j) {
+        this->define(*i.input[j]);
+    }
+    this->walk(i.body->statements);
+    if (i.result) this->walk(*i.result);
+    this->pop();
+}
+
+void Inliner::operator()(Ast::Literal&)
+{
+}
+
+void Inliner::operator()(Ast::Logical& l)
+{
+    this->walk(l.left);
+    this->walk(l.right);
+}
+
+void Inliner::operator()(Ast::Tuple& t)
+{
+    for (auto& element : t.elements) this->walk(element);
+}
+
+void Inliner::operator()(Ast::Unary& u)
+{
+    this->walk(u.right);
+}
+
+void Inliner::operator()(Ast::Variable& v)
+{
+    this->use(v.name.lexeme());
+}
+
+void Inliner::operator()(Ast::VariableTuple&)
+{
+    assert(false && "Variable tuples are walked as part of assignments and declarations");
+}
+
+void Inliner::operator()(Ast::Block& b)
+{
+    this->push();
+    this->walk(b.statements);
+    this->pop();
+}
+
+void Inliner::operator()(Ast::ExpressionStatement& es)
+{
+    if (es.expression) this->walk(*es.expression);
+}
+
+void Inliner::operator()(Ast::If& i)
+{
+    this->walk(i.condition);
+    this->walk(i.then_branch);
+    if (i.else_branch) this->walk(*i.else_branch);
+}
+
+void Inliner::operator()(Ast::Return& r)
+{
+    if (r.expression) this->walk(*r.expression);
+}
+
+void Inliner::operator()(Ast::While& w)
+{
+    this->walk(w.condition);
+    this->walk(w.body);
+}
+
+void Inliner::operator()(Ast::Declaration& d)
+{
+    // Variables declared at the top level are globals
+    const auto v = std::get_if<Ast::Variable>(&d.variable->contents);
+    const auto f = d.initializer ? dynamic_cast<const Ast::Function*>(d.initializer->get())
+                                 : nullptr;
+    Candidate* candidate = nullptr;
+    if (v && f && scopes_.size() > 1) {
+        candidate = &candidates_.emplace_back(*v, *f, scopes_.size());
+        enclosing_.push_back(candidate);
+    }
+
+    if (d.initializer) this->walk(*d.initializer);
+
+    if (candidate) {
+        enclosing_.pop_back();
+        this->define(v->name.lexeme(), candidate);
+    } else {
+        this->define(*d.variable);
+    }
+}
+
+void Inliner::operator()(Ast::Import& i)
+{
+    if (i.variable) {
+        this->define((*i.variable)->name.lexeme());
+        return;
+    }
+
+    // The file can define any name in this scope, including the candidates'
+    auto& scope = scopes_.back();
+    scope.opaque = true;
+    for (auto j = scope.first_binding; j < bindings_.size(); ++j) {
+        if (bindings_[j].candidate) bindings_[j].candidate->changed = true;
+    }
+}
+
+void Inliner::pop()
+{
+    bindings_.resize(scopes_.back().first_binding);
+    scopes_.pop_back();
+}
+
+void Inliner::define(std::string_view name, Candidate* candidate)
+{
+    // Declaring a variable again in the same scope gives the same variable a new value
+    for (auto i = bindings_.size(); i-- > scopes_.back().first_binding; ) {
+        if (bindings_[i].name != name) continue;
+        if (bindings_[i].candidate) bindings_[i].candidate->changed = true;
+        if (candidate) candidate->changed = true;
+        return;
+    }
+    bindings_.push_back({name, candidate});
+}
+
+void Inliner::define(const Ast::VariableTuple& vt)
+{
+    Ast::for_each_variable(vt, [this](const Ast::Variable& v) {
+        this->define(v.name.lexeme());
+    });
+}
+
+std::pair<Inliner::Binding*, std::size_t> Inliner::find(std::string_view name)
+{
+    // The top level's variables are globals
+    auto last_binding = bindings_.size();
+    for (auto scope = scopes_.size(); scope-- > 1; ) {
+        const auto first_binding = scopes_[scope].first_binding;
+        for (auto i = last_binding; i-- > first_binding; ) {
+            if (bindings_[i].name == name) return {&bindings_[i], scope};
+        }
+        last_binding = first_binding;
+    }
+    return {nullptr, 0};
+}
+
+bool Inliner::could_be_hidden(std::size_t scope) const
+{
+    for (auto i = scope + 1; i < scopes_.size(); ++i) {
+        if (scopes_[i].opaque) return true;
+    }
+    return false;
+}
+
+void Inliner::use(std::string_view name)
+{
+    const auto [binding, scope] = this->find(name);
+    const bool global = scope == 0 && !this->could_be_hidden(0);
+    for (const auto enclosing : enclosing_) {
+        if (scope >= enclosing->scope) continue;
+        if (global) {
+            enclosing->globals.insert(name);
+        } else {
+            enclosing->uses_enclosing = true;
+        }
+    }
+}
+
+bool Inliner::inlinable(Candidate& candidate)
+{
+    if (candidate.inlinable) return *candidate.inlinable;
+
+    bool inlinable = !candidate.changed && !candidate.uses_enclosing;
+    for (const auto call : candidate.enclosing_calls) {
+        inlinable = inlinable && calls_[call].inlined;
+    }
+    inlinable = inlinable && is_simple(candidate.function);
+
+    candidate.inlinable = inlinable;
+    return inlinable;
+}
+
+void Inliner::inline_calls()
+{
+    for (auto& [expression, callee, inlined] : calls_) {
+        if (!this->inlinable(*callee)) continue;
+
+        auto& call = dynamic_cast<Ast::Call&>(**expression);
+        const auto& function = callee->function;
+        const auto& statements = function.body->statements;
+
+        Copier copier;
+        auto input = map_input<std::unique_ptr<Ast::VariableTuple>>(function.input,
+                                                                    [&copier](const auto& vt) {
+            return std::make_unique<Ast::VariableTuple>(copier.copy(*vt));
+        });
+
+        // A return can only be the last statement, its value is the result
+        const auto r = statements.empty()
+            ? nullptr : dynamic_cast<const Ast::Return*>(statements.back().get());
+        Ast::Ast body;
+        for (std::size_t i = 0; i + (r ? 1 : 0) < statements.size(); ++i) {
+            body.push_back(copier.copy(*statements[i]));
+        }
+        auto result = r ? copier.copy(r->expression) : std::nullopt;
+
+        add_to_report(report_, "[line " + std::to_string(call.token.line) +
+                               "] inlined call to '" + std::string{callee->variable.name.lexeme()} +
+                               "'");
+
+        *expression = std::make_unique<Ast::Inlined>(call.token, std::move(call.input),
+                                                     std::move(input),
+                                                     std::make_unique<Ast::Block>(std::move(body)),
+                                                     std::move(result));
+        inlined = true;
+    }
+}
+
+}
+
+void inline_calls(Ast::Ast& ast, std::vector<std::string>* report)
+{
+    Inliner inliner{report};
+    inliner.walk(ast);
+    inliner.inline_calls();
+}
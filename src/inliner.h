@@ -0,0 +1,19 @@
+#pragma once
+
+#include "ast.h"
+
+#include <string>
+#include <vector>
+
+// Replaces calls to small functions with copies of their bodies, before the ast is resolved, which
+// saves creating an interpreter for each call and throwing its return value back. Only functions
+// that local variables are declared with are inlined, if the variables are never assigned or
+// declared again, so that every call through them calls the same function. A variable can't be
+// used in the function it's declared with, so none of them can call itself.
+//
+// The function's body has to be small, return only at its end, not import any files, and only use
+// its own variables and globals that aren't hidden by other variables where it's called. Globals,
+// including functions defined at the top level, can be changed by later lines of the prompt and by
+// imported files, so calls through them are kept, and so are calls in imported files. Each call
+// that's inlined is described by a line in the report, if there is one.
+void inline_calls(Ast::Ast&, std::vector<std::string>* report = nullptr);
@@ -4,6 +4,7 @@
 #include "environment.h"
 #include "ast.h"
 #include "error.h"
+#include "memo.h"
 #include "resolver.h"
 
 // Attempt to set a Ast::VariableTuple vt to an ObjectReference o using a SetFunction
@@ -35,35 +36,50 @@ void set_variable_tuple(SetFunction&& set_function, const Ast::VariableTuple& vt
     std::visit(f, vt.contents);
 }
 
-void define_variable_tuple(const Ast::VariableTuple& vt, Environment& e)
+bool is_boxed(const Locations& locations, const Ast::Variable& v)
+{
+    const auto location = locations.find(v.id);
+    return location != locations.end() && location->second == boxed_location;
+}
+
+void define_variable_tuple(const Ast::VariableTuple& vt, Environment& e, const Locations& l)
 {
     const auto f = combine(
-        [&e](const Ast::Variable& v) {
-            e.define(v.name.lexeme, nullptr);
+        [&e, &l](const Ast::Variable& v) {
+            e.define(v.name.lexeme(), nullptr, is_boxed(l, v));
         },
-        [&e](const std::vector<Ast::VariableTuple>& vvt) {
-            for (const auto& vt : vvt) define_variable_tuple(vt, e);
+        [&e, &l](const std::vector<Ast::VariableTuple>& vvt) {
+            for (const auto& vt : vvt) define_variable_tuple(vt, e, l);
         }
     );
     std::visit(f, vt.contents);
 }
 
 struct Interpreter : Ast::Expression::Visitor<ObjectReference>, Ast::Statement::Visitor<void> {
+    // The module is the top level of the file being run, and the captures are those of the
+    // function being called, if any
     Interpreter(const Locations& locations, std::shared_ptr<Environment> e,
-                std::shared_ptr<Environment> ge)
-        : locations_{locations}, environment_{std::move(e)}, global_environment_{std::move(ge)}
+                const std::shared_ptr<Globals>& g, const ModuleRunner& run_module,
+                const std::shared_ptr<Environment>& module, const std::vector<Cell>* captures)
+        : locations_{locations}, environment_{std::move(e)}, globals_{g}, run_module_{run_module},
+          module_{module}, captures_{captures}
     {}
 
     Interpreter(const Interpreter&) = delete;
     Interpreter(Interpreter&&) = delete;
 
     ObjectReference call(const Function&, const FunctionInput<ObjectReference>&, const Token&);
+    ObjectReference call(const ObjectReference& callee, const FunctionInput<ObjectReference>&,
+                         const Token&);
 
     ObjectReference operator()(const Ast::Assign&) override;
+    ObjectReference operator()(const Ast::AssignMember&) override;
     ObjectReference operator()(const Ast::Binary&) override;
     ObjectReference operator()(const Ast::Call&) override ;
     ObjectReference operator()(const Ast::Function&) override;
+    ObjectReference operator()(const Ast::Get&) override;
     ObjectReference operator()(const Ast::Grouping&) override;
+    ObjectReference operator()(const Ast::Inlined&) override;
     ObjectReference operator()(const Ast::Literal&) override;
     ObjectReference operator()(const Ast::Logical&) override;
     ObjectReference operator()(const Ast::Tuple&) override ;
@@ -80,9 +96,87 @@ struct Interpreter : Ast::Expression::Visitor<ObjectReference>, Ast::Statement::
     void operator()(const Ast::Import&) override;
 
 private:
+    // Calls the function a memoized function memoizes, unless it's already been called with the
+    // same inputs
+    ObjectReference call_memoized(const Function&, const FunctionInput<ObjectReference>&,
+                                  const Token&);
+
+    // For a binary operator whose operands are both proven to be numbers
+    ObjectReference numeric(const Ast::Binary&);
+
+    // Evaluates the inputs of a call, in order
+    FunctionInput<ObjectReference> evaluate(const FunctionInput<std::unique_ptr<Ast::Expression>>&);
+
     const Locations& locations_;
     std::shared_ptr<Environment> environment_;
-    std::shared_ptr<Environment> global_environment_;
+    const std::shared_ptr<Globals>& globals_;
+    const ModuleRunner& run_module_;
+    const std::shared_ptr<Environment>& module_;
+    const std::vector<Cell>* captures_;
+};
+
+// Evaluates expressions the type inference pass proved are numbers straight to doubles, without
+// checking them or allocating objects for the results of their operators
+struct NumberEvaluator : Ast::Expression::Visitor<double> {
+    NumberEvaluator(Interpreter& interpreter)
+        : interpreter_{interpreter}
+    {}
+
+    double operator()(const Ast::Binary& b) override
+    {
+        // Operands that aren't proven are checked by the interpreter, once both are evaluated
+        if (b.left->type != Ast::Type::number || b.right->type != Ast::Type::number) {
+            return this->evaluate(b);
+        }
+
+        const double left = b.left->accept(*this);
+        const double right = b.right->accept(*this);
+        switch (b.op.type) {
+            case Token::Type::minus: return left - right;
+            case Token::Type::slash: return left / right;
+            case Token::Type::star: return left * right;
+            case Token::Type::plus: return left + right;
+            default:
+                assert(false && "Only arithmetic operators give numbers");
+                return 0;
+        }
+    }
+
+    double operator()(const Ast::Grouping& g) override
+    {
+        return g.expression->accept(*this);
+    }
+
+    double operator()(const Ast::Literal& l) override
+    {
+        return l.value.get_unchecked<double>();
+    }
+
+    double operator()(const Ast::Unary& u) override
+    {
+        if (u.right->type != Ast::Type::number) return this->evaluate(u);
+        assert(u.op.type == Token::Type::minus);
+        return -u.right->accept(*this);
+    }
+
+    double operator()(const Ast::Assign& a) override { return this->evaluate(a); }
+    double operator()(const Ast::AssignMember& a) override { return this->evaluate(a); }
+    double operator()(const Ast::Call& c) override { return this->evaluate(c); }
+    double operator()(const Ast::Function& f) override { return this->evaluate(f); }
+    double operator()(const Ast::Get& g) override { return this->evaluate(g); }
+    double operator()(const Ast::Inlined& i) override { return this->evaluate(i); }
+    double operator()(const Ast::Logical& l) override { return this->evaluate(l); }
+    double operator()(const Ast::Tuple& t) override { return this->evaluate(t); }
+    double operator()(const Ast::Variable& v) override { return this->evaluate(v); }
+    double operator()(const Ast::VariableTuple& vt) override { return this->evaluate(vt); }
+private:
+    template <typename Expression>
+    double evaluate(const Expression& e)
+    {
+        return interpreter_(e).template get_unchecked<double>();
+    }
+
+    Interpreter& interpreter_;
 };
 
 ObjectReference Interpreter::operator()(const Ast::Assign& a)
@@ -94,17 +188,40 @@ ObjectReference Interpreter::operator()(const Ast::Assign& a)
             location != locations_.end())
         {
             const auto level = location->second;
-            this->environment_->assign_at(v.name, o, level);
+            if (is_global(level)) {
+                globals_->assign(global_slot(level), v.name, o);
+            } else if (is_captured(level)) {
+                if (!(*captures_)[captured_index(level)].assign_boxed(o)) {
+                    throw RuntimeError(v.name, "undefined variable '" +
+                                               std::string{v.name.lexeme()} + "'");
+                }
+            } else {
+                this->environment_->assign_at(v.name, o, level);
+            }
         } else {
-            this->global_environment_->assign(v.name, o);
+            globals_->assign(v.name, o);
         }
     };
     set_variable_tuple(set_function, *a.variable, value, a.token);
     return value;
 }
 
+ObjectReference Interpreter::operator()(const Ast::AssignMember& a)
+{
+    const auto object = a.object->accept(*this);
+    auto value = a.expression->accept(*this);
+
+    if (!object.holds<Record>()) throw RuntimeError(a.name, "can only assign fields of records");
+    object.get_unchecked<Record>().assign(a.name, value, a.cache);
+    return value;
+}
+
 ObjectReference Interpreter::operator()(const Ast::Binary& b)
 try {
+    if (b.left->type == Ast::Type::number && b.right->type == Ast::Type::number) {
+        return this->numeric(b);
+    }
+
     auto left = b.left->accept(*this);
     auto right = b.right->accept(*this);
 
@@ -144,39 +261,72 @@ catch (const ObjectReference::Bad_access&) {
     throw RuntimeError(b.op, "bad operand type");
 }
 
-ObjectReference Interpreter::operator()(const Ast::Call& c) {
-    ObjectReference callee = c.callee->accept(*this);
+ObjectReference Interpreter::numeric(const Ast::Binary& b)
+{
+    NumberEvaluator numbers{*this};
+    const double left = b.left->accept(numbers);
+    const double right = b.right->accept(numbers);
 
-    FunctionInput<ObjectReference> input = [this, &c] {
-        switch (c.input.size()) {
-        case 0:
-            return FunctionInput<ObjectReference>();
-        case 1:
-            return FunctionInput<ObjectReference>(c.input.at(0)->accept(*this));
+    switch (b.op.type) {
+        case Token::Type::minus: return left - right;
+        case Token::Type::slash: return left / right;
+        case Token::Type::star: return left * right;
+        case Token::Type::plus: return left + right;
+        case Token::Type::greater: return left > right;
+        case Token::Type::greater_equal: return left >= right;
+        case Token::Type::less: return left < right;
+        case Token::Type::less_equal: return left <= right;
+        case Token::Type::bang_equal: return left != right;
+        case Token::Type::equal_equal: return left == right;
         default:
-            return FunctionInput<ObjectReference>(c.input.at(0)->accept(*this),
-                                                  c.input.at(1)->accept(*this));
-        };
-    }();
+            throw RuntimeError(b.op, "bad operator type");
+    };
+}
 
-    const auto visitor = combine(
-        [&](const Function& f) -> ObjectReference {
-            return this->call(f, input, c.token);
-        },
-        [&](const BuiltInFunction& f) -> ObjectReference {
-            return f.call(input, c.token);
-        },
-        [&](auto) -> ObjectReference {
-            throw RuntimeError(c.token, "can only call functions");
-        }
-    );
+FunctionInput<ObjectReference> Interpreter::evaluate(
+    const FunctionInput<std::unique_ptr<Ast::Expression>>& input)
+{
+    switch (input.size()) {
+    case 0:
+        return FunctionInput<ObjectReference>();
+    case 1:
+        return FunctionInput<ObjectReference>(input.at(0)->accept(*this));
+    default:
+        return FunctionInput<ObjectReference>(input.at(0)->accept(*this),
+                                              input.at(1)->accept(*this));
+    };
+}
 
-    return callee.visit(visitor);
+ObjectReference Interpreter::operator()(const Ast::Call& c) {
+    ObjectReference callee = c.callee->accept(*this);
+
+    FunctionInput<ObjectReference> input = this->evaluate(c.input);
+
+    return this->call(callee, input, c.token);
 }
 
 ObjectReference Interpreter::operator()(const Ast::Function& f)
 {
-    return Function(f, environment_);
+    return Function(f, module_, capture(f, *environment_, captures_), globals_);
+}
+
+ObjectReference Interpreter::operator()(const Ast::Get& g)
+{
+    ObjectReference object = g.object->accept(*this);
+    load_if_lazy(object);
+
+    const ObjectReference* member;
+    if (object.holds<Record>()) {
+        member = object.get_unchecked<Record>().find(g.name.lexeme(), g.cache);
+    } else if (object.holds<Set>()) {
+        member = object.get_unchecked<Set>().find(g.name.lexeme(), g.cache);
+    } else {
+        throw RuntimeError(g.name, "can only access members of modules and records");
+    }
+    if (!member) {
+        throw RuntimeError(g.name, "undefined member '" + std::string{g.name.lexeme()} + "'");
+    }
+    return *member;
 }
 
 ObjectReference Interpreter::operator()(const Ast::Grouping& g)
@@ -184,6 +334,34 @@ ObjectReference Interpreter::operator()(const Ast::Grouping& g)
     return g.expression->accept(*this);
 };
 
+ObjectReference Interpreter::operator()(const Ast::Inlined& i)
+{
+    const auto arguments = this->evaluate(i.arguments);
+    assert(arguments.size() <= i.input.size() && "Only calls with enough inputs are inlined");
+
+    // Unlike a call, there's no need to throw the result back, nor to switch to the module and
+    // captures of the function, since the body is resolved where it's been copied to
+    auto new_environment = std::make_shared<Environment>(environment_);
+    Interpreter new_interpreter{locations_, new_environment, globals_, run_module_, module_,
+                                captures_};
+
+    const auto set_function = [this, &new_environment](const Ast::Variable& v,
+                                                       const ObjectReference& o) {
+        new_environment->define(v.name.lexeme(), o, is_boxed(locations_, v));
+    };
+    for (std::size_t j = 0; j < arguments.size(); ++j) {
+        set_variable_tuple(set_function, *i.input[j], arguments[j], i.token);
+    }
+    for (std::size_t j = arguments.size(); j < i.input.size(); ++j) {
+        define_variable_tuple(*i.input[j], *new_environment, locations_);
+    }
+
+    for (const auto& statement : i.body->statements) {
+        statement->accept(new_interpreter);
+    }
+    return i.result ? (*i.result)->accept(new_interpreter) : nullptr;
+}
+
 ObjectReference Interpreter::operator()(const Ast::Literal& l)
 {
     return l.value;
@@ -212,6 +390,11 @@ ObjectReference Interpreter::operator()(const Ast::Tuple& t) {
 
 ObjectReference Interpreter::operator()(const Ast::Unary& u)
 try {
+    if (u.op.type == Token::Type::minus && u.right->type == Ast::Type::number) {
+        NumberEvaluator numbers{*this};
+        return -u.right->accept(numbers);
+    }
+
     auto right = u.right->accept(*this);
 
     if (u.op.type == Token::Type::minus) {
@@ -233,9 +416,20 @@ ObjectReference Interpreter::operator()(const Ast::Variable& v)
     if (const auto location = locations_.find(v.id);
         location != locations_.end())
     {
+        if (is_global(location->second)) {
+            return globals_->get(global_slot(location->second), v.name);
+        }
+        if (is_captured(location->second)) {
+            const auto value = (*captures_)[captured_index(location->second)].get();
+            if (!value) {
+                throw RuntimeError(v.name, "undefined variable '" + std::string{v.name.lexeme()} +
+                                           "'");
+            }
+            return *value;
+        }
         return environment_->get_at(v.name, location->second);
     } else {
-        return global_environment_->get(v.name);
+        return globals_->get(v.name);
     }
 }
 
@@ -250,7 +444,8 @@ ObjectReference Interpreter::operator()(const Ast::VariableTuple&)
 void Interpreter::operator()(const Ast::Block& b)
 {
     auto new_environment = std::make_shared<Environment>(environment_);
-    Interpreter new_interpreter{locations_, new_environment, global_environment_};
+    Interpreter new_interpreter{locations_, new_environment, globals_, run_module_, module_,
+                                captures_};
 
     for (auto& statement : b.statements) {
         statement->accept(new_interpreter);
@@ -293,37 +488,59 @@ void Interpreter::operator()(const Ast::While& w)
 void Interpreter::operator()(const Ast::Declaration& d)
 {
     if (!d.initializer) {
-        define_variable_tuple(*d.variable, *environment_);
+        define_variable_tuple(*d.variable, *environment_, locations_);
         return;
     }
 
     ObjectReference value = (*d.initializer)->accept(*this);
 
+    // Only variables declared at the top level, into global slots, and boxed variables are
+    // resolved
     const auto set_function = [this](const Ast::Variable& v, const ObjectReference& o) {
-        environment_->define(v.name.lexeme, o);
+        const auto location = locations_.find(v.id);
+        if (location != locations_.end() && is_global(location->second)) {
+            globals_->define(global_slot(location->second), o);
+        } else {
+            environment_->define(v.name.lexeme(), o, location != locations_.end());
+        }
     };
     set_variable_tuple(set_function, *d.variable, value, d.token);
 }
 
 void Interpreter::operator()(const Ast::Import& i)
 {
+    if (i.lazy) {
+        assert(i.variable && "Lazy imports are always imported into an object");
+        auto load = [run_module = run_module_, filepath = i.filepath, token = i.token] {
+            return run_module(filepath, token);
+        };
+        LazyModule module{i.filepath, std::make_shared<const std::function<Set()>>(load)};
+        environment_->define((*i.variable)->name.lexeme(), std::move(module),
+                             is_boxed(locations_, **i.variable));
+        return;
+    }
+
     // If it's imported in place, we interpret in the current environment, otherwise we create an
     // entirely new environment
-    auto new_environment = i.variable ? std::make_shared<Environment>() : environment_;
+    const auto globals = i.variable ? std::make_shared<Globals>(globals_->module()) : globals_;
+    auto new_environment = i.variable ? std::make_shared<Environment>(*globals) : environment_;
 
-    interpret(i.ast, locations_, new_environment, global_environment_);
+    interpret(*i.ast, locations_, new_environment, globals, run_module_);
 
     if (i.variable) { 
         // If we're importing into an object, then we define that object here
-        Set& s = new_environment->set();
-        ObjectReference o{std::move(s)};
-        environment_->define((*i.variable)->name.lexeme, o);
+        // The values are copied rather than moved, since the module's environment is the closure
+        // of the functions defined in it
+        ObjectReference o{new_environment->set()};
+        environment_->define((*i.variable)->name.lexeme(), o, is_boxed(locations_, **i.variable));
     }
 }
 
 ObjectReference Interpreter::call(const Function& f, const FunctionInput<ObjectReference>& input,
                                   const Token& token)
 {
+    if (f.memo()) return this->call_memoized(f, input, token);
+
     if (input.size() > f.expression().input.size()) {
         auto expects = std::to_string(f.expression().input.size());
         auto received = std::to_string(input.size());
@@ -332,18 +549,19 @@ ObjectReference Interpreter::call(const Function& f, const FunctionInput<ObjectR
     }
 
     auto new_environment = std::make_shared<Environment>(f.closure());
-    Interpreter new_interpreter{locations_, new_environment, global_environment_};
+    Interpreter new_interpreter{locations_, new_environment, f.globals(), run_module_, f.closure(),
+                                &f.captures()};
 
-    const auto set_function = [&new_environment](const Ast::Variable& v,
-                                                 const ObjectReference& o) {
-        new_environment->define(v.name.lexeme, o);
+    const auto set_function = [this, &new_environment](const Ast::Variable& v,
+                                                       const ObjectReference& o) {
+        new_environment->define(v.name.lexeme(), o, is_boxed(locations_, v));
     };
 
     for (std::size_t i = 0; i < input.size(); ++i) {
         set_variable_tuple(set_function, *f.expression().input[i], input[i], token);
     }
     for (std::size_t i = input.size(); i < f.expression().input.size(); ++i) {
-        define_variable_tuple(*f.expression().input[i], *new_environment);
+        define_variable_tuple(*f.expression().input[i], *new_environment, locations_);
     }
 
     try {
@@ -354,11 +572,56 @@ ObjectReference Interpreter::call(const Function& f, const FunctionInput<ObjectR
     return nullptr;
 }
 
+ObjectReference Interpreter::call(const ObjectReference& callee,
+                                  const FunctionInput<ObjectReference>& input, const Token& token)
+{
+    const auto visitor = combine(
+        [&](const Function& f) -> ObjectReference {
+            return this->call(f, input, token);
+        },
+        [&](const BuiltInFunction& f) -> ObjectReference {
+            if (!f.call_back) return f.call(input, token);
+
+            return f.call_back(input, token, [this](const ObjectReference& callee,
+                                                    const FunctionInput<ObjectReference>& input,
+                                                    const Token& token) {
+                return this->call(callee, input, token);
+            });
+        },
+        [&](const RecordType& t) -> ObjectReference {
+            return t.construct(input, token);
+        },
+        [&](auto) -> ObjectReference {
+            throw RuntimeError(token, "can only call functions");
+        }
+    );
+
+    return callee.visit(visitor);
+}
+
+// Kept apart from call, so that calls to other functions don't need any more stack
+ObjectReference Interpreter::call_memoized(const Function& f,
+                                           const FunctionInput<ObjectReference>& input,
+                                           const Token& token)
+{
+    auto& cache = *f.memo();
+    auto key = MemoCache::key(input);
+    if (!key) {
+        cache.miss();
+        return this->call(cache.function(), input, token);
+    }
+    if (const auto cached = cache.find(*key)) return *cached;
+
+    auto result = this->call(cache.function(), input, token);
+    cache.store(std::move(*key), result);
+    return result;
+}
+
 void interpret(const Ast::Ast& ast, const Locations& locations,
-               std::shared_ptr<Environment> environment,
-               std::shared_ptr<Environment> global_environment)
+               std::shared_ptr<Environment> environment, const std::shared_ptr<Globals>& globals,
+               const ModuleRunner& run_module)
 {
-    Interpreter i{locations, std::move(environment), std::move(global_environment)};
+    Interpreter i{locations, environment, globals, run_module, environment, nullptr};
     for (auto& statement : ast) {
         statement->accept(i);
     }
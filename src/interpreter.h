@@ -6,11 +6,17 @@
 #include "resolver.h"
 
 #include <memory>
+#include <functional>
+#include <string>
 
 struct ReturnValue {
     ObjectReference value;
 };
 
+// Loads, resolves and runs a lazily imported file in a new environment, returning its contents.
+// Provided by the Program, since that knows how files are loaded and which interpreter to use.
+using ModuleRunner = std::function<Set(const std::string& filepath, const Token&)>;
+
 void interpret(const Ast::Ast& ast, const Locations&, std::shared_ptr<Environment> environment,
-               std::shared_ptr<Environment> global_environment);
+               const std::shared_ptr<Globals>&, const ModuleRunner&);
 
@@ -0,0 +1,82 @@
+#include "list.h"
+#include "object.h"
+
+#include <vector>
+
+struct List::Elements {
+    // Only one of these is used, the objects once anything but a number has been stored
+    std::vector<double> numbers;
+    std::vector<ObjectReference> objects;
+    bool boxed = false;
+
+    void box()
+    {
+        objects.reserve(numbers.capacity());
+        for (const auto x : numbers) objects.emplace_back(x);
+        numbers = {};
+        boxed = true;
+    }
+};
+
+List::List()
+    : elements_{std::make_shared<Elements>()}
+{}
+
+std::size_t List::size() const
+{
+    return elements_->boxed ? elements_->objects.size() : elements_->numbers.size();
+}
+
+ObjectReference List::get(std::size_t index) const
+{
+    if (elements_->boxed) return elements_->objects[index];
+    return elements_->numbers[index];
+}
+
+void List::put(std::size_t index, ObjectReference o) const
+{
+    if (!elements_->boxed && o.holds<double>()) {
+        elements_->numbers[index] = o.get_unchecked<double>();
+        return;
+    }
+    if (!elements_->boxed) elements_->box();
+    elements_->objects[index] = std::move(o);
+}
+
+void List::push(ObjectReference o) const
+{
+    if (!elements_->boxed && o.holds<double>()) {
+        elements_->numbers.push_back(o.get_unchecked<double>());
+        return;
+    }
+    if (!elements_->boxed) elements_->box();
+    elements_->objects.push_back(std::move(o));
+}
+
+void List::resize(std::size_t size, const ObjectReference& o) const
+{
+    if (size <= this->size()) return;
+    if (!elements_->boxed && o.holds<double>()) {
+        elements_->numbers.resize(size, o.get_unchecked<double>());
+        return;
+    }
+    if (!elements_->boxed) elements_->box();
+    elements_->objects.resize(size, o);
+}
+
+ObjectReference List::pop() const
+{
+    if (!elements_->boxed) {
+        const auto x = elements_->numbers.back();
+        elements_->numbers.pop_back();
+        return x;
+    }
+    auto o = std::move(elements_->objects.back());
+    elements_->objects.pop_back();
+    return o;
+}
+
+bool operator==(const List& a, const List& b)
+{
+    return a.elements_ == b.elements_;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+
+struct ObjectReference;
+
+// A mutable sequence of objects, which every copy of the list shares, so a list is only equal to
+// itself. While a list only holds numbers they're kept unboxed, next to each other, and the list
+// only switches to holding references to objects when something else is first stored in it.
+//
+// The list itself is the handle to its elements, so changing the elements doesn't change the list,
+// and can be done through a const list. The elements are only freed along with the last handle, so
+// a list that holds itself, directly or through other lists, dictionaries or records, is never
+// freed.
+struct List {
+    List();
+
+    std::size_t size() const;
+
+    // The index must be less than the size
+    ObjectReference get(std::size_t index) const;
+    void put(std::size_t index, ObjectReference) const;
+    void push(ObjectReference) const;
+    // Adds copies of the object to the end until the list has the size
+    void resize(std::size_t, const ObjectReference&) const;
+    // The list mustn't be empty
+    ObjectReference pop() const;
+
+    friend bool operator==(const List&, const List&);
+private:
+    struct Elements;
+    std::shared_ptr<Elements> elements_;
+};
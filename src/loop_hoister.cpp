@@ -0,0 +1,888 @@
+#include "loop_hoister.h"
+#include "pass_helpers.h"
+#include "object.h"
+
+#include <algorithm>
+#include <cassert>
+#include <deque>
+#include <optional>
+#include <string_view>
+#include <unordered_set>
+
+namespace {
+
+Ast::Type type_of(const ObjectReference& o)
+{
+    if (o.holds<double>()) return Ast::Type::number;
+    if (o.holds<bool>()) return Ast::Type::boolean;
+    if (o.holds<std::string>()) return Ast::Type::string;
+    return Ast::Type::unknown;
+}
+
+// Temporaries can't clash with the program's variables, whose names can't start with a '$'. The
+// tokens of the temporaries refer to the names, so they're kept for as long as the program runs.
+std::string_view temporary_name(std::size_t index)
+{
+    static std::deque<std::string> names;
+    while (names.size() <= index) names.push_back("$" + std::to_string(names.size()));
+    return names[index];
+}
+
+// Whether evaluating the expression can't change anything, so that evaluating it again right away
+// gives the same value, or fails the same way
+bool has_no_effects(const Ast::Expression& e)
+{
+    if (dynamic_cast<const Ast::Literal*>(&e) || dynamic_cast<const Ast::Variable*>(&e)) {
+        return true;
+    }
+    if (const auto g = dynamic_cast<const Ast::Grouping*>(&e)) {
+        return has_no_effects(*g->expression);
+    }
+    if (const auto u = dynamic_cast<const Ast::Unary*>(&e)) return has_no_effects(*u->right);
+    if (const auto b = dynamic_cast<const Ast::Binary*>(&e)) {
+        return has_no_effects(*b->left) && has_no_effects(*b->right);
+    }
+    if (const auto l = dynamic_cast<const Ast::Logical*>(&e)) {
+        return has_no_effects(*l->left) && has_no_effects(*l->right);
+    }
+    if (const auto t = dynamic_cast<const Ast::Tuple*>(&e)) {
+        return std::all_of(t->elements.begin(), t->elements.end(),
+                           [](const auto& element) { return has_no_effects(*element); });
+    }
+    return false;
+}
+
+// Copies an expression without effects, whose copy is evaluated in the same scope
+std::unique_ptr<Ast::Expression> copy(const Ast::Expression& e, Locations& locations)
+{
+    if (const auto l = dynamic_cast<const Ast::Literal*>(&e)) {
+        return std::make_unique<Ast::Literal>(l->value);
+    }
+    if (const auto v = dynamic_cast<const Ast::Variable*>(&e)) {
+        auto variable = std::make_unique<Ast::Variable>(v->name);
+        if (const auto location = locations.find(v->id); location != locations.end()) {
+            const auto copied = location->second;
+            locations[variable->id] = copied;
+        }
+        return variable;
+    }
+    if (const auto g = dynamic_cast<const Ast::Grouping*>(&e)) {
+        return std::make_unique<Ast::Grouping>(copy(*g->expression, locations));
+    }
+    if (const auto u = dynamic_cast<const Ast::Unary*>(&e)) {
+        return std::make_unique<Ast::Unary>(u->op, copy(*u->right, locations));
+    }
+    if (const auto b = dynamic_cast<const Ast::Binary*>(&e)) {
+        auto left = copy(*b->left, locations);
+        return std::make_unique<Ast::Binary>(std::move(left), b->op, copy(*b->right, locations));
+    }
+    if (const auto l = dynamic_cast<const Ast::Logical*>(&e)) {
+        auto left = copy(*l->left, locations);
+        return std::make_unique<Ast::Logical>(std::move(left), l->op, copy(*l->right, locations));
+    }
+    const auto& t = dynamic_cast<const Ast::Tuple&>(e);
+    std::vector<std::unique_ptr<Ast::Expression>> elements;
+    for (const auto& element : t.elements) elements.push_back(copy(*element, locations));
+    return std::make_unique<Ast::Tuple>(std::move(elements));
+}
+
+// Reading a temporary costs about as much as evaluating a literal or a variable, or an operator
+// applied to a literal
+bool is_worth_hoisting(const Ast::Expression& e)
+{
+    const auto& expression = ungrouped(e);
+    if (dynamic_cast<const Ast::Literal*>(&expression) ||
+        dynamic_cast<const Ast::Variable*>(&expression))
+    {
+        return false;
+    }
+    if (const auto u = dynamic_cast<const Ast::Unary*>(&expression)) {
+        return !dynamic_cast<const Ast::Literal*>(&ungrouped(*u->right));
+    }
+    return true;
+}
+
+// The type of the result of an operator that can't fail on operands of the given types
+std::optional<Ast::Type> result_type(Token::Type op, Ast::Type left, Ast::Type right)
+{
+    const bool numbers = left == Ast::Type::number && right == Ast::Type::number;
+    switch (op) {
+        case Token::Type::minus:
+        case Token::Type::slash:
+        case Token::Type::star:
+            if (numbers) return Ast::Type::number;
+            return {};
+        case Token::Type::greater:
+        case Token::Type::greater_equal:
+        case Token::Type::less:
+        case Token::Type::less_equal:
+            if (numbers) return Ast::Type::boolean;
+            return {};
+        case Token::Type::plus:
+            if (numbers) return Ast::Type::number;
+            if (left == Ast::Type::string && right == Ast::Type::string) return Ast::Type::string;
+            return {};
+        case Token::Type::bang_equal:
+        case Token::Type::equal_equal:
+            return Ast::Type::boolean;
+        default:
+            return {};
+    }
+}
+
+// The names a loop assigns or declares anywhere in it, including in the functions it defines
+struct Changes : Ast::Expression::Visitor<void>, Ast::Statement::Visitor<void> {
+    std::unordered_set<std::string_view> names;
+    // Set if the loop imports a file without a name, which can declare any name
+    bool unknown = false;
+
+    void add(const Ast::Statement& s) { s.accept(*this); }
+    void add(const Ast::Expression& e) { e.accept(*this); }
+    void add(const Ast::VariableTuple& vt) {
+        Ast::for_each_variable(vt, [this](const Ast::Variable& v) {
+            names.insert(v.name.lexeme());
+        });
+    }
+
+    void operator()(const Ast::Assign& a) override {
+        this->add(*a.expression);
+        this->add(*a.variable);
+    }
+    void operator()(const Ast::AssignMember& a) override {
+        this->add(*a.object);
+        this->add(*a.expression);
+    }
+    void operator()(const Ast::Binary& b) override {
+        this->add(*b.left);
+        this->add(*b.right);
+    }
+    void operator()(const Ast::Call& c) override {
+        this->add(*c.callee);
+        for (std::size_t i = 0; i < c.input.size(); ++i) this->add(*c.input[i]);
+    }
+    void operator()(const Ast::Function& f) override {
+        for (std::size_t i = 0; i < f.input.size(); ++i) this->add(*f.input[i]);
+        this->add(*f.body);
+    }
+    void operator()(const Ast::Get& g) override {
+        this->add(*g.object);
+    }
+    void operator()(const Ast::Grouping& g) override {
+        this->add(*g.expression);
+    }
+    void operator()(const Ast::Inlined& i) override {
+        for (std::size_t j = 0; j < i.arguments.size(); ++j) this->add(*i.arguments[j]);
+        for (std::size_t j = 0; j < i.input.size(); ++j) this->add(*i.input[j]);
+        this->add(*i.body);
+        if (i.result) this->add(**i.result);
+    }
+    void operator()(const Ast::Literal&) override {}
+    void operator()(const Ast::Logical& l) override {
+        this->add(*l.left);
+        this->add(*l.right);
+    }
+    void operator()(const Ast::Tuple& t) override {
+        for (const auto& element : t.elements) this->add(*element);
+    }
+    void operator()(const Ast::Unary& u) override {
+        this->add(*u.right);
+    }
+    void operator()(const Ast::Variable&) override {}
+    void operator()(const Ast::VariableTuple& vt) override {
+        this->add(vt);
+    }
+
+    void operator()(const Ast::Block& b) override {
+        for (const auto& statement : b.statements) this->add(*statement);
+    }
+    void operator()(const Ast::ExpressionStatement& es) override {
+        if (es.expression) this->add(**es.expression);
+    }
+    void operator()(const Ast::If& i) override {
+        this->add(*i.condition);
+        this->add(*i.then_branch);
+        if (i.else_branch) this->add(**i.else_branch);
+    }
+    void operator()(const Ast::Return& r) override {
+        if (r.expression) this->add(**r.expression);
+    }
+    void operator()(const Ast::While& w) override {
+        this->add(*w.condition);
+        this->add(*w.body);
+    }
+    void operator()(const Ast::Declaration& d) override {
+        if (d.initializer) this->add(**d.initializer);
+        this->add(*d.variable);
+    }
+    void operator()(const Ast::Import& i) override {
+        if (i.variable) {
+            names.insert((*i.variable)->name.lexeme());
+        } else {
+            unknown = true;
+        }
+    }
+};
+
+// An invariant part of the loop being hoisted, and how many scopes into the loop it is
+struct Invariant {
+    std::unique_ptr<Ast::Expression>* expression;
+    int depth;
+    unsigned line;
+};
+
+// Finds the invariant parts of a loop, given the types its variables have on entering it and the
+// names it changes
+struct InvariantFinder : Ast::Expression::MutableVisitor, Ast::Statement::MutableVisitor {
+    InvariantFinder(const Locations& l, const std::unordered_map<std::string_view, Ast::Type>& e,
+                    const std::unordered_set<std::string_view>& c)
+        : locations_{l}, entry_{e}, changed_{c}
+    {}
+
+    void find(std::unique_ptr<Ast::Statement>&);
+    void find_parts(std::unique_ptr<Ast::Expression>&);
+
+    void operator()(Ast::Assign&) override;
+    void operator()(Ast::AssignMember&) override;
+    void operator()(Ast::Binary&) override;
+    void operator()(Ast::Call&) override;
+    void operator()(Ast::Function&) override;
+    void operator()(Ast::Get&) override;
+    void operator()(Ast::Grouping&) override;
+    void operator()(Ast::Inlined&) override;
+    void operator()(Ast::Literal&) override;
+    void operator()(Ast::Logical&) override;
+    void operator()(Ast::Tuple&) override;
+    void operator()(Ast::Unary&) override;
+    void operator()(Ast::Variable&) override;
+    void operator()(Ast::VariableTuple&) override;
+
+    void operator()(Ast::Block&) override;
+    void operator()(Ast::ExpressionStatement&) override;
+    void operator()(Ast::If&) override;
+    void operator()(Ast::Return&) override;
+    void operator()(Ast::While&) override;
+    void operator()(Ast::Declaration&) override;
+    void operator()(Ast::Import&) override;
+
+    std::vector<Invariant> invariants;
+private:
+    // Returns the expression's type if it's invariant, and otherwise finds its invariant parts
+    std::optional<Ast::Type> find(std::unique_ptr<Ast::Expression>&);
+    std::optional<Ast::Type> invariant_type(const Ast::Variable&) const;
+    void add(std::unique_ptr<Ast::Expression>&);
+
+    const Locations& locations_;
+    const std::unordered_map<std::string_view, Ast::Type>& entry_;
+    const std::unordered_set<std::string_view>& changed_;
+
+    // How many scopes into the loop the statement or expression being visited is
+    int depth_ = 0;
+    // The type of the expression just visited, if it's invariant
+    std::optional<Ast::Type> type_;
+    // The line of the last token found in the loop, for parts that have none of their own
+    unsigned line_ = 0;
+};
+
+void InvariantFinder::find(std::unique_ptr<Ast::Statement>& statement)
+{
+    statement->accept(*this);
+}
+
+void InvariantFinder::find_parts(std::unique_ptr<Ast::Expression>& expression)
+{
+    if (this->find(expression)) this->add(expression);
+}
+
+std::optional<Ast::Type> InvariantFinder::find(std::unique_ptr<Ast::Expression>& expression)
+{
+    type_.reset();
+    expression->accept(*this);
+    return type_;
+}
+
+std::optional<Ast::Type> InvariantFinder::invariant_type(const Ast::Variable& v) const
+{
+    const auto location = locations_.find(v.id);
+    if (location == locations_.end() || is_global(location->second) ||
+        is_captured(location->second))
+    {
+        return {};
+    }
+
+    // A name the loop doesn't declare is bound outside of it, to what it's bound to on entering it
+    const auto name = v.name.lexeme();
+    if (changed_.count(name) > 0) return {};
+    const auto type = entry_.find(name);
+    if (type == entry_.end()) return {};
+    return type->second;
+}
+
+void InvariantFinder::add(std::unique_ptr<Ast::Expression>& expression)
+{
+    if (!is_worth_hoisting(*expression)) return;
+    invariants.push_back({&expression, depth_, line_of(*expression).value_or(line_)});
+}
+
+// Anything that could fail or change something isn't invariant, but its parts might be
+
+void InvariantFinder::operator()(Ast::Assign& a)
+{
+    line_ = a.token.line;
+    this->find_parts(a.expression);
+    type_.reset();
+}
+
+void InvariantFinder::operator()(Ast::AssignMember& a)
+{
+    this->find_parts(a.object);
+    line_ = a.name.line;
+    this->find_parts(a.expression);
+    type_.reset();
+}
+
+void InvariantFinder::operator()(Ast::Binary& b)
+{
+    const auto left = this->find(b.left);
+    line_ = b.op.line;
+    const auto right = this->find(b.right);
+    if (left && right) {
+        if (const auto type = result_type(b.op.type, *left, *right)) {
+            type_ = type;
+            return;
+        }
+    }
+    if (left) this->add(b.left);
+    if (right) this->add(b.right);
+    type_.reset();
+}
+
+void InvariantFinder::operator()(Ast::Call& c)
+{
+    this->find_parts(c.callee);
+    line_ = c.token.line;
+    for (std::size_t i = 0; i < c.input.size(); ++i) this->find_parts(c.input[i]);
+    type_.reset();
+}
+
+void InvariantFinder::operator()(Ast::Function&)
+{
+    // Functions' bodies aren't evaluated where the functions are
+    type_.reset();
+}
+
+void InvariantFinder::operator()(Ast::Get& g)
+{
+    this->find_parts(g.object);
+    line_ = g.name.line;
+    type_.reset();
+}
+
+void InvariantFinder::operator()(Ast::Grouping& g)
+{
+    type_ = this->find(g.expression);
+}
+
+void InvariantFinder::operator()(Ast::Inlined& i)
+{
+    line_ = i.token.line;
+    for (std::size_t j = 0; j < i.arguments.size(); ++j) this->find_parts(i.arguments[j]);
+
+    // The inputs and the body share a scope
+    ++depth_;
+    for (auto& statement : i.body->statements) this->find(statement);
+    if (i.result) this->find_parts(*i.result);
+    --depth_;
+    type_.reset();
+}
+
+void InvariantFinder::operator()(Ast::Literal& l)
+{
+    type_ = type_of(l.value);
+}
+
+void InvariantFinder::operator()(Ast::Logical& l)
+{
+    const auto left = this->find(l.left);
+    line_ = l.op.line;
+    const auto right = this->find(l.right);
+    if (left && right) {
+        type_ = *right == Ast::Type::boolean ? Ast::Type::boolean : Ast::Type::unknown;
+        return;
+    }
+    if (left) this->add(l.left);
+    if (right) this->add(l.right);
+    type_.reset();
+}
+
+void InvariantFinder::operator()(Ast::Tuple& t)
+{
+    std::vector<bool> invariant;
+    for (auto& element : t.elements) invariant.push_back(this->find(element).has_value());
+    if (std::all_of(invariant.begin(), invariant.end(), [](bool i) { return i; })) {
+        type_ = Ast::Type::unknown;
+        return;
+    }
+    for (std::size_t i = 0; i < t.elements.size(); ++i) {
+        if (invariant[i]) this->add(t.elements[i]);
+    }
+    type_.reset();
+}
+
+void InvariantFinder::operator()(Ast::Unary& u)
+{
+    line_ = u.op.line;
+    const auto right = this->find(u.right);
+    if (right && u.op.type == Token::Type::bang) {
+        type_ = Ast::Type::boolean;
+        return;
+    }
+    if (right && u.op.type == Token::Type::minus && *right == Ast::Type::number) {
+        type_ = Ast::Type::number;
+        return;
+    }
+    if (right) this->add(u.right);
+    type_.reset();
+}
+
+void InvariantFinder::operator()(Ast::Variable& v)
+{
+    line_ = v.name.line;
+    type_ = this->invariant_type(v);
+}
+
+void InvariantFinder::operator()(Ast::VariableTuple&)
+{
+    assert(false && "Variable tuples are only part of assignments and declarations, whose "
+                    "variables are never invariant");
+}
+
+void InvariantFinder::operator()(Ast::Block& b)
+{
+    ++depth_;
+    for (auto& statement : b.statements) this->find(statement);
+    --depth_;
+}
+
+void InvariantFinder::operator()(Ast::ExpressionStatement& es)
+{
+    if (es.expression) this->find_parts(*es.expression);
+}
+
+void InvariantFinder::operator()(Ast::If& i)
+{
+    line_ = i.keyword.line;
+    this->find_parts(i.condition);
+    this->find(i.then_branch);
+    if (i.else_branch) this->find(*i.else_branch);
+}
+
+void InvariantFinder::operator()(Ast::Return& r)
+{
+    line_ = r.keyword.line;
+    if (r.expression) this->find_parts(*r.expression);
+}
+
+void InvariantFinder::operator()(Ast::While& w)
+{
+    this->find_parts(w.condition);
+    this->find(w.body);
+}
+
+void InvariantFinder::operator()(Ast::Declaration& d)
+{
+    line_ = d.token.line;
+    if (d.initializer) this->find_parts(*d.initializer);
+}
+
+void InvariantFinder::operator()(Ast::Import&)
+{
+    // Loops that import files without names aren't hoisted, and imports with names only declare
+}
+
+// Moves the variables of a hoisted expression the given number of scopes outwards
+struct Relocator : Ast::Expression::Visitor<void> {
+    Relocator(Locations& l, int s)
+        : locations{l}, scopes{s}
+    {}
+
+    Locations& locations;
+    const int scopes;
+
+    void operator()(const Ast::Assign&) override { this->not_hoisted(); }
+    void operator()(const Ast::AssignMember&) override { this->not_hoisted(); }
+    void operator()(const Ast::Binary& b) override {
+        b.left->accept(*this);
+        b.right->accept(*this);
+    }
+    void operator()(const Ast::Call&) override { this->not_hoisted(); }
+    void operator()(const Ast::Function&) override { this->not_hoisted(); }
+    void operator()(const Ast::Get&) override { this->not_hoisted(); }
+    void operator()(const Ast::Grouping& g) override {
+        g.expression->accept(*this);
+    }
+    void operator()(const Ast::Inlined&) override { this->not_hoisted(); }
+    void operator()(const Ast::Literal&) override {}
+    void operator()(const Ast::Logical& l) override {
+        l.left->accept(*this);
+        l.right->accept(*this);
+    }
+    void operator()(const Ast::Tuple& t) override {
+        for (const auto& element : t.elements) element->accept(*this);
+    }
+    void operator()(const Ast::Unary& u) override {
+        u.right->accept(*this);
+    }
+    void operator()(const Ast::Variable& v) override {
+        locations[v.id] += scopes;
+    }
+    void operator()(const Ast::VariableTuple&) override { this->not_hoisted(); }
+private:
+    void not_hoisted() {
+        assert(false && "Only expressions that can't fail or change anything are hoisted");
+    }
+};
+
+// The loop is put in a block, which is one more scope between the variables found at or beyond the
+// given depth and their uses
+struct Deepener : Ast::Expression::Visitor<void>, Ast::Statement::Visitor<void> {
+    Deepener(Locations& l, int d)
+        : locations{l}, depth{d}
+    {}
+
+    Locations& locations;
+    int depth;
+
+    void operator()(const Ast::Assign& a) override {
+        a.expression->accept(*this);
+        Ast::for_each_variable(*a.variable, [this](const Ast::Variable& v) { (*this)(v); });
+    }
+    void operator()(const Ast::AssignMember& a) override {
+        a.object->accept(*this);
+        a.expression->accept(*this);
+    }
+    void operator()(const Ast::Binary& b) override {
+        b.left->accept(*this);
+        b.right->accept(*this);
+    }
+    void operator()(const Ast::Call& c) override {
+        c.callee->accept(*this);
+        for (std::size_t i = 0; i < c.input.size(); ++i) c.input[i]->accept(*this);
+    }
+    void operator()(const Ast::Function& f) override {
+        // The function's own variables are found from inside it, only its captures are found
+        // from where it's created
+        auto captures = *f.captures;
+        for (auto& capture : captures) {
+            if (!is_captured(capture.location) && capture.location >= depth) ++capture.location;
+        }
+        f.captures = std::make_shared<const std::vector<Ast::Capture>>(std::move(captures));
+    }
+    void operator()(const Ast::Get& g) override {
+        g.object->accept(*this);
+    }
+    void operator()(const Ast::Grouping& g) override {
+        g.expression->accept(*this);
+    }
+    void operator()(const Ast::Inlined& i) override {
+        for (std::size_t j = 0; j < i.arguments.size(); ++j) i.arguments[j]->accept(*this);
+        ++depth;
+        for (const auto& statement : i.body->statements) statement->accept(*this);
+        if (i.result) (*i.result)->accept(*this);
+        --depth;
+    }
+    void operator()(const Ast::Literal&) override {}
+    void operator()(const Ast::Logical& l) override {
+        l.left->accept(*this);
+        l.right->accept(*this);
+    }
+    void operator()(const Ast::Tuple& t) override {
+        for (const auto& element : t.elements) element->accept(*this);
+    }
+    void operator()(const Ast::Unary& u) override {
+        u.right->accept(*this);
+    }
+    void operator()(const Ast::Variable& v) override {
+        const auto location = locations.find(v.id);
+        if (location == locations.end()) return;
+
+        // Globals and captures aren't found by depth, and nor are declarations of boxed variables
+        auto& found = location->second;
+        if (!is_global(found) && !is_captured(found) && found >= depth) ++found;
+    }
+    void operator()(const Ast::VariableTuple&) override {}
+
+    void operator()(const Ast::Block& b) override {
+        ++depth;
+        for (const auto& statement : b.statements) statement->accept(*this);
+        --depth;
+    }
+    void operator()(const Ast::ExpressionStatement& es) override {
+        if (es.expression) (*es.expression)->accept(*this);
+    }
+    void operator()(const Ast::If& i) override {
+        i.condition->accept(*this);
+        i.then_branch->accept(*this);
+        if (i.else_branch) (*i.else_branch)->accept(*this);
+    }
+    void operator()(const Ast::Return& r) override {
+        if (r.expression) (*r.expression)->accept(*this);
+    }
+    void operator()(const Ast::While& w) override {
+        w.condition->accept(*this);
+        w.body->accept(*this);
+    }
+    void operator()(const Ast::Declaration& d) override {
+        if (d.initializer) (*d.initializer)->accept(*this);
+    }
+    void operator()(const Ast::Import&) override {}
+};
+
+// Loops are hoisted from the innermost out, so that what's hoisted out of a loop can be hoisted
+// further out of the loops around it
+struct Hoister : Ast::Expression::Visitor<void>, Ast::Statement::MutableVisitor {
+    Hoister(Locations& l, const LoopEntryTypes& t, std::vector<std::string>* r)
+        : locations_{l}, entry_types_{t}, report_{r}
+    {}
+
+    void walk(Ast::Ast& statements);
+
+    bool hoisted() const { return hoisted_; }
+
+    void operator()(const Ast::Assign&) override;
+    void operator()(const Ast::AssignMember&) override;
+    void operator()(const Ast::Binary&) override;
+    void operator()(const Ast::Call&) override;
+    void operator()(const Ast::Function&) override;
+    void operator()(const Ast::Get&) override;
+    void operator()(const Ast::Grouping&) override;
+    void operator()(const Ast::Inlined&) override;
+    void operator()(const Ast::Literal&) override;
+    void operator()(const Ast::Logical&) override;
+    void operator()(const Ast::Tuple&) override;
+    void operator()(const Ast::Unary&) override;
+    void operator()(const Ast::Variable&) override;
+    void operator()(const Ast::VariableTuple&) override;
+
+    void operator()(Ast::Block&) override;
+    void operator()(Ast::ExpressionStatement&) override;
+    void operator()(Ast::If&) override;
+    void operator()(Ast::Return&) override;
+    void operator()(Ast::While&) override;
+    void operator()(Ast::Declaration&) override;
+    void operator()(Ast::Import&) override;
+private:
+    void walk(std::unique_ptr<Ast::Statement>&);
+
+    void hoist(std::unique_ptr<Ast::Statement>& loop);
+
+    Locations& locations_;
+    const LoopEntryTypes& entry_types_;
+    std::vector<std::string>* report_;
+    bool hoisted_ = false;
+
+    // The statement being walked, which a loop that's hoisted is replaced in
+    std::unique_ptr<Ast::Statement>* statement_ = nullptr;
+};
+
+void Hoister::walk(Ast::Ast& statements)
+{
+    for (auto& statement : statements) this->walk(statement);
+}
+
+void Hoister::walk(std::unique_ptr<Ast::Statement>& statement)
+{
+    statement_ = &statement;
+    statement->accept(*this);
+}
+
+void Hoister::operator()(const Ast::Assign& a)
+{
+    a.expression->accept(*this);
+}
+
+void Hoister::operator()(const Ast::AssignMember& a)
+{
+    a.object->accept(*this);
+    a.expression->accept(*this);
+}
+
+void Hoister::operator()(const Ast::Binary& b)
+{
+    b.left->accept(*this);
+    b.right->accept(*this);
+}
+
+void Hoister::operator()(const Ast::Call& c)
+{
+    c.callee->accept(*this);
+    for (std::size_t i = 0; i < c.input.size(); ++i) c.input[i]->accept(*this);
+}
+
+void Hoister::operator()(const Ast::Function& f)
+{
+    this->walk(f.body->statements);
+}
+
+void Hoister::operator()(const Ast::Get& g)
+{
+    g.object->accept(*this);
+}
+
+void Hoister::operator()(const Ast::Grouping& g)
+{
+    g.expression->accept(*this);
+}
+
+void Hoister::operator()(const Ast::Inlined& i)
+{
+    for (std::size_t j = 0; j < i.arguments.size(); ++j) i.arguments[j]->accept(*this);
+    this->walk(i.body->statements);
+    if (i.result) (*i.result)->accept(*this);
+}
+
+void Hoister::operator()(const Ast::Literal&)
+{
+}
+
+void Hoister::operator()(const Ast::Logical& l)
+{
+    l.left->accept(*this);
+    l.right->accept(*this);
+}
+
+void Hoister::operator()(const Ast::Tuple& t)
+{
+    for (const auto& element : t.elements) element->accept(*this);
+}
+
+void Hoister::operator()(const Ast::Unary& u)
+{
+    u.right->accept(*this);
+}
+
+void Hoister::operator()(const Ast::Variable&)
+{
+}
+
+void Hoister::operator()(const Ast::VariableTuple&)
+{
+}
+
+void Hoister::operator()(Ast::Block& b)
+{
+    this->walk(b.statements);
+}
+
+void Hoister::operator()(Ast::ExpressionStatement& es)
+{
+    if (es.expression) (*es.expression)->accept(*this);
+}
+
+void Hoister::operator()(Ast::If& i)
+{
+    i.condition->accept(*this);
+    this->walk(i.then_branch);
+    if (i.else_branch) this->walk(*i.else_branch);
+}
+
+void Hoister::operator()(Ast::Return& r)
+{
+    if (r.expression) (*r.expression)->accept(*this);
+}
+
+void Hoister::operator()(Ast::While& w)
+{
+    auto& statement = *statement_;
+    w.condition->accept(*this);
+    this->walk(w.body);
+    this->hoist(statement);
+}
+
+void Hoister::operator()(Ast::Declaration& d)
+{
+    if (d.initializer) (*d.initializer)->accept(*this);
+}
+
+void Hoister::operator()(Ast::Import&)
+{
+    // Imported files are shared between importers, so they're left as they are
+}
+
+void Hoister::hoist(std::unique_ptr<Ast::Statement>& loop)
+{
+    auto& w = dynamic_cast<Ast::While&>(*loop);
+
+    // The condition is evaluated once more before the loop, to skip the temporaries if the loop
+    // never runs
+    if (!has_no_effects(*w.condition)) return;
+
+    const auto entry = entry_types_.find(&w);
+    if (entry == entry_types_.end()) return;
+
+    Changes changes;
+    changes.add(*w.condition);
+    changes.add(*w.body);
+    if (changes.unknown) return;
+
+    InvariantFinder finder{locations_, entry->second, changes.names};
+    finder.find_parts(w.condition);
+    finder.find(w.body);
+    const auto& invariants = finder.invariants;
+    if (invariants.empty()) return;
+
+    auto guard = copy(*w.condition, locations_);
+
+    Ast::Ast statements;
+    std::vector<std::pair<const Ast::Variable*, int>> temporaries;
+    for (std::size_t i = 0; i < invariants.size(); ++i) {
+        auto [expression, depth, line] = invariants[i];
+        auto hoisted = std::move(*expression);
+        const auto& part = ungrouped(*hoisted);
+
+        std::string label = "tuple";
+        if (const auto b = dynamic_cast<const Ast::Binary*>(&part)) {
+            label = "'" + std::string{b->op.lexeme()} + "'";
+        } else if (const auto l = dynamic_cast<const Ast::Logical*>(&part)) {
+            label = "'" + std::string{l->op.lexeme()} + "'";
+        } else if (const auto u = dynamic_cast<const Ast::Unary*>(&part)) {
+            label = "'" + std::string{u->op.lexeme()} + "'";
+        }
+        add_to_report(report_, "[line " + std::to_string(line) + "] hoisted invariant " +
+                               label + " out of loop");
+
+        // Declared in the block the loop is put in, which is one scope inside the loop's own
+        Relocator relocator{locations_, 1 - depth};
+        hoisted->accept(relocator);
+        const Token name{Token::Type::identifier, temporary_name(i), line};
+        auto temporary = std::make_unique<Ast::Variable>(name);
+        temporaries.emplace_back(temporary.get(), depth);
+        *expression = std::move(temporary);
+
+        statements.push_back(std::make_unique<Ast::Declaration>(
+            std::make_unique<Ast::VariableTuple>(Ast::Variable{name}),
+            Token{Token::Type::semicolon, ";", line}, std::move(hoisted)));
+    }
+
+    // The temporaries aren't located yet, so they're left where they are
+    Deepener deepener{locations_, 0};
+    w.condition->accept(deepener);
+    w.body->accept(deepener);
+    for (const auto& [temporary, depth] : temporaries) locations_[temporary->id] = depth;
+
+    const auto line = dynamic_cast<const Ast::Declaration&>(*statements.front()).token.line;
+    statements.push_back(std::move(loop));
+    loop = std::make_unique<Ast::If>(Token{Token::Type::k_if, "if", line}, std::move(guard),
+                                     std::make_unique<Ast::Block>(std::move(statements)),
+                                     std::nullopt);
+    hoisted_ = true;
+}
+
+}
+
+bool hoist_loop_invariants(Ast::Ast& ast, Locations& locations, const LoopEntryTypes& entry_types,
+                           std::vector<std::string>* report)
+{
+    Hoister hoister{locations, entry_types, report};
+    hoister.walk(ast);
+    return hoister.hoisted();
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "ast.h"
+#include "resolver.h"
+#include "type_inference.h"
+
+#include <string>
+#include <vector>
+
+// Moves the parts of while loops that evaluate to the same value every time around the loop out of
+// it, into temporaries declared just before it, once the ast has been optimized and its types
+// inferred. A part is only moved if it can neither fail nor change anything, given the types its
+// variables are known to have on entering the loop, and if none of its variables can change in the
+// loop, which means they're local variables that aren't assigned or declared in it, nor boxed.
+// Calls and member accesses are never moved.
+//
+// The loop is put in a block with its temporaries, under an if on a copy of its condition, so that
+// nothing is evaluated if the loop never is. Loops whose conditions could change anything, and
+// loops that import files without names, are kept as they are. Each part that's moved is
+// described by a line in the report, if there is one. Returns whether anything was moved, in which
+// case the types need inferring again.
+bool hoist_loop_invariants(Ast::Ast&, Locations&, const LoopEntryTypes&,
+                           std::vector<std::string>* report = nullptr);
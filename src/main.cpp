@@ -4,6 +4,7 @@
 #include <fstream>
 #include <sstream>
 #include <string_view>
+#include <optional>
 
 #include "resolver.h"
 #include "argagg.hpp"
@@ -14,6 +15,18 @@
 #include "const.h"
 #include "environment.h"
 #include "ast_printer.h"
+#include "module_cache.h"
+#include "module_prefetcher.h"
+#include "module_registry.h"
+#include "general.h"
+#include "mapped_file.h"
+#include "common_subexpressions.h"
+#include "field_offsets.h"
+#include "inliner.h"
+#include "loop_hoister.h"
+#include "optimizer.h"
+#include "purity.h"
+#include "type_inference.h"
 
 struct DebugOptions {
     constexpr DebugOptions(std::uint8_t data) noexcept
@@ -27,21 +40,35 @@ struct DebugOptions {
     static const DebugOptions locations;
     static const DebugOptions ast;
     static const DebugOptions tokens;
+    static const DebugOptions optimizations;
+    static const DebugOptions types;
 private:
     std::uint8_t data_;
 };
 
-const DebugOptions DebugOptions::none      = 0b00000000;
-const DebugOptions DebugOptions::locations = 0b00000001;
-const DebugOptions DebugOptions::ast       = 0b00000010;
-const DebugOptions DebugOptions::tokens    = 0b00000100;
+const DebugOptions DebugOptions::none          = 0b00000000;
+const DebugOptions DebugOptions::locations     = 0b00000001;
+const DebugOptions DebugOptions::ast           = 0b00000010;
+const DebugOptions DebugOptions::tokens        = 0b00000100;
+const DebugOptions DebugOptions::optimizations = 0b00001000;
+const DebugOptions DebugOptions::types         = 0b00010000;
+
+struct RunOptions {
+    // Read and write .albc cache files for the script and everything it imports
+    bool use_cache = true;
+
+    // Run each top-level statement of the script as soon as it's parsed, rather than parsing the
+    // whole script first. Scripts read from stdin are always streamed.
+    bool stream = false;
+};
 
 struct Program {
-    Program(DebugOptions debug_options = DebugOptions::none)
-        : debug_options_{debug_options}
+    Program(DebugOptions debug_options = DebugOptions::none, RunOptions run_options = {})
+        : debug_options_{debug_options}, run_options_{run_options}
     {}
 
     ErrorCode run_file(std::string_view path);
+    ErrorCode run_stream(std::istream& input);
     void run_prompt();
     ErrorCode run(std::string_view source);
 
@@ -50,18 +77,123 @@ struct Program {
         return error_code_;
     }
 private:
+    std::optional<Ast::Ast> parse_source(std::string_view source);
+    // Also inlines calls to small functions before resolving the ast, optimizes it, using what the
+    // resolver found out about it, infers its types, hoists invariant code out of its loops,
+    // reuses the values of repeated expressions and marks its pure functions
+    void resolve_ast(Ast::Ast&, Locations&);
+    ErrorCode execute(const Ast::Ast&);
+
+    std::shared_ptr<const Ast::Ast> load_import(const std::string& filepath, const Token&);
+    std::shared_ptr<const Ast::Ast> parse_import(const std::string& filepath);
+    Set run_lazy_import(const std::string& filepath, const Token&);
+
+    // A cache hit skips scanning and parsing, so the cache is not used when debugging those
+    bool use_cache() const noexcept {
+        return run_options_.use_cache && debug_options_ == DebugOptions::none;
+    }
+
     DebugOptions debug_options_;
+    RunOptions run_options_;
     ErrorCode error_code_ = ErrorCode::no_error;
 
-    ScopeStack scopes_;
+    // Everything scanned (or read from a cache file) so far, which the tokens in asts refer to.
+    // Files are mapped rather than copied.
+    std::vector<Source> sources_;
+
+    ModuleRegistry modules_;
+    ModulePrefetcher prefetcher_{this->use_cache()};
+    std::shared_ptr<Globals> globals_ = std::make_shared<Globals>(builtin_globals());
+    ScopeStack scopes_{*globals_};
     Locations locations_;
-    std::shared_ptr<Environment> environment_ = std::make_shared<Environment>();
-    std::shared_ptr<Environment> global_environment_ = global_environment;
+    std::shared_ptr<Environment> environment_ = std::make_shared<Environment>(*globals_);
+
+    const ModuleRunner run_module_ = [this](const std::string& filepath, const Token& token) {
+        return this->run_lazy_import(filepath, token);
+    };
 };
 
 ErrorCode Program::run_file(std::string_view path)
 {
-    return this->run(read_file(path));
+    const ModuleRegistry::Loading loading{modules_, std::string{path}};
+    const auto file = std::make_shared<const MappedFile>(std::string{path});
+    sources_.push_back(file);
+    const auto source = file->data();
+
+    // A file that couldn't be read is run as if it were empty, without a cache
+    const bool use_cache = this->use_cache() && *file;
+
+    if (use_cache) {
+        if (auto cached = load_cached_module(path, source)) {
+            sources_.push_back(cached->text);
+            if (cached->resolved) {
+                locations_.insert(cached->locations.begin(), cached->locations.end());
+                for (const auto& [id, name] : cached->globals) {
+                    locations_[id] = global_location(globals_->slot(name));
+                }
+                infer_types(cached->ast, locations_);
+                infer_purity(cached->ast, locations_);
+                resolve_field_offsets(cached->ast);
+            } else {
+                // The cache was written when the file was imported elsewhere
+                this->resolve_ast(cached->ast, locations_);
+                store_cached_module(path, source, cached->ast, &locations_);
+            }
+            return this->execute(cached->ast);
+        }
+    }
+
+    auto ast = this->parse_source(source);
+    if (!ast) return error_code_;
+
+    this->resolve_ast(*ast, locations_);
+
+    if (use_cache) store_cached_module(path, source, *ast, &locations_);
+
+    return this->execute(*ast);
+}
+
+ErrorCode Program::run_stream(std::istream& input)
+{
+    TokenStream tokens{input, [this](const ScanError& e) { this->report(e); }};
+
+    const auto load_import = [this](const std::string& filepath, const Token& token) {
+        return this->load_import(filepath, token);
+    };
+
+    parse(tokens, [this](const Error& e) { this->report(e); }, load_import,
+          [this](StreamedStatement statement) {
+              // After an error, the rest of the input is only parsed to report any other errors
+              if (error_code_ == ErrorCode::runtime_error) return false;
+              if (error_code_ != ErrorCode::no_error) return true;
+
+              if (debug_options_ & DebugOptions::ast) {
+                  std::cout << to_string(statement.ast) << '\n';
+              }
+
+              // The locations of the statement's variables are only needed while it runs, unless it
+              // leaves something behind
+              Locations statement_locations;
+              this->resolve_ast(statement.ast, statement_locations);
+              locations_.insert(statement_locations.begin(), statement_locations.end());
+
+              this->execute(statement.ast);
+
+              if (!statement.keeps_tokens) {
+                  for (const auto& location : statement_locations) {
+                      locations_.erase(location.first);
+                  }
+              } else {
+                  for (auto& source : statement.sources) {
+                      if (sources_.empty() || sources_.back() != source) {
+                          sources_.push_back(std::move(source));
+                      }
+                  }
+              }
+              return true;
+          });
+
+    return error_code_;
 }
 
 void Program::run_prompt()
@@ -74,7 +206,19 @@ void Program::run_prompt()
 }
 
 ErrorCode Program::run(std::string_view source)
-try {
+{
+    const auto line = std::make_shared<const std::string>(source);
+    sources_.push_back(line);
+
+    auto ast = this->parse_source(*line);
+    if (!ast) return error_code_;
+
+    this->resolve_ast(*ast, locations_);
+    return this->execute(*ast);
+}
+
+std::optional<Ast::Ast> Program::parse_source(std::string_view source)
+{
     const auto tokens = scan(source, [this](const ScanError& e) { this->report(e); });
 
     if (debug_options_ & DebugOptions::tokens) {
@@ -83,25 +227,79 @@ try {
         }
     }
 
-    auto ast = parse(tokens, [this](const Error& e) { this->report(e); });
+    prefetcher_.prefetch(tokens);
 
-    if (error_code_ != ErrorCode::no_error) return error_code_;
+    auto ast = parse(tokens, [this](const Error& e) { this->report(e); },
+                     [this](const std::string& filepath, const Token& token) {
+                         return this->load_import(filepath, token);
+                     });
+
+    if (error_code_ != ErrorCode::no_error) return {};
 
     if (debug_options_ & DebugOptions::ast) {
         std::cout << to_string(ast) << '\n';
     }
 
-    resolve(ast, scopes_, locations_);
+    return ast;
+}
+
+void Program::resolve_ast(Ast::Ast& ast, Locations& locations)
+{
+    std::vector<std::string> report;
+    inline_calls(ast, &report);
+
+    Uses uses;
+    resolve(ast, scopes_, locations, &uses);
 
     if (debug_options_ & DebugOptions::locations) {
         Locations recent_locations;
         resolve(ast, scopes_, recent_locations);
         for (const auto& l : recent_locations) {
-            std::cout << l.first << " has level " << l.second << '\n';
+            if (is_global(l.second)) {
+                std::cout << l.first << " has global slot " << global_slot(l.second) << '\n';
+            } else if (l.second == boxed_location) {
+                std::cout << l.first << " is boxed\n";
+            } else if (is_captured(l.second)) {
+                std::cout << l.first << " is capture " << captured_index(l.second) << '\n';
+            } else {
+                std::cout << l.first << " has level " << l.second << '\n';
+            }
         }
     }
 
-    interpret(ast, locations_, environment_, global_environment_);
+    optimize(ast, locations, uses, &report);
+
+    std::vector<std::string> types;
+    const auto types_report = debug_options_ & DebugOptions::types ? &types : nullptr;
+    LoopEntryTypes loop_entry_types;
+    infer_types(ast, locations, types_report, &loop_entry_types);
+
+    // The hoisted and reused expressions, and the temporaries they're moved into, are inferred
+    // again
+    const auto hoisted = hoist_loop_invariants(ast, locations, loop_entry_types, &report);
+    const auto reused = eliminate_common_subexpressions(ast, locations, &report);
+    if (hoisted || reused) {
+        types.clear();
+        infer_types(ast, locations, types_report);
+    }
+
+    infer_purity(ast, locations);
+    resolve_field_offsets(ast);
+
+    if (debug_options_ & DebugOptions::optimizations) {
+        for (const auto& line : report) {
+            std::cout << line << '\n';
+        }
+    }
+
+    for (const auto& line : types) {
+        std::cout << line << '\n';
+    }
+}
+
+ErrorCode Program::execute(const Ast::Ast& ast)
+try {
+    interpret(ast, locations_, environment_, globals_, run_module_);
 
     return error_code_;
 }
@@ -110,18 +308,109 @@ catch (const RuntimeError& e) {
     return error_code_;
 }
 
+std::shared_ptr<const Ast::Ast> Program::load_import(const std::string& filepath,
+                                                     const Token& token)
+{
+    return modules_.load(filepath, token, [this](const std::string& filepath) {
+        return this->parse_import(filepath);
+    });
+}
+
+std::shared_ptr<const Ast::Ast> Program::parse_import(const std::string& filepath)
+{
+    auto module = prefetcher_.load(filepath);
+    sources_.push_back(module.cached ? module.cached_text : module.file);
+
+    // Errors are reported, and imported files loaded, in the same order as if the file had been
+    // parsed here
+    auto error = module.errors.begin();
+    const auto report_errors_until = [this, &module, &error](std::size_t imports_before) {
+        for (; error != module.errors.end() && error->imports_before <= imports_before; ++error) {
+            std::visit([this](const Error& e) { this->report(e); }, error->error);
+        }
+    };
+
+    for (std::size_t i = 0; i < module.unloaded_imports.size(); ++i) {
+        report_errors_until(i);
+
+        auto& import = *module.unloaded_imports[i];
+        try {
+            import.ast = this->load_import(import.filepath, import.token);
+        }
+        catch (const ParseError& e) {
+            this->report(e);
+            import.ast = std::make_shared<const Ast::Ast>();
+        }
+    }
+    report_errors_until(module.unloaded_imports.size());
+
+    if (this->use_cache() && *module.file && !module.cached &&
+        error_code_ == ErrorCode::no_error) {
+        store_cached_module(filepath, module.file->data(), module.ast);
+    }
+
+    return std::make_shared<const Ast::Ast>(std::move(module.ast));
+}
+
 void Program::report(const Error& e)
 {
     std::cerr << e.what() << '\n';
     error_code_ = e.code();
 }
 
+Set Program::run_lazy_import(const std::string& filepath, const Token& token)
+{
+    const auto previous_error_code = error_code_;
+    error_code_ = ErrorCode::no_error;
+
+    // An eagerly imported file that can't be read is imported as if it were empty, but there's
+    // no import statement to report it at by the time a lazy one is loaded
+    if (!MappedFile{filepath}) {
+        throw RuntimeError(token, "failed to load lazily imported file '" + filepath + "'");
+    }
+
+    std::shared_ptr<const Ast::Ast> ast;
+    try {
+        ast = this->load_import(filepath, token);
+    }
+    catch (const ParseError& e) {
+        this->report(e);
+    }
+
+    if (error_code_ != ErrorCode::no_error) {
+        throw RuntimeError(token, "failed to load lazily imported file '" + filepath + "'");
+    }
+    error_code_ = previous_error_code;
+
+    // Imported files are resolved on their own, and functions defined in the file are called
+    // with the program's locations, so the file is resolved into those
+    ScopeStack scopes{*globals_, false};
+    resolve(*ast, scopes, locations_);
+    infer_types(*ast, locations_);
+    infer_purity(*ast, locations_);
+    resolve_field_offsets(*ast);
+
+    // Like a file imported under a name, it's run with a global table of its own
+    const auto globals = std::make_shared<Globals>(globals_->module());
+    auto environment = std::make_shared<Environment>(*globals);
+    interpret(*ast, locations_, environment, globals, run_module_);
+
+    // Copied, since the environment is the closure of the functions defined in the file
+    return environment->set();
+}
+
 int main(int argc, char** argv)
 try {
     argagg::parser arg_parser{{
-        {"tokens",    {"-s", "--scanner-debug"},  "Debug scanner",  0},
-        {"ast",       {"-p", "--parser-debug"},   "Debug parser",   0},
-        {"locations", {"-r", "--resolver-debug"}, "Debug resolver", 0},
+        {"tokens",     {"-s", "--scanner-debug"},  "Debug scanner",  0},
+        {"ast",        {"-p", "--parser-debug"},   "Debug parser",   0},
+        {"locations",  {"-r", "--resolver-debug"}, "Debug resolver", 0},
+        {"opt_report", {"-o", "--opt-report"},
+            "Report the calls the optimizer inlined and the code it hoisted, reused or removed", 0},
+        {"types",      {"-y", "--type-report"},    "Report the types inferred for expressions", 0},
+        {"no_cache",   {"-n", "--no-cache"},       "Don't use .albc cache files", 0},
+        {"stream",     {"-t", "--stream"},
+            "Run each statement as soon as it's parsed, reading the script a chunk at a time", 0},
     }};
 
     const auto args = arg_parser.parse(argc, argv);
@@ -129,16 +418,27 @@ try {
     const DebugOptions debug_options =
         static_cast<bool>(args["locations"]) * DebugOptions::locations +
         static_cast<bool>(args["ast"]) * DebugOptions::ast +
-        static_cast<bool>(args["tokens"]) * DebugOptions::tokens;
+        static_cast<bool>(args["tokens"]) * DebugOptions::tokens +
+        static_cast<bool>(args["opt_report"]) * DebugOptions::optimizations +
+        static_cast<bool>(args["types"]) * DebugOptions::types;
 
-    Program program{debug_options};
+    RunOptions run_options;
+    run_options.use_cache = !static_cast<bool>(args["no_cache"]);
+    run_options.stream = static_cast<bool>(args["stream"]);
+
+    Program program{debug_options, run_options};
 
     if (args.pos.empty()) {
         program.run_prompt();
+    } else if (args.pos.size() == 1 && std::string_view{args.pos.front()} == "-") {
+        program.run_stream(std::cin);
+    } else if (args.pos.size() == 1 && run_options.stream) {
+        std::ifstream file{args.pos.front(), std::ios::binary};
+        program.run_stream(file);
     } else if (args.pos.size() == 1) {
         program.run_file(args.pos.front());
     } else {
-        std::cerr << "Usage: " << Const::program_name << " [options] [script]\n";
+        std::cerr << "Usage: " << Const::program_name << " [options] [script | -]\n";
         return static_cast<int>(ErrorCode::bad_program_usage);
     }
 
@@ -152,4 +452,3 @@ catch (const argagg::error& e) {
     std::cerr << e.what() << '\n';
     return static_cast<int>(ErrorCode::bad_program_usage);
 }
-
@@ -0,0 +1,53 @@
+#include "mapped_file.h"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile(const std::string& path)
+{
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return;
+
+    struct stat st;
+    if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* address = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (address != MAP_FAILED) {
+            data_ = static_cast<const char*>(address);
+            size_ = static_cast<std::size_t>(st.st_size);
+            mapped_ = true;
+            opened_ = true;
+
+            // Files are mostly read from start to end, by the scanner or when hashing them
+            ::madvise(address, size_, MADV_SEQUENTIAL);
+        }
+    }
+    if (!mapped_) opened_ = this->read(fd);
+    ::close(fd);
+}
+
+bool MappedFile::read(int fd)
+{
+    char buffer[1 << 16];
+    for (;;) {
+        const auto n = ::read(fd, buffer, sizeof(buffer));
+        if (n == 0) break;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            // Directories can be opened, but not read
+            text_.clear();
+            return false;
+        }
+        text_.append(buffer, static_cast<std::size_t>(n));
+    }
+    data_ = text_.data();
+    size_ = text_.size();
+    return true;
+}
+
+MappedFile::~MappedFile()
+{
+    if (mapped_) ::munmap(const_cast<char*>(data_), size_);
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// The whole text of a file, empty if the file couldn't be opened. Regular files are mapped
+// read-only, so nothing is copied, and the file mustn't be truncated while it's mapped, since
+// reading the pages past its new end is an error. Anything that can't be mapped, such as a pipe, a
+// file in /proc that reports no size, or a file mmap fails on, is read into a string instead.
+struct MappedFile {
+    explicit MappedFile(const std::string& path);
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+
+    // Whether the file could be opened and read, even if it's empty
+    explicit operator bool() const noexcept { return opened_; }
+    std::string_view data() const noexcept { return {data_, size_}; }
+private:
+    // Reads the rest of the file into text_
+    bool read(int fd);
+
+    const char* data_ = nullptr;
+    std::size_t size_ = 0;
+    bool mapped_ = false;
+    bool opened_ = false;
+    std::string text_;
+};
@@ -0,0 +1,47 @@
+#include "memo.h"
+
+std::optional<MemoCache::Key> MemoCache::key(const FunctionInput<ObjectReference>& input)
+{
+    Key key{{}, input.size()};
+    key.inputs.reserve(input.size());
+    for (std::size_t i = 0; i < input.size(); ++i) {
+        const auto h = hash_value(input[i]);
+        if (!h) return {};
+        key.hash = combine_hashes(key.hash, *h);
+        key.inputs.push_back(input[i]);
+    }
+    return key;
+}
+
+bool MemoCache::Equal::operator()(const Key& a, const Key& b) const
+{
+    if (a.inputs.size() != b.inputs.size()) return false;
+    for (std::size_t i = 0; i < a.inputs.size(); ++i) {
+        if (!same_value(a.inputs[i], b.inputs[i])) return false;
+    }
+    return true;
+}
+
+const ObjectReference* MemoCache::find(const Key& key)
+{
+    const auto result = results_.find(key);
+    if (result == results_.end()) {
+        ++misses_;
+        return nullptr;
+    }
+    ++hits_;
+    return &result->second;
+}
+
+void MemoCache::store(Key key, ObjectReference result)
+{
+    // A call can store the result for its inputs before an enclosing call with the same inputs does
+    const auto [it, inserted] = results_.try_emplace(std::move(key), std::move(result));
+    if (!inserted) return;
+    order_.push_back(&it->first);
+
+    if (results_.size() > capacity_) {
+        results_.erase(results_.find(*order_.front()));
+        order_.pop_front();
+    }
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "function_input.h"
+#include "object.h"
+
+#include <cstddef>
+#include <deque>
+#include <optional>
+#include <unordered_map>
+
+// The results of the calls to a memoized function, by the values of their inputs. Only calls whose
+// inputs are nil, booleans, numbers, strings or tuples of those are kept, since anything else is
+// compared by more than its value. Once the cache is full, the oldest result is dropped for each
+// new one.
+struct MemoCache {
+    static constexpr std::size_t default_capacity = 65536;
+
+    // Inputs are compared with same_value
+    struct Key {
+        Tuple inputs;
+        std::size_t hash;
+    };
+
+    MemoCache(Function function, std::size_t capacity)
+        : function_{std::move(function)}, capacity_{capacity}
+    {}
+
+    // The function the results are of, which isn't memoized itself, to be called on a miss
+    const Function& function() const { return function_; }
+
+    // Empty if any of the inputs can't be kept
+    static std::optional<Key> key(const FunctionInput<ObjectReference>&);
+
+    // Null if there's no result for the key, which counts as a miss
+    const ObjectReference* find(const Key&);
+    void store(Key, ObjectReference result);
+
+    // Calls run because their inputs couldn't be kept count as misses too
+    void miss() { ++misses_; }
+
+    std::size_t hits() const { return hits_; }
+    std::size_t misses() const { return misses_; }
+    std::size_t size() const { return results_.size(); }
+    std::size_t capacity() const { return capacity_; }
+private:
+    struct Hash {
+        std::size_t operator()(const Key& key) const { return key.hash; }
+    };
+    struct Equal {
+        bool operator()(const Key&, const Key&) const;
+    };
+
+    Function function_;
+
+    std::unordered_map<Key, ObjectReference, Hash, Equal> results_;
+    // The keys of the results, oldest first, which the map's nodes keep in place
+    std::deque<const Key*> order_;
+
+    std::size_t capacity_;
+    std::size_t hits_ = 0;
+    std::size_t misses_ = 0;
+};
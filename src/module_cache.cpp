@@ -0,0 +1,907 @@
+#include "module_cache.h"
+#include "ast.h"
+#include "general.h"
+#include "mapped_file.h"
+#include "object.h"
+#include "resolver.h"
+#include "token.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std::literals;
+
+namespace {
+
+constexpr auto magic = "ALBC"sv;
+
+enum class Tag : std::uint8_t {
+    // Statements
+    block, expression_statement, if_statement, return_statement, while_statement, declaration,
+    import,
+
+    // Expressions
+    assign, binary, call, function, get, grouping, literal, logical, tuple, unary, variable,
+    inlined, assign_member,
+};
+
+enum class LiteralTag : std::uint8_t { nil, boolean, number, string, record_type };
+
+// Thrown by the Reader when the cache file doesn't make sense, the cache is then ignored
+struct BadCache {};
+
+// 64-bit FNV-1a
+std::uint64_t hash(std::string_view s)
+{
+    std::uint64_t h = 14695981039346656037ull;
+    for (const char ch : s) {
+        h ^= static_cast<unsigned char>(ch);
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+struct Writer : Ast::Expression::Visitor<void>, Ast::Statement::Visitor<void> {
+    explicit Writer(const Locations* l)
+        : locations_{l}
+    {}
+
+    Writer(const Writer&) = delete;
+    Writer(Writer&&) = delete;
+
+    void write(const Ast::Ast&);
+
+    template <typename T>
+    void write(T value) {
+        static_assert(std::is_arithmetic_v<T>);
+        buffer.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+    void write(std::string_view);
+
+    // Writes the index of the string in the string table, so each distinct string is only stored
+    // once however many tokens share it
+    void write_interned(std::string_view);
+    // Without a tag, for the values of literals and the initial values of fields
+    void write_literal(const ObjectReference&);
+    // Counts, lines, depths and string indices are nearly always small, so they're written as
+    // LEB128 varints
+    void write_varint(std::uint32_t);
+    void write(Tag tag) { this->write(static_cast<std::uint8_t>(tag)); }
+    void write(LiteralTag tag) { this->write(static_cast<std::uint8_t>(tag)); }
+    void write(const Token&);
+    void write(const Ast::VariableTuple&);
+
+    template <typename T>
+    void write(const std::optional<std::unique_ptr<T>>& o) {
+        this->write(static_cast<std::uint8_t>(o.has_value()));
+        if (o) (*o)->accept(*this);
+    }
+
+    void operator()(const Ast::Assign&) override;
+    void operator()(const Ast::AssignMember&) override;
+    void operator()(const Ast::Binary&) override;
+    void operator()(const Ast::Call&) override;
+    void operator()(const Ast::Function&) override;
+    void operator()(const Ast::Get&) override;
+    void operator()(const Ast::Grouping&) override;
+    void operator()(const Ast::Inlined&) override;
+    void operator()(const Ast::Literal&) override;
+    void operator()(const Ast::Logical&) override;
+    void operator()(const Ast::Tuple&) override;
+    void operator()(const Ast::Unary&) override;
+    void operator()(const Ast::Variable&) override;
+    void operator()(const Ast::VariableTuple&) override;
+
+    void operator()(const Ast::Block&) override;
+    void operator()(const Ast::ExpressionStatement&) override;
+    void operator()(const Ast::If&) override;
+    void operator()(const Ast::Return&) override;
+    void operator()(const Ast::While&) override;
+    void operator()(const Ast::Declaration&) override;
+    void operator()(const Ast::Import&) override;
+
+    std::string buffer;
+    std::vector<std::string> strings;
+
+    // Every file imported while writing, the cache depends on their contents
+    std::vector<std::string> imports;
+private:
+    const Locations* locations_;
+
+    // Asts shared by several import statements are written once, and referred to by index after
+    // that
+    std::unordered_map<const Ast::Ast*, std::uint32_t> modules_;
+    std::unordered_map<std::string, std::uint32_t> string_indices_;
+};
+
+void Writer::write(const Ast::Ast& ast)
+{
+    this->write_varint(static_cast<std::uint32_t>(ast.size()));
+    for (const auto& statement : ast) {
+        statement->accept(*this);
+    }
+}
+
+void Writer::write_varint(std::uint32_t value)
+{
+    while (value >= 0x80) {
+        buffer.push_back(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    buffer.push_back(static_cast<char>(value));
+}
+
+void Writer::write(std::string_view s)
+{
+    this->write_varint(static_cast<std::uint32_t>(s.size()));
+    buffer.append(s);
+}
+
+void Writer::write_interned(std::string_view s)
+{
+    auto [it, inserted] =
+        string_indices_.try_emplace(std::string{s}, static_cast<std::uint32_t>(strings.size()));
+    if (inserted) strings.push_back(it->first);
+    this->write_varint(it->second);
+}
+
+void Writer::write(const Token& token)
+{
+    // The literal is only needed by the parser, so it isn't stored
+    this->write(static_cast<std::uint8_t>(token.type));
+    this->write_varint(static_cast<std::uint32_t>(token.line));
+    this->write_interned(token.lexeme());
+}
+
+void Writer::write(const Ast::VariableTuple& vt)
+{
+    const auto f = combine(
+        [this](const Ast::Variable& v) {
+            this->write_varint(static_cast<std::uint32_t>(0));
+            v.accept(*this);
+        },
+        [this](const std::vector<Ast::VariableTuple>& vvt) {
+            this->write_varint(static_cast<std::uint32_t>(vvt.size()));
+            for (const auto& vt : vvt) this->write(vt);
+        }
+    );
+    std::visit(f, vt.contents);
+}
+
+void Writer::operator()(const Ast::Assign& a)
+{
+    this->write(Tag::assign);
+    this->write(*a.variable);
+    this->write(a.token);
+    a.expression->accept(*this);
+}
+
+void Writer::operator()(const Ast::AssignMember& a)
+{
+    this->write(Tag::assign_member);
+    a.object->accept(*this);
+    this->write(a.name);
+    a.expression->accept(*this);
+}
+
+void Writer::operator()(const Ast::Binary& b)
+{
+    this->write(Tag::binary);
+    b.left->accept(*this);
+    this->write(b.op);
+    b.right->accept(*this);
+}
+
+void Writer::operator()(const Ast::Call& c)
+{
+    this->write(Tag::call);
+    c.callee->accept(*this);
+    this->write(c.token);
+    this->write(static_cast<std::uint8_t>(c.input.size()));
+    for (std::size_t i = 0; i < c.input.size(); ++i) {
+        c.input[i]->accept(*this);
+    }
+}
+
+void Writer::operator()(const Ast::Function& f)
+{
+    this->write(Tag::function);
+    this->write(static_cast<std::uint8_t>(f.input.size()));
+    for (std::size_t i = 0; i < f.input.size(); ++i) {
+        this->write(*f.input[i]);
+    }
+    this->write(f.body->statements);
+
+    // The captures are only known once the function is resolved, and are stored like locations
+    const auto captures = locations_ && f.captures ? f.captures->size() : 0;
+    this->write_varint(static_cast<std::uint32_t>(captures));
+    for (std::size_t i = 0; i < captures; ++i) {
+        const auto& capture = (*f.captures)[i];
+        this->write(capture.name);
+        this->write_varint(static_cast<std::uint32_t>(capture.location) + 2);
+    }
+}
+
+void Writer::operator()(const Ast::Get& g)
+{
+    this->write(Tag::get);
+    g.object->accept(*this);
+    this->write(g.name);
+}
+
+void Writer::operator()(const Ast::Grouping& g)
+{
+    this->write(Tag::grouping);
+    g.expression->accept(*this);
+}
+
+void Writer::operator()(const Ast::Inlined& i)
+{
+    this->write(Tag::inlined);
+    this->write(i.token);
+    this->write(static_cast<std::uint8_t>(i.arguments.size()));
+    for (std::size_t j = 0; j < i.arguments.size(); ++j) {
+        i.arguments[j]->accept(*this);
+    }
+    this->write(static_cast<std::uint8_t>(i.input.size()));
+    for (std::size_t j = 0; j < i.input.size(); ++j) {
+        this->write(*i.input[j]);
+    }
+    this->write(i.body->statements);
+    this->write(i.result);
+}
+
+void Writer::operator()(const Ast::Literal& l)
+{
+    this->write(Tag::literal);
+    this->write_literal(l.value);
+}
+
+void Writer::write_literal(const ObjectReference& o)
+{
+    const auto f = combine(
+        [this](std::nullptr_t) { this->write(LiteralTag::nil); },
+        [this](bool x) {
+            this->write(LiteralTag::boolean);
+            this->write(static_cast<std::uint8_t>(x));
+        },
+        [this](double x) {
+            this->write(LiteralTag::number);
+            this->write(x);
+        },
+        [this](const std::string& x) {
+            this->write(LiteralTag::string);
+            this->write_interned(x);
+        },
+        [this](const RecordType& x) {
+            this->write(LiteralTag::record_type);
+            this->write_interned(x.name());
+            this->write_varint(static_cast<std::uint32_t>(x.fields().size()));
+            for (std::size_t i = 0; i < x.fields().size(); ++i) {
+                this->write_interned(x.fields()[i].name);
+                this->write(static_cast<std::uint8_t>(x.fields()[i].type));
+                this->write_literal(x.initial()[i]);
+            }
+        },
+        [](const auto&) {
+            assert(false && "Literals can only be nil, bool, double, string or record types");
+        }
+    );
+    o.visit(f);
+}
+
+void Writer::operator()(const Ast::Logical& l)
+{
+    this->write(Tag::logical);
+    l.left->accept(*this);
+    this->write(l.op);
+    l.right->accept(*this);
+}
+
+void Writer::operator()(const Ast::Tuple& t)
+{
+    this->write(Tag::tuple);
+    this->write_varint(static_cast<std::uint32_t>(t.elements.size()));
+    for (const auto& e : t.elements) {
+        e->accept(*this);
+    }
+}
+
+void Writer::operator()(const Ast::Unary& u)
+{
+    this->write(Tag::unary);
+    this->write(u.op);
+    u.right->accept(*this);
+}
+
+void Writer::operator()(const Ast::Variable& v)
+{
+    this->write(Tag::variable);
+    this->write(v.name);
+
+    // Stored as two more than the location, so that 0 means unresolved and 1 means global
+    std::uint32_t depth = 0;
+    if (locations_) {
+        if (const auto location = locations_->find(v.id); location != locations_->end()) {
+            depth = is_global(location->second)
+                ? 1 : static_cast<std::uint32_t>(location->second) + 2;
+        }
+    }
+    this->write_varint(depth);
+}
+
+void Writer::operator()(const Ast::VariableTuple& vt)
+{
+    this->write(vt);
+}
+
+void Writer::operator()(const Ast::Block& b)
+{
+    this->write(Tag::block);
+    this->write(b.statements);
+}
+
+void Writer::operator()(const Ast::ExpressionStatement& es)
+{
+    this->write(Tag::expression_statement);
+    this->write(es.expression);
+}
+
+void Writer::operator()(const Ast::If& i)
+{
+    this->write(Tag::if_statement);
+    this->write(i.keyword);
+    i.condition->accept(*this);
+    i.then_branch->accept(*this);
+    this->write(i.else_branch);
+}
+
+void Writer::operator()(const Ast::Return& r)
+{
+    this->write(Tag::return_statement);
+    this->write(r.keyword);
+    this->write(r.expression);
+}
+
+void Writer::operator()(const Ast::While& w)
+{
+    this->write(Tag::while_statement);
+    w.condition->accept(*this);
+    w.body->accept(*this);
+}
+
+void Writer::operator()(const Ast::Declaration& d)
+{
+    this->write(Tag::declaration);
+    this->write(*d.variable);
+    this->write(d.token);
+    this->write(d.initializer);
+}
+
+void Writer::operator()(const Ast::Import& i)
+{
+    this->write(Tag::import);
+    this->write(i.token);
+    this->write_interned(i.filepath);
+    this->write(static_cast<std::uint8_t>(i.lazy));
+
+    // A lazily imported file is loaded (and cached) on its own when it is used, so neither its
+    // ast nor its contents are part of this cache
+    if (i.lazy) {
+        this->write(i.variable);
+        return;
+    }
+
+    const auto [it, inserted] =
+        modules_.try_emplace(i.ast.get(), static_cast<std::uint32_t>(modules_.size()));
+    this->write_varint(it->second);
+    if (inserted) this->write(*i.ast);
+
+    this->write(i.variable);
+
+    if (std::find(imports.begin(), imports.end(), i.filepath) == imports.end()) {
+        imports.push_back(i.filepath);
+    }
+}
+
+struct Reader {
+    explicit Reader(std::string_view data)
+        : data_{data}
+    {}
+
+    template <typename T>
+    T read() {
+        static_assert(std::is_arithmetic_v<T>);
+        T value;
+        std::memcpy(&value, this->take(sizeof(T)).data(), sizeof(T));
+        return value;
+    }
+    std::uint32_t read_varint() {
+        std::uint32_t value = 0;
+        for (int shift = 0; shift < 35; shift += 7) {
+            const auto byte = this->read<std::uint8_t>();
+            value |= static_cast<std::uint32_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) return value;
+        }
+        throw BadCache{};
+    }
+    std::string_view read_string() { return this->take(this->read_varint()); }
+    std::string_view read_interned() {
+        const auto i = this->read_varint();
+        if (i >= strings.size()) throw BadCache{};
+        return strings[i];
+    }
+    std::string_view read_bytes(std::size_t n) { return this->take(n); }
+
+    Ast::Ast read_ast();
+
+    bool is_at_end() const noexcept { return data_.empty(); }
+    // What's left to read
+    std::string_view rest() const noexcept { return data_; }
+
+    // Set once the header has been read, resolved depths and globals are then recorded here
+    Locations* locations = nullptr;
+    std::vector<std::pair<std::uint64_t, std::string_view>>* globals = nullptr;
+    std::vector<std::string_view> strings;
+private:
+    std::string_view take(std::size_t n) {
+        if (n > data_.size()) throw BadCache{};
+        const auto s = data_.substr(0, n);
+        data_.remove_prefix(n);
+        return s;
+    }
+
+    Tag read_tag();
+    Token read_token();
+    // Declared variables can be boxed, see boxed_location
+    std::unique_ptr<Ast::Variable> read_variable(bool declared = false);
+    std::unique_ptr<Ast::Variable> read_untagged_variable(bool declared = false);
+    Ast::VariableTuple read_variable_tuple(bool declared);
+    // Throws unless a variable at the location would be found in an environment the interpreter
+    // has, or among the captures of the function it's in
+    void check_location(int location);
+    Ast::Ast read_block();
+    std::unique_ptr<Ast::Statement> read_statement();
+    std::unique_ptr<Ast::Expression> read_expression();
+    ObjectReference read_literal();
+
+    template <typename T, typename ReadFunction>
+    std::optional<std::unique_ptr<T>> read_optional(ReadFunction read_function) {
+        if (this->read<std::uint8_t>() == 0) return {};
+        return read_function();
+    }
+
+    // The inputs of a function or a call, preceded by how many there are
+    template <typename T, typename ReadFunction>
+    FunctionInput<T> read_input(ReadFunction read_function) {
+        switch (this->read<std::uint8_t>()) {
+            case 0: return {};
+            case 1: return {read_function()};
+            case 2: {
+                auto input_0 = read_function();
+                return {std::move(input_0), read_function()};
+            }
+            default: throw BadCache{};
+        }
+    }
+
+    std::string_view data_;
+    std::vector<std::shared_ptr<const Ast::Ast>> modules_;
+
+    // How many environments enclose the one the ast being read runs in, up to the top level of
+    // its file or the closure of its function, which is as far out as a variable can be found
+    int depth_ = 0;
+    // For each function being read, innermost last, how many captures its body uses
+    std::vector<std::size_t> captures_;
+};
+
+Tag Reader::read_tag()
+{
+    const auto tag = this->read<std::uint8_t>();
+    if (tag > static_cast<std::uint8_t>(Tag::assign_member)) throw BadCache{};
+    return static_cast<Tag>(tag);
+}
+
+Token Reader::read_token()
+{
+    const auto type = this->read<std::uint8_t>();
+    if (type > static_cast<std::uint8_t>(Token::Type::eof)) throw BadCache{};
+    const auto line = this->read_varint();
+    const auto lexeme = this->read_interned();
+    return Token{static_cast<Token::Type>(type), lexeme, line};
+}
+
+std::unique_ptr<Ast::Variable> Reader::read_variable(bool declared)
+{
+    if (this->read_tag() != Tag::variable) throw BadCache{};
+    return this->read_untagged_variable(declared);
+}
+
+std::unique_ptr<Ast::Variable> Reader::read_untagged_variable(bool declared)
+{
+    auto variable = std::make_unique<Ast::Variable>(this->read_token());
+    const auto depth = this->read_varint();
+    if (depth == 1 && globals) {
+        globals->emplace_back(variable->id, variable->name.lexeme());
+    } else if (depth > 1 && locations) {
+        const auto location = static_cast<int>(depth - 2);
+        if (!declared || location != boxed_location) this->check_location(location);
+        (*locations)[variable->id] = location;
+    }
+    return variable;
+}
+
+Ast::VariableTuple Reader::read_variable_tuple(bool declared)
+{
+    const auto size = this->read_varint();
+    if (size == 0) {
+        return Ast::VariableTuple{std::move(*this->read_variable(declared))};
+    }
+
+    std::vector<Ast::VariableTuple> vvt;
+    for (std::uint32_t i = 0; i < size; ++i) {
+        vvt.push_back(this->read_variable_tuple(declared));
+    }
+    return Ast::VariableTuple{std::move(vvt)};
+}
+
+void Reader::check_location(int location)
+{
+    if (location < 0) throw BadCache{};
+    if (!is_captured(location)) {
+        if (location > depth_) throw BadCache{};
+        return;
+    }
+    if (captures_.empty() || location == boxed_location) throw BadCache{};
+    captures_.back() = std::max(captures_.back(), captured_index(location) + 1);
+}
+
+Ast::Ast Reader::read_block()
+{
+    ++depth_;
+    auto ast = this->read_ast();
+    --depth_;
+    return ast;
+}
+
+ObjectReference Reader::read_literal()
+{
+    switch (static_cast<LiteralTag>(this->read<std::uint8_t>())) {
+        case LiteralTag::nil: return nullptr;
+        case LiteralTag::boolean: return this->read<std::uint8_t>() != 0;
+        case LiteralTag::number: return this->read<double>();
+        case LiteralTag::string: return std::string{this->read_interned()};
+        case LiteralTag::record_type: {
+            auto name = std::string{this->read_interned()};
+            const auto size = this->read_varint();
+            std::vector<RecordType::Field> fields;
+            std::vector<ObjectReference> initial;
+            for (std::uint32_t i = 0; i < size; ++i) {
+                auto field = std::string{this->read_interned()};
+                const auto type = this->read<std::uint8_t>();
+                if (type > static_cast<std::uint8_t>(FieldType::string)) throw BadCache{};
+                fields.push_back({std::move(field), static_cast<FieldType>(type)});
+                initial.push_back(this->read_literal());
+            }
+            return RecordType{std::move(name), std::move(fields), std::move(initial)};
+        }
+        default: throw BadCache{};
+    }
+}
+
+Ast::Ast Reader::read_ast()
+{
+    Ast::Ast ast;
+    const auto size = this->read_varint();
+    for (std::uint32_t i = 0; i < size; ++i) {
+        ast.push_back(this->read_statement());
+    }
+    return ast;
+}
+
+std::unique_ptr<Ast::Statement> Reader::read_statement()
+{
+    const auto read_expression = [this] { return this->read_expression(); };
+    const auto read_statement = [this] { return this->read_statement(); };
+
+    switch (this->read_tag()) {
+        case Tag::block:
+            return std::make_unique<Ast::Block>(this->read_block());
+        case Tag::expression_statement:
+            return std::make_unique<Ast::ExpressionStatement>(
+                this->read_optional<Ast::Expression>(read_expression));
+        case Tag::if_statement: {
+            auto keyword = this->read_token();
+            auto condition = this->read_expression();
+            auto then_branch = this->read_statement();
+            auto else_branch = this->read_optional<Ast::Statement>(read_statement);
+            return std::make_unique<Ast::If>(std::move(keyword), std::move(condition),
+                                             std::move(then_branch), std::move(else_branch));
+        }
+        case Tag::return_statement: {
+            auto keyword = this->read_token();
+            auto expression = this->read_optional<Ast::Expression>(read_expression);
+            return std::make_unique<Ast::Return>(std::move(keyword), std::move(expression));
+        }
+        case Tag::while_statement: {
+            auto condition = this->read_expression();
+            auto body = this->read_statement();
+            return std::make_unique<Ast::While>(std::move(condition), std::move(body));
+        }
+        case Tag::declaration: {
+            auto variable = std::make_unique<Ast::VariableTuple>(this->read_variable_tuple(true));
+            auto token = this->read_token();
+            auto initializer = this->read_optional<Ast::Expression>(read_expression);
+            return std::make_unique<Ast::Declaration>(std::move(variable), std::move(token),
+                                                      std::move(initializer));
+        }
+        case Tag::import: {
+            auto token = this->read_token();
+            auto filepath = std::string{this->read_interned()};
+
+            if (this->read<std::uint8_t>() != 0) {
+                auto variable = this->read_optional<Ast::Variable>([this] {
+                    return this->read_variable(true);
+                });
+                if (!variable) throw BadCache{};
+                return std::make_unique<Ast::Import>(std::move(token), std::move(filepath),
+                                                     nullptr, std::move(variable), true);
+            }
+
+            const auto module = this->read_varint();
+            if (module > modules_.size()) throw BadCache{};
+            if (module == modules_.size()) {
+                // Reserve the index first, since the modules imported by this one come after it
+                modules_.emplace_back();
+
+                // The file is resolved on its own, outside of any function
+                const auto depth = std::exchange(depth_, 0);
+                auto captures = std::exchange(captures_, {});
+                modules_[module] = std::make_shared<const Ast::Ast>(this->read_ast());
+                depth_ = depth;
+                captures_ = std::move(captures);
+            }
+            auto ast = modules_[module];
+            if (!ast) throw BadCache{};
+
+            auto variable = this->read_optional<Ast::Variable>([this] {
+                return this->read_variable(true);
+            });
+            return std::make_unique<Ast::Import>(std::move(token), std::move(filepath),
+                                                 std::move(ast), std::move(variable));
+        }
+        default:
+            throw BadCache{};
+    }
+}
+
+std::unique_ptr<Ast::Expression> Reader::read_expression()
+{
+    const auto read_expression = [this] { return this->read_expression(); };
+
+    switch (this->read_tag()) {
+        case Tag::assign: {
+            auto variable = std::make_unique<Ast::VariableTuple>(this->read_variable_tuple(false));
+            auto token = this->read_token();
+            auto expression = this->read_expression();
+            return std::make_unique<Ast::Assign>(std::move(variable), std::move(token),
+                                                 std::move(expression));
+        }
+        case Tag::binary: {
+            auto left = this->read_expression();
+            auto op = this->read_token();
+            auto right = this->read_expression();
+            return std::make_unique<Ast::Binary>(std::move(left), std::move(op),
+                                                 std::move(right));
+        }
+        case Tag::call: {
+            auto callee = this->read_expression();
+            auto token = this->read_token();
+            auto input = this->read_input<std::unique_ptr<Ast::Expression>>(read_expression);
+            return std::make_unique<Ast::Call>(std::move(callee), std::move(token),
+                                               std::move(input));
+        }
+        case Tag::function: {
+            // A call runs the body in a block inside the environment of the inputs, whose
+            // enclosing environment is the closure
+            const auto depth = std::exchange(depth_, 1);
+            captures_.push_back(0);
+            auto input = this->read_input<std::shared_ptr<Ast::VariableTuple>>([this] {
+                return std::make_shared<Ast::VariableTuple>(this->read_variable_tuple(true));
+            });
+            auto body = std::make_shared<Ast::Block>(this->read_block());
+            auto function = std::make_unique<Ast::Function>(std::move(input), std::move(body));
+            const auto used_captures = captures_.back();
+            captures_.pop_back();
+            depth_ = depth;
+
+            // The captures are found from where the function is created
+            std::vector<Ast::Capture> captures;
+            const auto capture_count = this->read_varint();
+            if (capture_count < used_captures) throw BadCache{};
+            for (std::uint32_t i = 0; i < capture_count; ++i) {
+                auto name = this->read_token();
+                const auto location = this->read_varint();
+                if (location < 2) throw BadCache{};
+                this->check_location(static_cast<int>(location - 2));
+                captures.push_back({std::move(name), static_cast<int>(location - 2)});
+            }
+            if (locations) {
+                function->captures = std::make_shared<const std::vector<Ast::Capture>>(
+                    std::move(captures));
+            }
+            return function;
+        }
+        case Tag::get: {
+            auto object = this->read_expression();
+            return std::make_unique<Ast::Get>(std::move(object), this->read_token());
+        }
+        case Tag::assign_member: {
+            auto object = this->read_expression();
+            auto name = this->read_token();
+            auto expression = this->read_expression();
+            return std::make_unique<Ast::AssignMember>(std::move(object), std::move(name),
+                                                       std::move(expression));
+        }
+        case Tag::grouping:
+            return std::make_unique<Ast::Grouping>(this->read_expression());
+        case Tag::literal:
+            return std::make_unique<Ast::Literal>(this->read_literal());
+        case Tag::logical: {
+            auto left = this->read_expression();
+            auto op = this->read_token();
+            auto right = this->read_expression();
+            return std::make_unique<Ast::Logical>(std::move(left), std::move(op),
+                                                  std::move(right));
+        }
+        case Tag::tuple: {
+            std::vector<std::unique_ptr<Ast::Expression>> elements;
+            const auto size = this->read_varint();
+            for (std::uint32_t i = 0; i < size; ++i) {
+                elements.push_back(this->read_expression());
+            }
+            return std::make_unique<Ast::Tuple>(std::move(elements));
+        }
+        case Tag::unary: {
+            auto op = this->read_token();
+            auto right = this->read_expression();
+            return std::make_unique<Ast::Unary>(std::move(op), std::move(right));
+        }
+        case Tag::variable:
+            return this->read_untagged_variable();
+        case Tag::inlined: {
+            auto token = this->read_token();
+            auto arguments = this->read_input<std::unique_ptr<Ast::Expression>>(read_expression);
+
+            // The inputs, the body and the result share an environment
+            ++depth_;
+            auto input = this->read_input<std::unique_ptr<Ast::VariableTuple>>([this] {
+                return std::make_unique<Ast::VariableTuple>(this->read_variable_tuple(true));
+            });
+            if (arguments.size() > input.size()) throw BadCache{};
+            auto body = std::make_unique<Ast::Block>(this->read_ast());
+            auto result = this->read_optional<Ast::Expression>(read_expression);
+            --depth_;
+            return std::make_unique<Ast::Inlined>(std::move(token), std::move(arguments),
+                                                  std::move(input), std::move(body),
+                                                  std::move(result));
+        }
+        default:
+            throw BadCache{};
+    }
+}
+
+bool write_all(int fd, std::string_view data)
+{
+    while (!data.empty()) {
+        const auto written = ::write(fd, data.data(), data.size());
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return false;
+        data.remove_prefix(static_cast<std::size_t>(written));
+    }
+    return true;
+}
+
+}  // Namespace
+
+std::string module_cache_path(std::string_view source_path)
+{
+    constexpr auto extension = ".albion"sv;
+
+    if (source_path.size() > extension.size() &&
+        source_path.substr(source_path.size() - extension.size()) == extension) {
+        source_path.remove_suffix(extension.size());
+    }
+    return std::string{source_path} + ".albc";
+}
+
+std::optional<CachedModule> load_cached_module(std::string_view source_path,
+                                               std::string_view source)
+try {
+    const auto file = std::make_shared<const MappedFile>(module_cache_path(source_path));
+    if (!*file) return {};
+
+    Reader reader{file->data()};
+
+    if (reader.read_bytes(magic.size()) != magic) return {};
+    if (reader.read<std::uint32_t>() != module_cache_version) return {};
+    const auto contents = reader.read<std::uint64_t>();
+    if (hash(reader.rest()) != contents) return {};
+    if (reader.read<std::uint64_t>() != hash(source)) return {};
+
+    const bool resolved = reader.read<std::uint8_t>() != 0;
+
+    const auto import_count = reader.read_varint();
+    for (std::uint32_t i = 0; i < import_count; ++i) {
+        const auto path = std::string{reader.read_string()};
+        if (reader.read<std::uint64_t>() != hash(MappedFile{path}.data())) return {};
+    }
+
+    // The ast's tokens refer to the strings in the file, so the mapping is kept with the ast
+    const auto string_count = reader.read_varint();
+    for (std::uint32_t i = 0; i < string_count; ++i) {
+        reader.strings.push_back(reader.read_string());
+    }
+
+    CachedModule module{{}, {}, resolved, {}, file};
+    if (resolved) {
+        reader.locations = &module.locations;
+        reader.globals = &module.globals;
+    }
+    module.ast = reader.read_ast();
+
+    if (!reader.is_at_end()) return {};
+    return module;
+}
+catch (const BadCache&) {
+    return {};
+}
+
+void store_cached_module(std::string_view source_path, std::string_view source,
+                         const Ast::Ast& ast, const Locations* locations)
+{
+    Writer body{locations};
+    body.write(ast);
+
+    Writer header{nullptr};
+    header.write(hash(source));
+    header.write(static_cast<std::uint8_t>(locations != nullptr));
+    header.write_varint(static_cast<std::uint32_t>(body.imports.size()));
+    for (const auto& path : body.imports) {
+        header.write(std::string_view{path});
+        header.write(hash(MappedFile{path}.data()));
+    }
+    header.write_varint(static_cast<std::uint32_t>(body.strings.size()));
+    for (const auto& string : body.strings) {
+        header.write(std::string_view{string});
+    }
+
+    // Everything after the hash of the contents is covered by it, so a file that's been damaged
+    // is ignored rather than read
+    Writer prefix{nullptr};
+    prefix.buffer.append(magic);
+    prefix.write(module_cache_version);
+    prefix.write(hash(header.buffer + body.buffer));
+
+    // Write to a temporary file first so that a reader never sees a partially written cache. Its
+    // name is unique so that processes storing the same module don't write into the same file.
+    const auto path = module_cache_path(source_path);
+    auto temporary_path = path + ".XXXXXX";
+    const int fd = ::mkstemp(temporary_path.data());
+    if (fd < 0) return;
+    const bool written = ::fchmod(fd, 0644) == 0 && write_all(fd, prefix.buffer) &&
+                         write_all(fd, header.buffer) && write_all(fd, body.buffer);
+    if (::close(fd) != 0 || !written ||
+        std::rename(temporary_path.c_str(), path.c_str()) != 0) {
+        std::remove(temporary_path.c_str());
+    }
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "ast.h"
+#include "resolver.h"
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Scanned, parsed and resolved files are cached in a compact binary form next to their source, so
+// that "dir/file.albion" is cached in "dir/file.albc". A cache file is only valid for the exact
+// source text it was produced from (compared by hash), for the current cache format version, and
+// for the exact text of every file imported (directly or indirectly) by that source. Its contents
+// are hashed too, and the locations in it are checked as it's read, so that a damaged file is
+// ignored rather than run.
+
+constexpr std::uint32_t module_cache_version = 11;
+
+struct CachedModule {
+    Ast::Ast ast;
+
+    // Only meaningful if resolved is true, in which case it holds the resolution of every variable
+    // in the ast when the file is resolved as a program or import of its own
+    Locations locations;
+    bool resolved;
+
+    // Global slots depend on the program, so the variables resolved as globals are listed by id
+    // and name instead, to be given slots when the module is run
+    std::vector<std::pair<std::uint64_t, std::string_view>> globals;
+
+    // The text the tokens in the ast refer to
+    Source text;
+};
+
+std::string module_cache_path(std::string_view source_path);
+
+// Returns nothing if there is no cache file, or if it's out of date or unreadable
+std::optional<CachedModule> load_cached_module(std::string_view source_path,
+                                               std::string_view source);
+
+// Pass the locations if the ast has been resolved on its own, writing the cache is best effort
+// and failures are ignored
+void store_cached_module(std::string_view source_path, std::string_view source,
+                         const Ast::Ast&, const Locations* locations = nullptr);
@@ -0,0 +1,96 @@
+#include "module_prefetcher.h"
+#include "module_cache.h"
+#include "parser.h"
+#include "scanner.h"
+
+ModulePrefetcher::~ModulePrefetcher()
+{
+    // Stop running tasks from starting new ones
+    const std::lock_guard<std::mutex> lock{mutex_};
+    stopping_ = true;
+}
+
+void ModulePrefetcher::prefetch(const std::vector<Token>& tokens)
+{
+    if (!parallel_) return;
+
+    std::vector<std::string> filepaths;
+    for (std::size_t i = 0; i + 1 < tokens.size(); ++i) {
+        if (tokens[i].type == Token::Type::k_import && tokens[i + 1].type == Token::Type::string) {
+            filepaths.push_back(literal_value(tokens[i + 1])->get<std::string>());
+        }
+    }
+    if (filepaths.empty()) return;
+
+    const std::lock_guard<std::mutex> lock{mutex_};
+    if (stopping_) return;
+
+    if (!pool_) pool_.emplace();
+
+    for (auto& filepath : filepaths) {
+        if (!requested_.insert(filepath).second) continue;
+
+        auto task = std::make_shared<Task>();
+        task->load = std::packaged_task<UnlinkedModule()>{[this, filepath] {
+            return this->load_now(filepath);
+        }};
+        task->result = task->load.get_future();
+        tasks_.emplace(std::move(filepath), task);
+
+        pool_->submit([task] {
+            if (!task->started.test_and_set()) task->load();
+        });
+    }
+}
+
+UnlinkedModule ModulePrefetcher::load(const std::string& filepath)
+{
+    std::shared_ptr<Task> task;
+    {
+        const std::lock_guard<std::mutex> lock{mutex_};
+        requested_.insert(filepath);
+
+        const auto it = tasks_.find(filepath);
+        if (it != tasks_.end()) {
+            task = std::move(it->second);
+            tasks_.erase(it);
+        }
+    }
+
+    if (!task) return this->load_now(filepath);
+
+    // Rather than waiting for a thread to get to it
+    if (!task->started.test_and_set()) task->load();
+
+    return task->result.get();
+}
+
+UnlinkedModule ModulePrefetcher::load_now(const std::string& filepath)
+{
+    UnlinkedModule module;
+    module.file = std::make_shared<const MappedFile>(filepath);
+
+    // The cache of a file that couldn't be read isn't used, as it would be for an empty file
+    if (use_cache_ && *module.file) {
+        if (auto cached = load_cached_module(filepath, module.file->data())) {
+            module.ast = std::move(cached->ast);
+            module.cached = true;
+            module.cached_text = std::move(cached->text);
+            return module;
+        }
+    }
+
+    const auto tokens = scan(module.file->data(), [&module](const ScanError& e) {
+        module.errors.push_back({0, e});
+    });
+
+    this->prefetch(tokens);
+
+    // Only parse errors are reported when imports aren't loaded
+    module.ast = parse(tokens, [&module](const Error& e) {
+        module.errors.push_back({module.unloaded_imports.size(),
+                                 dynamic_cast<const ParseError&>(e)});
+    }, module.unloaded_imports);
+
+    return module;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "ast.h"
+#include "error.h"
+#include "mapped_file.h"
+#include "thread_pool.h"
+#include "token.h"
+
+#include <atomic>
+#include <cstddef>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <variant>
+#include <vector>
+
+// A file that has been scanned and parsed without loading the files it imports
+struct UnlinkedModule {
+    struct DeferredError {
+        // The number of unloaded imports parsed before the error was found
+        std::size_t imports_before;
+        std::variant<ScanError, ParseError> error;
+    };
+
+    std::shared_ptr<const MappedFile> file;
+    Ast::Ast ast;
+
+    // Read from a cache file, in which case the ast already includes every imported file, and its
+    // tokens refer to the cache file rather than the source
+    bool cached = false;
+    Source cached_text;
+
+    // The imports in the ast that have no ast of their own yet, in source order
+    std::vector<Ast::Import*> unloaded_imports;
+
+    // In the order they were reported
+    std::vector<DeferredError> errors;
+};
+
+// Scans and parses imported files ahead of time on a pool of threads. Files are found by looking
+// for import statements in the tokens of files that are about to be parsed, and then in the tokens
+// of the imported files themselves. Errors aren't reported, they are kept with the module so that
+// the caller can report them in the same order as if the files were parsed one by one.
+struct ModulePrefetcher {
+    explicit ModulePrefetcher(bool use_cache)
+        : use_cache_{use_cache}
+    {}
+    ModulePrefetcher(const ModulePrefetcher&) = delete;
+    ModulePrefetcher(ModulePrefetcher&&) = delete;
+    ~ModulePrefetcher();
+
+    // Starts loading every file named in a (non-lazy) import statement in the tokens, that hasn't
+    // been started before
+    void prefetch(const std::vector<Token>&);
+
+    // Returns the file, waiting for it if it's being loaded on another thread, or loading it on
+    // this thread if it hasn't been started
+    UnlinkedModule load(const std::string& filepath);
+private:
+    struct Task {
+        std::packaged_task<UnlinkedModule()> load;
+        std::future<UnlinkedModule> result;
+
+        // Whether a thread has started running load
+        std::atomic_flag started = ATOMIC_FLAG_INIT;
+    };
+
+    UnlinkedModule load_now(const std::string& filepath);
+
+    const bool use_cache_;
+
+    // Loading files on the thread that needs them is just as fast with a single core
+    const bool parallel_ = ThreadPool::default_thread_count() > 1;
+
+    std::mutex mutex_;
+    std::unordered_map<std::string, std::shared_ptr<Task>> tasks_;
+    std::unordered_set<std::string> requested_;
+    bool stopping_ = false;
+
+    // Only started once a file imports something, destroyed first so that running tasks finish
+    // before anything else is destroyed
+    std::optional<ThreadPool> pool_;
+};
@@ -0,0 +1,73 @@
+#include "module_registry.h"
+#include "error.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+
+#include <sys/stat.h>
+
+namespace {
+
+// Falls back to the path as written if it can't be resolved, e.g. because the file doesn't exist
+std::string canonical_path(const std::string& filepath)
+{
+    char buffer[PATH_MAX];
+    if (::realpath(filepath.c_str(), buffer) == nullptr) return filepath;
+    return buffer;
+}
+
+std::timespec modification_time(const std::string& path)
+{
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0) return {};
+    return st.st_mtim;
+}
+
+bool operator==(const std::timespec& a, const std::timespec& b)
+{
+    return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+}  // Namespace
+
+ModuleRegistry::Loading::Loading(ModuleRegistry& registry, const std::string& filepath)
+    : registry_{registry}
+{
+    registry_.loading_.push_back({canonical_path(filepath), filepath});
+}
+
+ModuleRegistry::Loading::~Loading()
+{
+    registry_.loading_.pop_back();
+}
+
+std::shared_ptr<const Ast::Ast> ModuleRegistry::load(const std::string& filepath,
+                                                     const Token& token, const Loader& loader)
+{
+    const auto path = canonical_path(filepath);
+
+    const auto cycle_start =
+        std::find_if(loading_.begin(), loading_.end(),
+                     [&path](const LoadingFile& f) { return f.canonical_path == path; });
+    if (cycle_start != loading_.end()) {
+        std::string cycle;
+        for (auto it = cycle_start; it != loading_.end(); ++it) {
+            cycle += it->filepath + " -> ";
+        }
+        throw ParseError(token, "import cycle: " + cycle + filepath);
+    }
+
+    const auto time = modification_time(path);
+
+    if (const auto it = modules_.find(path);
+        it != modules_.end() && it->second.modification_time == time)
+    {
+        return it->second.ast;
+    }
+
+    const Loading loading{*this, filepath};
+    auto ast = loader(filepath);
+    modules_.insert_or_assign(path, Module{time, ast});
+    return ast;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "ast.h"
+#include "token.h"
+
+#include <ctime>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Keeps the ast of every file imported by a Program, so that a file imported from many places is
+// only scanned and parsed once. Files are identified by their canonical path, and an entry is
+// reloaded if the file has been modified since it was loaded.
+struct ModuleRegistry {
+    using Loader = std::function<std::shared_ptr<const Ast::Ast>(const std::string& filepath)>;
+
+    // Marks a file as being loaded for its lifetime, importing the file again in the meantime is
+    // an import cycle
+    struct Loading {
+        Loading(ModuleRegistry&, const std::string& filepath);
+        Loading(const Loading&) = delete;
+        Loading(Loading&&) = delete;
+        ~Loading();
+    private:
+        ModuleRegistry& registry_;
+    };
+
+    // Returns the ast of the file, calling the loader if it hasn't been loaded before. Throws a
+    // ParseError (reported against the given token) if the file is already being loaded.
+    std::shared_ptr<const Ast::Ast> load(const std::string& filepath, const Token&,
+                                         const Loader&);
+private:
+    struct Module {
+        std::timespec modification_time;
+        std::shared_ptr<const Ast::Ast> ast;
+    };
+
+    struct LoadingFile {
+        std::string canonical_path;
+        std::string filepath;
+    };
+
+    std::unordered_map<std::string, Module> modules_;
+
+    // The files currently being loaded, outermost first
+    std::vector<LoadingFile> loading_;
+};
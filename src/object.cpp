@@ -5,6 +5,12 @@
 #include "ast_printer.h"
 #include "error.h"
 
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <set>
+
 bool operator==(const ObjectReference& a, const ObjectReference& b)
 {
     return *a.data_ == *b.data_;
@@ -15,6 +21,108 @@ bool operator!=(const ObjectReference& a, const ObjectReference& b)
     return !(a == b);
 }
 
+const Shape& Shape::of(std::vector<std::string> names)
+{
+    // Shapes are never removed, so references to them stay valid
+    static std::mutex mutex;
+    static std::set<Shape> shapes;
+
+    Shape shape;
+    shape.names = std::move(names);
+    shape.by_name_.resize(shape.names.size());
+    for (std::uint32_t i = 0; i < shape.by_name_.size(); ++i) shape.by_name_[i] = i;
+    std::sort(shape.by_name_.begin(), shape.by_name_.end(),
+              [&shape](auto a, auto b) { return shape.names[a] < shape.names[b]; });
+
+    std::lock_guard lock{mutex};
+    return *shapes.insert(std::move(shape)).first;
+}
+
+std::optional<std::uint32_t> Shape::slot(std::string_view name) const
+{
+    const auto it = std::lower_bound(by_name_.begin(), by_name_.end(), name,
+                                     [this](auto slot, auto n) { return names[slot] < n; });
+    if (it == by_name_.end() || names[*it] != name) return {};
+    return *it;
+}
+
+Set::Set(Members members)
+{
+    std::sort(members.begin(), members.end(),
+              [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    std::vector<std::string> names;
+    names.reserve(members.size());
+    values_.reserve(members.size());
+    for (auto& [name, value] : members) {
+        names.push_back(std::move(name));
+        values_.push_back(std::move(value));
+    }
+    shape_ = &Shape::of(std::move(names));
+}
+
+const ObjectReference* Set::find(std::string_view name) const
+{
+    const auto slot = shape_->slot(name);
+    return slot ? &values_[*slot] : nullptr;
+}
+
+const ObjectReference* Set::find(std::string_view name, MemberCache& cache) const
+{
+    if (cache.shape == shape_) return &values_[cache.slot];
+
+    const auto slot = shape_->slot(name);
+    if (!slot) return nullptr;
+    cache = {shape_, *slot};
+    return &values_[*slot];
+}
+
+bool operator==(const Set& a, const Set& b)
+{
+    return a.shape_ == b.shape_ && a.values_ == b.values_;
+}
+
+bool operator==(const LazyModule& a, const LazyModule& b)
+{
+    return a.load == b.load;
+}
+
+void load_if_lazy(ObjectReference& o)
+{
+    if (!o.holds<LazyModule>()) return;
+
+    // Keep the loader alive, since replacing the module destroys it
+    const auto load = o.get<LazyModule>().load;
+    o.replace((*load)());
+}
+
+namespace {
+
+std::uint64_t bits(double x)
+{
+    std::uint64_t b;
+    std::memcpy(&b, &x, sizeof b);
+    return b;
+}
+
+// Prints the elements of a list, a dictionary or a record, unless it's already being printed
+// because it holds itself
+template <typename T, typename F>
+void print_once(std::string& s, const T& container, const F& print_elements)
+{
+    thread_local std::vector<const T*> printing;
+    const auto is_container = [&container](const T* p) { return *p == container; };
+    if (std::find_if(printing.begin(), printing.end(), is_container) != printing.end()) {
+        s += "...";
+        return;
+    }
+    printing.push_back(&container);
+    print_elements();
+    printing.pop_back();
+}
+
+}  // Namespace
+
 std::string to_string(const ObjectReference& o)
 {
     std::string s;
@@ -25,20 +133,56 @@ std::string to_string(const ObjectReference& o)
         [&s](const std::string_view x) { s += x; },
         [&s](const Function& x) { s += "function " + std::to_string(x.id()); },
         [&s](const BuiltInFunction& x) { s += "built-in function " + x.name; },
+        [&s](const LazyModule& x) { s += "lazy module \"" + x.filepath + "\""; },
         [&s](const Tuple& x) {
             s += "(";
             for (const auto& o : x) {
                 s += to_string(o);
                 s += ", ";
             }
-            s.pop_back();
-            s.pop_back();
+            if (!x.empty()) {
+                s.pop_back();
+                s.pop_back();
+            }
             s += ")";
         },
+        [&s](const List& x) {
+            s += "[";
+            print_once(s, x, [&s, &x] {
+                for (std::size_t i = 0; i < x.size(); ++i) {
+                    if (i > 0) s += ", ";
+                    s += to_string(x.get(i));
+                }
+            });
+            s += "]";
+        },
+        [&s](const Dictionary& x) {
+            s += "{";
+            print_once(s, x, [&s, &x] {
+                for (std::size_t i = 0; i < x.size(); ++i) {
+                    if (i > 0) s += ", ";
+                    s += to_string(x.key(i)) + ": " + to_string(x.value(i));
+                }
+            });
+            s += "}";
+        },
+        [&s](const RecordType& x) { s += "type " + x.name(); },
+        [&s](const Record& x) {
+            s += x.type().name() + " {";
+            print_once(s, x, [&s, &x] {
+                const auto& fields = x.type().fields();
+                for (std::size_t i = 0; i < fields.size(); ++i) {
+                    if (i > 0) s += ", ";
+                    s += fields[i].name + " = " + to_string(x.values()[i]);
+                }
+            });
+            s += "}";
+        },
         [&s](const Set& x) {
             s += "{";
-            for (const auto& [name, o] : x) {
-                s += name + " = " + to_string(o) + ", ";
+            const auto& names = x.shape().names;
+            for (std::size_t i = 0; i < names.size(); ++i) {
+                s += names[i] + " = " + to_string(x.values()[i]) + ", ";
             }
             s.pop_back();
             s.pop_back();
@@ -49,3 +193,41 @@ std::string to_string(const ObjectReference& o)
     return s;
 }
 
+std::size_t combine_hashes(std::size_t seed, std::size_t hash)
+{
+    return seed ^ (hash + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2));
+}
+
+std::optional<std::size_t> hash_value(const ObjectReference& o)
+{
+    if (o.holds<std::nullptr_t>()) return 0;
+    if (o.holds<bool>()) return o.get<bool>() ? 1 : 2;
+    if (o.holds<double>()) return std::hash<std::uint64_t>{}(bits(o.get<double>()));
+    if (o.holds<std::string>()) return std::hash<std::string>{}(o.get<std::string>());
+    if (!o.holds<Tuple>()) return {};
+
+    std::size_t seed = 3;
+    for (const auto& element : o.get<Tuple>()) {
+        const auto h = hash_value(element);
+        if (!h) return {};
+        seed = combine_hashes(seed, *h);
+    }
+    return seed;
+}
+
+bool same_value(const ObjectReference& a, const ObjectReference& b)
+{
+    if (a.holds<double>() && b.holds<double>()) {
+        return bits(a.get<double>()) == bits(b.get<double>());
+    }
+    if (a.holds<Tuple>() && b.holds<Tuple>()) {
+        const auto& x = a.get<Tuple>();
+        const auto& y = b.get<Tuple>();
+        if (x.size() != y.size()) return false;
+        for (std::size_t i = 0; i < x.size(); ++i) {
+            if (!same_value(x[i], y[i])) return false;
+        }
+        return true;
+    }
+    return a == b;
+}
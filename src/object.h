@@ -2,7 +2,12 @@
 
 #include "general.h"
 #include "function.h"
+#include "dictionary.h"
+#include "list.h"
+#include "record.h"
 
+#include <cassert>
+#include <cstdint>
 #include <variant>
 #include <string>
 #include <vector>
@@ -10,15 +15,71 @@
 #include <iostream>
 #include <memory>
 #include <unordered_map>
+#include <functional>
+#include <optional>
 
 struct Environment;
 struct ObjectReference;
 
 using Tuple = std::vector<ObjectReference>;
-using Set = std::unordered_map<std::string, ObjectReference>;
 
-using Object =
-    std::variant<std::nullptr_t, bool, double, std::string, Tuple, Set, Function, BuiltInFunction>;
+// The names of the members of a set or the fields of a record, where each one's value is kept at
+// the index of its name, its slot. Every set or record with the same names in the same order
+// shares one shape, which lives as long as the program does.
+struct Shape {
+    std::vector<std::string> names;
+
+    // The shape with the names, which must be distinct
+    static const Shape& of(std::vector<std::string> names);
+
+    // Empty if there's no member with the name
+    std::optional<std::uint32_t> slot(std::string_view name) const;
+
+    friend bool operator<(const Shape& a, const Shape& b) { return a.names < b.names; }
+private:
+    // The slots, in the order of their names
+    std::vector<std::uint32_t> by_name_;
+};
+
+// Where a member access last found its member, so that the next set of the same shape it's given
+// doesn't need to be searched
+struct MemberCache {
+    const Shape* shape = nullptr;
+    std::uint32_t slot = 0;
+};
+
+// The members of a module, by name, whose slots are in the order of their names
+struct Set {
+    using Members = std::vector<std::pair<std::string, ObjectReference>>;
+
+    explicit Set(Members);
+
+    const Shape& shape() const { return *shape_; }
+    // In the order of the shape's names
+    const Tuple& values() const { return values_; }
+
+    // Null if there's no member with the name
+    const ObjectReference* find(std::string_view name) const;
+    const ObjectReference* find(std::string_view name, MemberCache&) const;
+
+    friend bool operator==(const Set&, const Set&);
+private:
+    const Shape* shape_;
+    Tuple values_;
+};
+
+// A module imported with "import lazy". The file is only loaded, by calling load, when a member of
+// the module is first accessed, after which the module is replaced by its contents.
+struct LazyModule {
+    std::string filepath;
+    std::shared_ptr<const std::function<Set()>> load;
+};
+
+bool operator==(const LazyModule&, const LazyModule&);
+
+using Object = std::variant<std::nullptr_t, bool, double, std::string, Tuple, Set, Function,
+                            BuiltInFunction, LazyModule, List, Dictionary, RecordType,
+                            Record>;
 
 struct ObjectReference {
     ObjectReference(const ObjectReference&) = default;
@@ -43,11 +104,24 @@ struct ObjectReference {
         return std::get<T>(*data_);
     }
 
+    // For objects whose type is already known, such as those the type inference pass proved
+    template <typename T> const T& get_unchecked() const noexcept
+    {
+        assert(this->holds<T>());
+        return *std::get_if<T>(data_.get());
+    }
+
     template <typename F> decltype(auto) visit(F&& f) const
     {
         return std::visit(std::forward<F>(f), *data_);
     }
 
+    // Replaces the object for every reference sharing it
+    void replace(Object o)
+    {
+        *data_ = std::move(o);
+    }
+
     struct Bad_access {};
 
     friend bool operator==(const ObjectReference&, const ObjectReference&);
@@ -58,11 +132,22 @@ private:
 
 inline bool is_callable(const ObjectReference& o)
 {
-    return o.holds<Function>() || o.holds<BuiltInFunction>();
+    return o.holds<Function>() || o.holds<BuiltInFunction>() || o.holds<RecordType>();
 }
 
+// If the object is a LazyModule, loads it and replaces it with its contents
+void load_if_lazy(ObjectReference&);
+
 std::string to_string(const ObjectReference&);
 
+// Empty unless the object is nil, a boolean, a number, a string or a tuple of those, whose hashes
+// only depend on their values
+std::optional<std::size_t> hash_value(const ObjectReference&);
+std::size_t combine_hashes(std::size_t seed, std::size_t hash);
+// Whether two objects are the same value, where numbers are the same only if their bits are, so
+// that 0 and -0 are told apart, as they are when printed
+bool same_value(const ObjectReference&, const ObjectReference&);
+
 inline void print(const ObjectReference& o)
 {
     std::cout << to_string(o) << '\n';
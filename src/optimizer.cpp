@@ -0,0 +1,437 @@
+#include "optimizer.h"
+#include "pass_helpers.h"
+#include "object.h"
+
+#include <algorithm>
+#include <cassert>
+#include <optional>
+#include <unordered_map>
+
+namespace {
+
+// The line a statement that always returns returns on
+unsigned return_line(const Ast::Statement& s)
+{
+    if (const auto r = dynamic_cast<const Ast::Return*>(&s)) return r->keyword.line;
+    if (const auto i = dynamic_cast<const Ast::If*>(&s)) return i->keyword.line;
+
+    const auto b = dynamic_cast<const Ast::Block*>(&s);
+    assert(b && !b->statements.empty() && "Only returns, ifs and blocks always return");
+    return return_line(*b->statements.back());
+}
+
+std::string line_prefix(unsigned line)
+{
+    return "[line " + std::to_string(line) + "] ";
+}
+
+// How many times each name is declared in a scope
+using NameCounts = std::unordered_map<std::string_view, int>;
+
+// Counts the names a statement declares in the scope it's in, including those declared by imports
+// in the branches of ifs and the bodies of whiles, which aren't scopes of their own. Unknown is set
+// if it imports a file without a name, which can declare any name.
+struct DeclarationCounter : Ast::Statement::Visitor<void> {
+    DeclarationCounter(NameCounts& c)
+        : counts{c}
+    {}
+
+    NameCounts& counts;
+    bool unknown = false;
+
+    void operator()(const Ast::Block&) override {}
+    void operator()(const Ast::ExpressionStatement&) override {}
+    void operator()(const Ast::If& i) override {
+        i.then_branch->accept(*this);
+        if (i.else_branch) (*i.else_branch)->accept(*this);
+    }
+    void operator()(const Ast::Return&) override {}
+    void operator()(const Ast::While& w) override {
+        w.body->accept(*this);
+    }
+    void operator()(const Ast::Declaration& d) override {
+        Ast::for_each_variable(*d.variable, [this](const Ast::Variable& v) {
+            ++counts[v.name.lexeme()];
+        });
+    }
+    void operator()(const Ast::Import& i) override {
+        if (i.variable) {
+            ++counts[(*i.variable)->name.lexeme()];
+        } else {
+            unknown = true;
+        }
+    }
+};
+
+// Whether evaluating an expression can neither fail nor change anything
+struct PurityCheck : Ast::Expression::Visitor<void> {
+    PurityCheck(const Locations& l)
+        : locations{l}
+    {}
+
+    const Locations& locations;
+    bool pure = true;
+
+    void operator()(const Ast::Assign&) override { pure = false; }
+    void operator()(const Ast::AssignMember&) override { pure = false; }
+    void operator()(const Ast::Binary& b) override {
+        // Other operators fail on operands of the wrong type, comparing for equality never does
+        if (b.op.type != Token::Type::equal_equal && b.op.type != Token::Type::bang_equal) {
+            pure = false;
+            return;
+        }
+        b.left->accept(*this);
+        b.right->accept(*this);
+    }
+    void operator()(const Ast::Call&) override { pure = false; }
+    void operator()(const Ast::Function&) override {}
+    void operator()(const Ast::Get&) override { pure = false; }
+    void operator()(const Ast::Grouping& g) override {
+        g.expression->accept(*this);
+    }
+    void operator()(const Ast::Inlined&) override { pure = false; }
+    void operator()(const Ast::Literal&) override {}
+    void operator()(const Ast::Logical& l) override {
+        l.left->accept(*this);
+        l.right->accept(*this);
+    }
+    void operator()(const Ast::Tuple& t) override {
+        for (const auto& element : t.elements) element->accept(*this);
+    }
+    void operator()(const Ast::Unary& u) override {
+        if (u.op.type != Token::Type::bang) {
+            pure = false;
+            return;
+        }
+        u.right->accept(*this);
+    }
+    void operator()(const Ast::Variable& v) override {
+        // A local variable is always defined before it's used, unlike a global
+        const auto location = locations.find(v.id);
+        if (location == locations.end() || is_global(location->second)) pure = false;
+    }
+    void operator()(const Ast::VariableTuple&) override { pure = false; }
+};
+
+// Statements are optimized in place. Expressions are only visited to find functions, whose bodies
+// are optimized like any other block.
+struct Optimizer : Ast::Expression::Visitor<void>, Ast::Statement::MutableVisitor {
+    Optimizer(const Locations& l, const Uses& u, std::vector<std::string>* r)
+        : locations_{l}, uses_{u}, report_{r}
+    {}
+
+    // Returns whether the statements always return
+    bool optimize(Ast::Ast& statements, bool top_level);
+
+    void operator()(const Ast::Assign&) override;
+    void operator()(const Ast::AssignMember&) override;
+    void operator()(const Ast::Binary&) override;
+    void operator()(const Ast::Call&) override;
+    void operator()(const Ast::Function&) override;
+    void operator()(const Ast::Get&) override;
+    void operator()(const Ast::Grouping&) override;
+    void operator()(const Ast::Inlined&) override;
+    void operator()(const Ast::Literal&) override;
+    void operator()(const Ast::Logical&) override;
+    void operator()(const Ast::Tuple&) override;
+    void operator()(const Ast::Unary&) override;
+    void operator()(const Ast::Variable&) override;
+    void operator()(const Ast::VariableTuple&) override;
+
+    void operator()(Ast::Block&) override;
+    void operator()(Ast::ExpressionStatement&) override;
+    void operator()(Ast::If&) override;
+    void operator()(Ast::Return&) override;
+    void operator()(Ast::While&) override;
+    void operator()(Ast::Declaration&) override;
+    void operator()(Ast::Import&) override;
+private:
+    // Optimizes a single statement, which is set to null if nothing is left of it. Returns whether
+    // the statement always returns.
+    bool optimize(std::unique_ptr<Ast::Statement>&);
+    bool optimize_branch(std::unique_ptr<Ast::Statement>&);
+
+    void remove_unused_declarations(Ast::Ast& statements);
+    bool is_unused(const Ast::Declaration&) const;
+
+    // Whether evaluating the expression can neither fail nor change anything
+    bool is_pure(const Ast::Expression&) const;
+    // Whether binding the variables to the expression's value can't fail
+    bool binds(const Ast::VariableTuple&, const Ast::Expression&) const;
+    std::optional<bool> constant_condition(const Ast::Expression&) const;
+
+    const Locations& locations_;
+    const Uses& uses_;
+    std::vector<std::string>* report_;
+
+    // The statement being optimized, and whether it always returns
+    std::unique_ptr<Ast::Statement>* statement_ = nullptr;
+    bool returns_ = false;
+};
+
+bool Optimizer::optimize(Ast::Ast& statements, bool top_level)
+{
+    bool returns = false;
+    for (std::size_t i = 0; i < statements.size() && !returns; ++i) {
+        returns = this->optimize(statements[i]);
+        if (!returns || i + 1 == statements.size()) continue;
+
+        const auto unreachable = statements.size() - i - 1;
+        add_to_report(report_, line_prefix(return_line(*statements[i])) + "removed " +
+                               std::to_string(unreachable) + " unreachable statement" +
+                               (unreachable == 1 ? "" : "s") + " after return");
+        statements.resize(i + 1);
+    }
+
+    statements.erase(std::remove(statements.begin(), statements.end(), nullptr), statements.end());
+
+    if (!top_level) this->remove_unused_declarations(statements);
+
+    return returns;
+}
+
+bool Optimizer::optimize(std::unique_ptr<Ast::Statement>& statement)
+{
+    statement_ = &statement;
+    returns_ = false;
+    statement->accept(*this);
+    return returns_;
+}
+
+bool Optimizer::optimize_branch(std::unique_ptr<Ast::Statement>& branch)
+{
+    const bool returns = this->optimize(branch);
+    // A branch can't be empty, so an if that's removed from it leaves an empty statement
+    if (!branch) branch = std::make_unique<Ast::ExpressionStatement>();
+    return returns;
+}
+
+void Optimizer::remove_unused_declarations(Ast::Ast& statements)
+{
+    // Variables are defined by name, so when a name is declared more than once in the same scope,
+    // or a file imported into it might define it, the uses of the variable can't be told apart
+    NameCounts declarations;
+    DeclarationCounter counter{declarations};
+    for (const auto& statement : statements) {
+        statement->accept(counter);
+        if (counter.unknown) return;
+    }
+
+    const auto removable = [this, &declarations](const std::unique_ptr<Ast::Statement>& s) {
+        const auto d = dynamic_cast<const Ast::Declaration*>(s.get());
+        if (!d || !this->is_unused(*d)) return false;
+
+        bool declared_once = true;
+        Ast::for_each_variable(*d->variable, [&](const Ast::Variable& v) {
+            declared_once = declared_once && declarations[v.name.lexeme()] == 1;
+        });
+        if (!declared_once) return false;
+
+        Ast::for_each_variable(*d->variable, [this, d](const Ast::Variable& v) {
+            add_to_report(report_, line_prefix(d->token.line) + "removed unused variable '" +
+                                   std::string{v.name.lexeme()} + "'");
+        });
+        return true;
+    };
+
+    statements.erase(std::remove_if(statements.begin(), statements.end(), removable),
+                     statements.end());
+}
+
+bool Optimizer::is_unused(const Ast::Declaration& d) const
+{
+    bool unused = true;
+    Ast::for_each_variable(*d.variable, [this, &unused](const Ast::Variable& v) {
+        unused = unused && uses_.find(v.id) == uses_.end();
+    });
+    if (!unused || !d.initializer) return unused;
+
+    return this->is_pure(**d.initializer) && this->binds(*d.variable, **d.initializer);
+}
+
+bool Optimizer::is_pure(const Ast::Expression& e) const
+{
+    PurityCheck check{locations_};
+    e.accept(check);
+    return check.pure;
+}
+
+bool Optimizer::binds(const Ast::VariableTuple& vt, const Ast::Expression& e) const
+{
+    if (std::holds_alternative<Ast::Variable>(vt.contents)) return true;
+
+    // Only a tuple can be decomposed, and it can't have more elements than there are variables
+    const auto& variables = std::get<std::vector<Ast::VariableTuple>>(vt.contents);
+    const auto t = dynamic_cast<const Ast::Tuple*>(&ungrouped(e));
+    if (!t || t->elements.size() > variables.size()) return false;
+
+    for (std::size_t i = 0; i < t->elements.size(); ++i) {
+        if (!this->binds(variables[i], *t->elements[i])) return false;
+    }
+    return true;
+}
+
+std::optional<bool> Optimizer::constant_condition(const Ast::Expression& e) const
+{
+    const auto& condition = ungrouped(e);
+
+    if (const auto l = dynamic_cast<const Ast::Literal*>(&condition)) return is_truthy(l->value);
+
+    if (const auto u = dynamic_cast<const Ast::Unary*>(&condition);
+        u && u->op.type == Token::Type::bang)
+    {
+        if (const auto right = this->constant_condition(*u->right)) return !*right;
+    }
+
+    return {};
+}
+
+void Optimizer::operator()(const Ast::Assign& a)
+{
+    a.expression->accept(*this);
+}
+
+void Optimizer::operator()(const Ast::AssignMember& a)
+{
+    a.object->accept(*this);
+    a.expression->accept(*this);
+}
+
+void Optimizer::operator()(const Ast::Binary& b)
+{
+    b.left->accept(*this);
+    b.right->accept(*this);
+}
+
+void Optimizer::operator()(const Ast::Call& c)
+{
+    c.callee->accept(*this);
+
+    for (std::size_t i = 0; i < c.input.size(); ++i) {
+        c.input[i]->accept(*this);
+    }
+}
+
+void Optimizer::operator()(const Ast::Function& f)
+{
+    this->optimize(f.body->statements, false);
+}
+
+void Optimizer::operator()(const Ast::Get& g)
+{
+    g.object->accept(*this);
+}
+
+void Optimizer::operator()(const Ast::Grouping& g)
+{
+    g.expression->accept(*this);
+}
+
+void Optimizer::operator()(const Ast::Inlined& i)
+{
+    for (std::size_t j = 0; j < i.arguments.size(); ++j) {
+        i.arguments[j]->accept(*this);
+    }
+    this->optimize(i.body->statements, false);
+    if (i.result) (*i.result)->accept(*this);
+}
+
+void Optimizer::operator()(const Ast::Literal&)
+{
+}
+
+void Optimizer::operator()(const Ast::Logical& l)
+{
+    l.left->accept(*this);
+    l.right->accept(*this);
+}
+
+void Optimizer::operator()(const Ast::Tuple& t)
+{
+    for (const auto& e : t.elements) {
+        e->accept(*this);
+    }
+}
+
+void Optimizer::operator()(const Ast::Unary& u)
+{
+    u.right->accept(*this);
+}
+
+void Optimizer::operator()(const Ast::Variable&)
+{
+}
+
+void Optimizer::operator()(const Ast::VariableTuple&)
+{
+    assert(false && "Variable tuples are only part of assignments and declarations, which are "
+                    "optimized without them");
+}
+
+void Optimizer::operator()(Ast::Block& b)
+{
+    returns_ = this->optimize(b.statements, false);
+}
+
+void Optimizer::operator()(Ast::ExpressionStatement& es)
+{
+    if (es.expression) (*es.expression)->accept(*this);
+    returns_ = false;
+}
+
+void Optimizer::operator()(Ast::If& i)
+{
+    auto& statement = *statement_;
+
+    const auto condition = this->constant_condition(*i.condition);
+    if (!condition) {
+        i.condition->accept(*this);
+        const bool then_returns = this->optimize_branch(i.then_branch);
+        const bool else_returns = i.else_branch && this->optimize_branch(*i.else_branch);
+        returns_ = then_returns && else_returns;
+        return;
+    }
+
+    add_to_report(report_, line_prefix(i.keyword.line) + "removed " +
+                           (*condition ? "else branch" : "then branch") +
+                           " of if with constant condition");
+
+    // The branch that is always taken replaces the whole if
+    auto taken = *condition ? std::move(i.then_branch) : std::move(i.else_branch).value_or(nullptr);
+    statement = std::move(taken);
+    returns_ = statement && this->optimize(statement);
+}
+
+void Optimizer::operator()(Ast::Return& r)
+{
+    if (r.expression) (*r.expression)->accept(*this);
+    returns_ = true;
+}
+
+void Optimizer::operator()(Ast::While& w)
+{
+    w.condition->accept(*this);
+    this->optimize_branch(w.body);
+    returns_ = false;
+}
+
+void Optimizer::operator()(Ast::Declaration& d)
+{
+    if (d.initializer) (*d.initializer)->accept(*this);
+    returns_ = false;
+}
+
+void Optimizer::operator()(Ast::Import&)
+{
+    // Imported files aren't optimized
+    returns_ = false;
+}
+
+}
+
+void optimize(Ast::Ast& ast, const Locations& locations, const Uses& uses,
+              std::vector<std::string>* report)
+{
+    Optimizer optimizer{locations, uses, report};
+    optimizer.optimize(ast, true);
+}
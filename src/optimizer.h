@@ -0,0 +1,16 @@
+#pragma once
+
+#include "ast.h"
+#include "resolver.h"
+
+#include <string>
+#include <vector>
+
+// Removes code from a resolved ast that can't change what the program does: statements after a
+// return, the branches of ifs that are never taken because their conditions are constant, and
+// declarations of local variables that are never used, if their initializers have no side effects.
+//
+// Declarations at the top level are kept, since later lines of the prompt and files that import
+// the program can use them, and so are imported files, which are shared between importers. Each
+// removal is described by a line in the report, if there is one.
+void optimize(Ast::Ast&, const Locations&, const Uses&, std::vector<std::string>* report = nullptr);
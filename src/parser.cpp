@@ -1,14 +1,15 @@
 #include "parser.h"
 #include "error.h"
 #include "ast.h"
+#include "scanner.h"
 #include "function.h"
 #include "token.h"
 #include "object.h"
 #include "function_input.h"
-#include "scanner.h"
-#include "general.h"
 
 #include <cassert>
+#include <cstddef>
+#include <deque>
 #include <memory>
 #include <vector>
 
@@ -17,74 +18,137 @@ using namespace std::literals;
 namespace {
 
 struct ParseData {
-    ParseData(const std::vector<Token>& tokens,
-              std::function<void(const Error&)> report_error);
+    ParseData(const std::vector<Token>& tokens, std::function<void(const Error&)> report_error,
+              ImportLoader load_import, std::vector<Ast::Import*>* unloaded_imports = nullptr);
+    ParseData(TokenStream& stream, std::function<void(const Error&)> report_error,
+              ImportLoader load_import);
     ParseData(const ParseData&) = delete;
     ParseData(ParseData&&) = delete;
 
-    const Token& read() const noexcept;
-    bool is_at_end() const noexcept;
-    const Token& advance() noexcept;
+    const Token& read() const;
+    // The token after the current one
+    const Token& peek() const;
+    bool is_at_end() const;
+    const Token& advance();
 
-    template <typename... TokenType> bool match(TokenType... types) const noexcept;
-    template <typename... TokenType> bool match_advance(TokenType... types) noexcept;
+    template <typename... TokenType> bool match(TokenType... types) const;
+    bool match_type_declaration() const;
+    template <typename... TokenType> bool match_advance(TokenType... types);
     const Token& expect(Token::Type type, const std::string_view error_message);
 
-    void save_position() noexcept { saved_position_ = position_; }
-    void return_to_saved_position() noexcept { position_ = saved_position_; }
+    void synchronize();
 
-    void synchronize() noexcept;
+    // Frees the streamed tokens before the current one
+    void discard_read_tokens();
 
     const std::function<void(const Error&)> report_error;
+    const ImportLoader load_import;
+
+    // If set, imported files aren't loaded, and the imports are collected here instead
+    std::vector<Ast::Import*>* const unloaded_imports;
+
+    // Set whenever a function expression is parsed
+    bool parsed_function = false;
 private:
-    bool increment_position(int i = 1) noexcept;
+    bool increment_position(int i = 1);
 
-    const std::vector<Token>& tokens_;
+    // Either every token, or when streaming, the tokens pulled from the stream since they were
+    // last discarded. Tokens are pulled as they're read, and a deque keeps references to them
+    // valid as more are added.
+    const std::vector<Token>* const tokens_ = nullptr;
+    TokenStream* const stream_ = nullptr;
+    mutable std::deque<Token> streamed_tokens_;
 
     std::size_t position_ = 0;
-    std::size_t saved_position_ = 0;
 };
 
 ParseData::ParseData(const std::vector<Token>& tokens,
-                     std::function<void(const Error&)> report_error)
-    : report_error{report_error}, tokens_{tokens}
+                     std::function<void(const Error&)> report_error, ImportLoader load_import,
+                     std::vector<Ast::Import*>* unloaded_imports)
+    : report_error{report_error}, load_import{load_import}, unloaded_imports{unloaded_imports},
+      tokens_{&tokens}
 {
-    assert(!tokens_.empty() && tokens_.back().type == Token::Type::eof &&
+    assert(!tokens_->empty() && tokens_->back().type == Token::Type::eof &&
            "Parse data must end with eof token");
 }
 
-const Token& ParseData::read() const noexcept {
-    return tokens_[position_];
+ParseData::ParseData(TokenStream& stream, std::function<void(const Error&)> report_error,
+                     ImportLoader load_import)
+    : report_error{report_error}, load_import{load_import}, unloaded_imports{nullptr},
+      stream_{&stream}
+{}
+
+const Token& ParseData::read() const {
+    if (!stream_) return (*tokens_)[position_];
+
+    while (position_ >= streamed_tokens_.size()) {
+        streamed_tokens_.push_back(stream_->next());
+    }
+    return streamed_tokens_[position_];
+}
+
+const Token& ParseData::peek() const {
+    if (this->is_at_end()) return this->read();
+    if (!stream_) return (*tokens_)[position_ + 1];
+
+    while (position_ + 1 >= streamed_tokens_.size()) {
+        streamed_tokens_.push_back(stream_->next());
+    }
+    return streamed_tokens_[position_ + 1];
 }
 
-bool ParseData::is_at_end() const noexcept {
-    return position_ == tokens_.size() - 1;
+bool ParseData::is_at_end() const {
+    return this->read().type == Token::Type::eof;
 }
 
-bool ParseData::increment_position(int i) noexcept {
-    if (position_ >= tokens_.size() - i) return false;
+bool ParseData::increment_position(int i) {
+    if (stream_) {
+        assert(i == 1 && "Streamed tokens are only stepped through one at a time");
+        if (this->is_at_end()) return false;
+        ++position_;
+        return true;
+    }
+
+    if (position_ >= tokens_->size() - i) return false;
     if (i < 0 && position_ < static_cast<std::size_t>(-i)) return false;
 
     position_ += i;
     return true;
 }
 
-const Token& ParseData::advance() noexcept {
+const Token& ParseData::advance() {
     const auto& token = this->read();
     this->increment_position();
     return token;
 }
 
+void ParseData::discard_read_tokens()
+{
+    if (!stream_) return;
+
+    streamed_tokens_.erase(streamed_tokens_.begin(),
+                           streamed_tokens_.begin() + static_cast<std::ptrdiff_t>(position_));
+    position_ = 0;
+}
+
 template <typename... TokenType>
-bool ParseData::match(TokenType... types) const noexcept
+bool ParseData::match(TokenType... types) const
 {
     const auto& token = this->read();
     return ((token.type == types) || ...);
 }
 
+// type isn't a keyword, so that it can still be used as a name. It only starts a declaration when
+// it's followed by the type's name, which an expression never is.
+bool ParseData::match_type_declaration() const
+{
+    return this->match(Token::Type::identifier) && this->read().lexeme() == "type" &&
+           this->peek().type == Token::Type::identifier;
+}
+
 // Matches next token against token types, and advances if there is a match
 template <typename... TokenType>
-bool ParseData::match_advance(TokenType... types) noexcept
+bool ParseData::match_advance(TokenType... types)
 {
     if (this->match(types...)) {
         this->increment_position();
@@ -106,7 +170,7 @@ const Token& ParseData::expect(Token::Type type, const std::string_view error_me
     throw ParseError(token, std::string(error_message));
 }
 
-void ParseData::synchronize() noexcept
+void ParseData::synchronize()
 {
     while (true) {
         if (this->match(Token::Type::semicolon)) {
@@ -118,7 +182,8 @@ void ParseData::synchronize() noexcept
 
         if (this->match(Token::Type::k_class, Token::Type::k_fun, Token::Type::k_var,
                         Token::Type::k_for, Token::Type::k_if, Token::Type::k_while,
-                        Token::Type::k_return)) {
+                        Token::Type::k_return) ||
+            this->match_type_declaration()) {
             return;
         }
     }
@@ -127,6 +192,7 @@ void ParseData::synchronize() noexcept
 std::unique_ptr<Ast::VariableTuple> parse_variable_tuple(ParseData&);
 std::unique_ptr<Ast::Function> parse_function(ParseData&);
 std::unique_ptr<Ast::Expression> parse_primary(ParseData&);
+std::unique_ptr<Ast::Expression> parse_get(ParseData&);
 std::unique_ptr<Ast::Expression> parse_unary_call(ParseData& data);
 std::unique_ptr<Ast::Expression> parse_n_ary_call(ParseData& data);
 std::unique_ptr<Ast::Expression> parse_unary(ParseData&);
@@ -147,6 +213,7 @@ std::unique_ptr<Ast::Return> parse_return_statement(ParseData&);
 std::unique_ptr<Ast::Import> parse_import_statement(ParseData&);
 std::unique_ptr<Ast::Statement> parse_statement(ParseData&);
 std::unique_ptr<Ast::Statement> parse_var_declaration(ParseData&);
+std::unique_ptr<Ast::Statement> parse_type_declaration(ParseData&);
 std::unique_ptr<Ast::Statement> parse_declaration(ParseData&);
 
 std::unique_ptr<Ast::VariableTuple> parse_variable_tuple(ParseData& data)
@@ -195,6 +262,7 @@ std::unique_ptr<Ast::VariableTuple> parse_variable_tuple(ParseData& data)
 std::unique_ptr<Ast::Function> parse_function(ParseData& data)
 {
     data.expect(Token::Type::k_fun, "expect fun keyword to begin function expression");
+    data.parsed_function = true;
 
     auto input = [&data]() -> FunctionInput<std::shared_ptr<Ast::VariableTuple>> {
         if (!data.match(Token::Type::left_brace)) {
@@ -224,8 +292,7 @@ std::unique_ptr<Ast::Expression> parse_primary(ParseData& data)
 
     if (data.match(Token::Type::number, Token::Type::string)) {
         const auto& token = data.advance();
-        assert(token.literal && "Token type indicates there should be literal but none present");
-        return std::make_unique<Ast::Literal>(*token.literal);
+        return std::make_unique<Ast::Literal>(*literal_value(token));
     }
 
     if (data.match(Token::Type::identifier)) {
@@ -244,9 +311,21 @@ std::unique_ptr<Ast::Expression> parse_primary(ParseData& data)
     throw ParseError(data.read(), "expect expression");
 }
 
+std::unique_ptr<Ast::Expression> parse_get(ParseData& data)
+{
+    auto expression = parse_primary(data);
+
+    while (data.match_advance(Token::Type::colon)) {
+        const auto& name = data.expect(Token::Type::identifier, "expect member name after ':'");
+        expression = std::make_unique<Ast::Get>(std::move(expression), name);
+    }
+
+    return expression;
+}
+
 std::unique_ptr<Ast::Expression> parse_unary_call(ParseData& data)
 {
-    if (!data.match(Token::Type::dot)) return parse_primary(data);
+    if (!data.match(Token::Type::dot)) return parse_get(data);
 
     const auto& token = data.advance();
 
@@ -422,17 +501,49 @@ std::unique_ptr<Ast::Expression> parse_send_call(ParseData& data)
 }
 
 
-std::unique_ptr<Ast::Expression> parse_assignment(ParseData& data)
+// The left side of an assignment is parsed as an expression, since it can't be told apart from one
+// until the '=' is found, and then converted. Returns nullptr if it isn't made up of only
+// variables, parentheses and commas.
+std::unique_ptr<Ast::VariableTuple> to_variable_tuple(Ast::Expression& expression)
 {
-    data.save_position();
+    if (auto variable = dynamic_cast<Ast::Variable*>(&expression)) {
+        return std::make_unique<Ast::VariableTuple>(std::move(*variable));
+    }
+
+    if (auto grouping = dynamic_cast<Ast::Grouping*>(&expression)) {
+        return to_variable_tuple(*grouping->expression);
+    }
+
+    if (auto tuple = dynamic_cast<Ast::Tuple*>(&expression)) {
+        std::vector<Ast::VariableTuple> vec;
+        vec.reserve(tuple->elements.size());
+        for (auto& element : tuple->elements) {
+            auto variable_tuple = to_variable_tuple(*element);
+            if (!variable_tuple) return nullptr;
+            vec.push_back(std::move(*variable_tuple));
+        }
+        return std::make_unique<Ast::VariableTuple>(std::move(vec));
+    }
+
+    return nullptr;
+}
 
+std::unique_ptr<Ast::Expression> parse_assignment(ParseData& data)
+{
     auto expression = parse_send_call(data);
 
     if (data.match(Token::Type::equal)) {
-        data.return_to_saved_position();
+        auto token = data.advance();
+
+        if (auto get = dynamic_cast<Ast::Get*>(expression.get())) {
+            auto value = parse_assignment(data);
+            return std::make_unique<Ast::AssignMember>(std::move(get->object), get->name,
+                                                       std::move(value));
+        }
+
+        auto variable_tuple = to_variable_tuple(*expression);
+        if (!variable_tuple) throw ParseError(token, "expected identifier(s) before '='");
 
-        auto variable_tuple = parse_variable_tuple(data);
-        auto token = data.expect(Token::Type::equal, "error parsing assignment");
         auto value = parse_assignment(data);
 
         return std::make_unique<Ast::Assign>(std::move(variable_tuple), std::move(token),
@@ -475,6 +586,8 @@ std::unique_ptr<Ast::Block> parse_block(ParseData& data)
 
 std::unique_ptr<Ast::Statement> parse_if_statement(ParseData& data)
 {
+    const Token& keyword = data.advance();
+
     data.expect(Token::Type::left_paren, "expect '(' after 'if'");
     auto condition = parse_expression(data);
     data.expect(Token::Type::right_paren, "expect ')' after if condition");
@@ -483,8 +596,8 @@ std::unique_ptr<Ast::Statement> parse_if_statement(ParseData& data)
     std::optional<std::unique_ptr<Ast::Statement>> else_branch;  // Default to empty block
     if (data.match_advance(Token::Type::k_else)) else_branch = parse_statement(data);
 
-    return std::make_unique<Ast::If>(std::move(condition), std::move(then_branch),
-                                std::move(else_branch));
+    return std::make_unique<Ast::If>(keyword, std::move(condition), std::move(then_branch),
+                                     std::move(else_branch));
 }
 
 std::unique_ptr<Ast::Statement> parse_while_statement(ParseData& data)
@@ -554,20 +667,42 @@ std::unique_ptr<Ast::Return> parse_return_statement(ParseData& data)
 std::unique_ptr<Ast::Import> parse_import_statement(ParseData& data)
 {
     const Token& keyword = data.expect(Token::Type::k_import, "expected import keyword");
+    // lazy isn't a keyword, so that it can still be used as a name
+    const bool lazy = data.match(Token::Type::identifier) && data.read().lexeme() == "lazy";
+    if (lazy) data.advance();
 
-    const std::string& filepath =
-        data.expect(Token::Type::string, "expect string after import statement")
-            .literal->get<std::string>();
+    const Token& filepath_token =
+        data.expect(Token::Type::string, "expect string after import statement");
+    const std::string filepath = literal_value(filepath_token)->get<std::string>();
 
     std::optional<std::unique_ptr<Ast::Variable>> variable;
     if (data.match_advance(Token::Type::k_as)) {
         variable = std::make_unique<Ast::Variable>(
             data.expect(Token::Type::identifier, "expect identifier after as"));
+    } else if (lazy) {
+        throw ParseError(data.read(), "expect 'as' after lazy import");
     }
 
-    data.expect(Token::Type::semicolon, "expect ';' after import statement");
+    if (lazy) {
+        // Nothing is loaded until a member of the module is accessed
+        data.expect(Token::Type::semicolon, "expect ';' after import statement");
+        return std::make_unique<Ast::Import>(keyword, filepath, nullptr, std::move(variable),
+                                             true);
+    }
 
-    auto ast = parse(scan(read_file(filepath), data.report_error), data.report_error);
+    if (data.unloaded_imports) {
+        data.expect(Token::Type::semicolon, "expect ';' after import statement");
+        auto import =
+            std::make_unique<Ast::Import>(keyword, filepath, nullptr, std::move(variable));
+        data.unloaded_imports->push_back(import.get());
+        return import;
+    }
+
+    // Load before expecting the semicolon, so that if loading fails synchronizing stops at the end
+    // of this statement
+    auto ast = data.load_import(filepath, filepath_token);
+
+    data.expect(Token::Type::semicolon, "expect ';' after import statement");
 
     return std::make_unique<Ast::Import>(keyword, filepath, std::move(ast), std::move(variable));
 }
@@ -575,7 +710,7 @@ std::unique_ptr<Ast::Import> parse_import_statement(ParseData& data)
 std::unique_ptr<Ast::Statement> parse_statement(ParseData& data)
 {
     if (data.match_advance(Token::Type::k_for)) return parse_for_statement(data);
-    if (data.match_advance(Token::Type::k_if)) return parse_if_statement(data);
+    if (data.match(Token::Type::k_if)) return parse_if_statement(data);
     if (data.match(Token::Type::k_return)) return parse_return_statement(data);
     if (data.match(Token::Type::k_import)) return parse_import_statement(data);
     if (data.match_advance(Token::Type::k_while)) return parse_while_statement(data);
@@ -602,20 +737,85 @@ std::unique_ptr<Ast::Statement> parse_var_declaration(ParseData& data)
                                               std::move(initializer));
 }
 
+// type T { x|double@0, y, s|string@"" };
+// is a declaration of T, initialized to the record type as a literal
+std::unique_ptr<Ast::Statement> parse_type_declaration(ParseData& data)
+{
+    const auto name = data.expect(Token::Type::identifier, "expect type name after 'type'");
+    data.expect(Token::Type::left_brace, "expect '{' after type name");
+
+    std::vector<RecordType::Field> fields;
+    std::vector<ObjectReference> initial;
+    while (!data.match(Token::Type::right_brace)) {
+        const auto& field = data.expect(Token::Type::identifier, "expect field name");
+        for (const auto& f : fields) {
+            if (f.name == field.lexeme()) throw ParseError(field, "field declared twice");
+        }
+
+        auto type = FieldType::any;
+        if (data.match_advance(Token::Type::pipe)) {
+            const auto& t = data.expect(Token::Type::identifier, "expect field type after '|'");
+            if (t.lexeme() == "double") type = FieldType::number;
+            else if (t.lexeme() == "bool") type = FieldType::boolean;
+            else if (t.lexeme() == "string") type = FieldType::string;
+            else throw ParseError(t, "field types can only be double, bool or string");
+        }
+
+        // Typed fields start at zero, false or the empty string, unless they're given a value
+        ObjectReference value = nullptr;
+        if (type == FieldType::number) value = 0.0;
+        else if (type == FieldType::boolean) value = false;
+        else if (type == FieldType::string) value = std::string{};
+        if (data.match_advance(Token::Type::at)) {
+            const bool negative = data.match_advance(Token::Type::minus);
+            const auto& literal = data.advance();
+            auto v = literal_value(literal);
+            if (!v || (negative && !v->holds<double>())) {
+                throw ParseError(literal, "expect a literal after '@'");
+            }
+            value = negative ? ObjectReference{-v->get<double>()} : std::move(*v);
+        }
+
+        fields.push_back({std::string{field.lexeme()}, type});
+        initial.push_back(std::move(value));
+        if (!data.match_advance(Token::Type::comma)) break;
+    }
+    data.expect(Token::Type::right_brace, "expect '}' after fields");
+    auto token = data.expect(Token::Type::semicolon, "expect ';' after type declaration");
+
+    RecordType record_type{std::string{name.lexeme()}, std::move(fields), std::move(initial)};
+    for (std::size_t i = 0; i < record_type.fields().size(); ++i) {
+        try {
+            record_type.check(i, record_type.initial()[i], token);
+        } catch (const RuntimeError&) {
+            throw ParseError(token, "the initial value of field '" +
+                                    record_type.fields()[i].name + "' isn't of its type");
+        }
+    }
+
+    return std::make_unique<Ast::Declaration>(
+        std::make_unique<Ast::VariableTuple>(Ast::Variable{name}), std::move(token),
+        std::make_unique<Ast::Literal>(std::move(record_type)));
+}
+
 std::unique_ptr<Ast::Statement> parse_declaration(ParseData& data)
 {
     if (data.match_advance(Token::Type::k_var)) return parse_var_declaration(data);
+    if (data.match_type_declaration()) {
+        data.advance();
+        return parse_type_declaration(data);
+    }
 
     return parse_statement(data);
 }
 
 }  // End of anonymous namespace
 
-Ast::Ast parse(const std::vector<Token>& tokens, std::function<void(const Error&)> report_error)
+namespace {
+
+Ast::Ast parse(ParseData& data)
 {
     Ast::Ast ast;
-    ParseData data{tokens, report_error};
-
     while (!data.is_at_end()) {
         try {
             ast.push_back(parse_declaration(data));
@@ -629,3 +829,52 @@ Ast::Ast parse(const std::vector<Token>& tokens, std::function<void(const Error&
     return ast;
 }
 
+}  // End of anonymous namespace
+
+Ast::Ast parse(const std::vector<Token>& tokens, std::function<void(const Error&)> report_error,
+               ImportLoader load_import)
+{
+    ParseData data{tokens, report_error, load_import};
+    return parse(data);
+}
+
+Ast::Ast parse(const std::vector<Token>& tokens, std::function<void(const Error&)> report_error,
+               std::vector<Ast::Import*>& unloaded_imports)
+{
+    ParseData data{tokens, report_error, {}, &unloaded_imports};
+    return parse(data);
+}
+
+
+void parse(TokenStream& tokens, std::function<void(const Error&)> report_error,
+           ImportLoader load_import,
+           const std::function<bool(StreamedStatement)>& handle_statement)
+{
+    ParseData data{tokens, report_error, load_import};
+    while (!data.is_at_end()) {
+        // The resolver keeps the names of top-level variables, which refer to the source
+        const bool declares = data.match(Token::Type::k_var, Token::Type::k_import) ||
+                              data.match_type_declaration();
+        data.parsed_function = false;
+
+        std::unique_ptr<Ast::Statement> statement;
+        try {
+            statement = parse_declaration(data);
+        }
+        catch (const ParseError& e) {
+            data.report_error(e);
+            data.synchronize();
+        }
+
+        data.discard_read_tokens();
+        auto sources = tokens.take_sources();
+        if (!statement) continue;
+
+        StreamedStatement streamed;
+        streamed.ast.push_back(std::move(statement));
+        streamed.sources = std::move(sources);
+        streamed.keeps_tokens = declares || data.parsed_function;
+
+        if (!handle_statement(std::move(streamed))) return;
+    }
+}
@@ -3,8 +3,44 @@
 #include "token.h"
 #include "ast.h"
 #include "error.h"
+#include "scanner.h"
 
 #include <functional>
+#include <memory>
 #include <vector>
+#include <string>
 
-Ast::Ast parse(const std::vector<Token>& tokens, std::function<void(const Error&)> report_error);
+// Produces the ast of a file named in an import statement, given the string token naming the file.
+// It may throw a ParseError, which is reported against the import statement. The loader is
+// responsible for keeping the file's source alive for as long as the ast is used.
+using ImportLoader =
+    std::function<std::shared_ptr<const Ast::Ast>(const std::string& filepath, const Token&)>;
+
+Ast::Ast parse(const std::vector<Token>& tokens, std::function<void(const Error&)> report_error,
+               ImportLoader load_import);
+
+// Parses without loading any imported files. Imports (other than lazy ones) are given no ast, and
+// are added to unloaded_imports in source order, so that the files can be loaded separately.
+Ast::Ast parse(const std::vector<Token>& tokens, std::function<void(const Error&)> report_error,
+               std::vector<Ast::Import*>& unloaded_imports);
+
+// A top-level statement parsed from a token stream
+struct StreamedStatement {
+    // Just the one statement
+    Ast::Ast ast;
+
+    // The chunks of input that the statement's tokens refer to
+    std::vector<Source> sources;
+
+    // Whether running the statement can leave things that refer to its tokens, such as functions
+    // or the names of top-level variables, so that the sources have to be kept afterwards
+    bool keeps_tokens = false;
+};
+
+// Parses one top-level statement at a time, pulling tokens from the stream as they're needed, and
+// hands each to handle_statement as soon as it's parsed, so that only the current statement is in
+// memory. Errors are reported as they're found, and statements with errors are skipped. Parsing
+// stops early if handle_statement returns false.
+void parse(TokenStream& tokens, std::function<void(const Error&)> report_error,
+           ImportLoader load_import,
+           const std::function<bool(StreamedStatement)>& handle_statement);
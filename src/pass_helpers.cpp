@@ -0,0 +1,37 @@
+#include "pass_helpers.h"
+
+const Ast::Expression& ungrouped(const Ast::Expression& e)
+{
+    if (const auto g = dynamic_cast<const Ast::Grouping*>(&e)) return ungrouped(*g->expression);
+    return e;
+}
+
+Ast::Expression& ungrouped(Ast::Expression& e)
+{
+    if (const auto g = dynamic_cast<Ast::Grouping*>(&e)) return ungrouped(*g->expression);
+    return e;
+}
+
+std::optional<unsigned> line_of(const Ast::Expression& e)
+{
+    if (const auto v = dynamic_cast<const Ast::Variable*>(&e)) return v->name.line;
+    if (const auto g = dynamic_cast<const Ast::Grouping*>(&e)) return line_of(*g->expression);
+    if (const auto u = dynamic_cast<const Ast::Unary*>(&e)) return u->op.line;
+    if (const auto b = dynamic_cast<const Ast::Binary*>(&e)) {
+        return line_of(*b->left).value_or(b->op.line);
+    }
+    if (const auto l = dynamic_cast<const Ast::Logical*>(&e)) {
+        return line_of(*l->left).value_or(l->op.line);
+    }
+    if (const auto t = dynamic_cast<const Ast::Tuple*>(&e)) {
+        for (const auto& element : t->elements) {
+            if (const auto line = line_of(*element)) return line;
+        }
+    }
+    return {};
+}
+
+void add_to_report(std::vector<std::string>* report, std::string line)
+{
+    if (report) report->push_back(std::move(line));
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "ast.h"
+
+#include <optional>
+#include <string>
+#include <vector>
+
+// What the passes that rewrite the resolved ast before it's run have in common
+
+// Strips any parentheses around an expression
+const Ast::Expression& ungrouped(const Ast::Expression&);
+Ast::Expression& ungrouped(Ast::Expression&);
+
+// The line of the first token of an expression made of operators, literals, variables and tuples,
+// if it has any. Literals have no tokens, so an operator on a literal is on the operator's line.
+std::optional<unsigned> line_of(const Ast::Expression&);
+
+// Adds a line to the report of what the passes did, if one is being made for --opt-report
+void add_to_report(std::vector<std::string>* report, std::string line);
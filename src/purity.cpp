@@ -0,0 +1,460 @@
+#include "purity.h"
+#include "pass_helpers.h"
+
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+namespace {
+
+// What a global is bound to by a declaration or an assignment
+struct Binding {
+    // Null if it isn't bound to a function literal
+    const Ast::Function* function;
+    // Bound to the function memoized, which is only the same as the function if the memo global is
+    // the builtin
+    bool memoized;
+};
+
+// Whether the function is pure, ignoring what the globals it calls are bound to
+struct LocalPurity {
+    bool pure = true;
+    std::vector<std::string_view> callees;
+};
+
+// Collects the bindings of the globals anywhere in the ast, including in imported files, and checks
+// each function defined in the ast itself
+struct Collector : Ast::Expression::Visitor<void>, Ast::Statement::Visitor<void> {
+    Collector(const Locations& l)
+        : locations_{l}
+    {}
+
+    void collect(const Ast::Ast& statements, bool imported = false);
+
+    std::unordered_map<std::string_view, std::vector<Binding>> globals;
+    // Set if a file is imported without a name, which can bind any global, or lazily
+    bool unknown = false;
+    std::unordered_map<const Ast::Function*, LocalPurity> functions;
+
+    void operator()(const Ast::Assign&) override;
+    void operator()(const Ast::AssignMember&) override;
+    void operator()(const Ast::Binary&) override;
+    void operator()(const Ast::Call&) override;
+    void operator()(const Ast::Function&) override;
+    void operator()(const Ast::Get&) override;
+    void operator()(const Ast::Grouping&) override;
+    void operator()(const Ast::Inlined&) override;
+    void operator()(const Ast::Literal&) override;
+    void operator()(const Ast::Logical&) override;
+    void operator()(const Ast::Tuple&) override;
+    void operator()(const Ast::Unary&) override;
+    void operator()(const Ast::Variable&) override;
+    void operator()(const Ast::VariableTuple&) override;
+
+    void operator()(const Ast::Block&) override;
+    void operator()(const Ast::ExpressionStatement&) override;
+    void operator()(const Ast::If&) override;
+    void operator()(const Ast::Return&) override;
+    void operator()(const Ast::While&) override;
+    void operator()(const Ast::Declaration&) override;
+    void operator()(const Ast::Import&) override;
+private:
+    void collect(const Ast::Statement& s) { s.accept(*this); }
+    void collect(const Ast::Expression& e) { e.accept(*this); }
+    void bind(const Ast::VariableTuple&, const Ast::Expression* value);
+
+    const Locations& locations_;
+    bool imported_ = false;
+};
+
+// Checks the body of a function, where the depth is the number of scopes inside the scope of its
+// inputs. The function's own variables are the ones found within that depth.
+struct Checker : Ast::Expression::Visitor<void>, Ast::Statement::Visitor<void> {
+    Checker(const Locations& l)
+        : locations_{l}
+    {}
+
+    void check(const Ast::Statement& s) {
+        if (result.pure) s.accept(*this);
+    }
+    void check(const Ast::Expression& e) {
+        if (result.pure) e.accept(*this);
+    }
+
+    LocalPurity result;
+
+    void operator()(const Ast::Assign&) override;
+    void operator()(const Ast::AssignMember&) override;
+    void operator()(const Ast::Binary&) override;
+    void operator()(const Ast::Call&) override;
+    void operator()(const Ast::Function&) override;
+    void operator()(const Ast::Get&) override;
+    void operator()(const Ast::Grouping&) override;
+    void operator()(const Ast::Inlined&) override;
+    void operator()(const Ast::Literal&) override;
+    void operator()(const Ast::Logical&) override;
+    void operator()(const Ast::Tuple&) override;
+    void operator()(const Ast::Unary&) override;
+    void operator()(const Ast::Variable&) override;
+    void operator()(const Ast::VariableTuple&) override;
+
+    void operator()(const Ast::Block&) override;
+    void operator()(const Ast::ExpressionStatement&) override;
+    void operator()(const Ast::If&) override;
+    void operator()(const Ast::Return&) override;
+    void operator()(const Ast::While&) override;
+    void operator()(const Ast::Declaration&) override;
+    void operator()(const Ast::Import&) override;
+private:
+    bool is_own(const Ast::Variable&) const;
+
+    const Locations& locations_;
+    int depth_ = 0;
+};
+
+bool is_global_variable(const Locations& locations, const Ast::Variable& v)
+{
+    const auto location = locations.find(v.id);
+    return location != locations.end() && is_global(location->second);
+}
+
+// The function literal that the expression evaluates to, possibly memoized
+std::optional<Binding> function_literal(const Ast::Expression& e, const Locations& locations)
+{
+    const auto& expression = ungrouped(e);
+    if (const auto f = dynamic_cast<const Ast::Function*>(&expression)) return Binding{f, false};
+
+    const auto c = dynamic_cast<const Ast::Call*>(&expression);
+    if (!c || c->input.size() == 0) return {};
+    const auto callee = dynamic_cast<const Ast::Variable*>(&ungrouped(*c->callee));
+    if (!callee || callee->name.lexeme() != "memo" || !is_global_variable(locations, *callee)) {
+        return {};
+    }
+    const auto f = dynamic_cast<const Ast::Function*>(&ungrouped(*c->input[0]));
+    if (!f) return {};
+    return Binding{f, true};
+}
+
+void Collector::collect(const Ast::Ast& statements, bool imported)
+{
+    const auto was_imported = imported_;
+    imported_ = imported;
+    for (const auto& statement : statements) this->collect(*statement);
+    imported_ = was_imported;
+}
+
+void Collector::bind(const Ast::VariableTuple& vt, const Ast::Expression* value)
+{
+    const auto single = std::holds_alternative<Ast::Variable>(vt.contents);
+    const auto literal = single && value ? function_literal(*value, locations_) : std::nullopt;
+
+    Ast::for_each_variable(vt, [this, &literal](const Ast::Variable& v) {
+        if (!is_global_variable(locations_, v)) return;
+        globals[v.name.lexeme()].push_back(literal.value_or(Binding{nullptr, false}));
+    });
+}
+
+void Collector::operator()(const Ast::Block& b)
+{
+    for (const auto& statement : b.statements) this->collect(*statement);
+}
+
+void Collector::operator()(const Ast::ExpressionStatement& es)
+{
+    if (es.expression) this->collect(**es.expression);
+}
+
+void Collector::operator()(const Ast::If& i)
+{
+    this->collect(*i.condition);
+    this->collect(*i.then_branch);
+    if (i.else_branch) this->collect(**i.else_branch);
+}
+
+void Collector::operator()(const Ast::Return& r)
+{
+    if (r.expression) this->collect(**r.expression);
+}
+
+void Collector::operator()(const Ast::While& w)
+{
+    this->collect(*w.condition);
+    this->collect(*w.body);
+}
+
+void Collector::operator()(const Ast::Declaration& d)
+{
+    if (d.initializer) this->collect(**d.initializer);
+    this->bind(*d.variable, d.initializer ? d.initializer->get() : nullptr);
+}
+
+void Collector::operator()(const Ast::Import& i)
+{
+    if (i.variable) globals[(*i.variable)->name.lexeme()].push_back({nullptr, false});
+    // A lazily imported file isn't loaded yet, so nothing it binds can be collected
+    if (!i.variable || i.lazy) unknown = true;
+    if (i.ast) this->collect(*i.ast, true);
+}
+
+void Collector::operator()(const Ast::Assign& a)
+{
+    this->collect(*a.expression);
+    this->bind(*a.variable, a.expression.get());
+}
+
+void Collector::operator()(const Ast::AssignMember& a)
+{
+    this->collect(*a.object);
+    this->collect(*a.expression);
+}
+
+void Collector::operator()(const Ast::Binary& b)
+{
+    this->collect(*b.left);
+    this->collect(*b.right);
+}
+
+void Collector::operator()(const Ast::Call& c)
+{
+    this->collect(*c.callee);
+    for (std::size_t i = 0; i < c.input.size(); ++i) this->collect(*c.input[i]);
+}
+
+void Collector::operator()(const Ast::Function& f)
+{
+    if (!imported_) {
+        Checker checker{locations_};
+        checker.check(*f.body);
+        functions[&f] = std::move(checker.result);
+    }
+    this->collect(*f.body);
+}
+
+void Collector::operator()(const Ast::Get& g)
+{
+    this->collect(*g.object);
+}
+
+void Collector::operator()(const Ast::Grouping& g)
+{
+    this->collect(*g.expression);
+}
+
+void Collector::operator()(const Ast::Inlined& i)
+{
+    for (std::size_t j = 0; j < i.arguments.size(); ++j) this->collect(*i.arguments[j]);
+    this->collect(*i.body);
+    if (i.result) this->collect(**i.result);
+}
+
+void Collector::operator()(const Ast::Literal&)
+{
+}
+
+void Collector::operator()(const Ast::Logical& l)
+{
+    this->collect(*l.left);
+    this->collect(*l.right);
+}
+
+void Collector::operator()(const Ast::Tuple& t)
+{
+    for (const auto& element : t.elements) this->collect(*element);
+}
+
+void Collector::operator()(const Ast::Unary& u)
+{
+    this->collect(*u.right);
+}
+
+void Collector::operator()(const Ast::Variable&)
+{
+}
+
+void Collector::operator()(const Ast::VariableTuple&)
+{
+}
+
+bool Checker::is_own(const Ast::Variable& v) const
+{
+    const auto location = locations_.find(v.id);
+    if (location == locations_.end()) return false;
+    return !is_global(location->second) && !is_captured(location->second) &&
+           location->second <= depth_;
+}
+
+void Checker::operator()(const Ast::Block& b)
+{
+    ++depth_;
+    for (const auto& statement : b.statements) this->check(*statement);
+    --depth_;
+}
+
+void Checker::operator()(const Ast::ExpressionStatement& es)
+{
+    if (es.expression) this->check(**es.expression);
+}
+
+void Checker::operator()(const Ast::If& i)
+{
+    this->check(*i.condition);
+    this->check(*i.then_branch);
+    if (i.else_branch) this->check(**i.else_branch);
+}
+
+void Checker::operator()(const Ast::Return& r)
+{
+    if (r.expression) this->check(**r.expression);
+}
+
+void Checker::operator()(const Ast::While& w)
+{
+    this->check(*w.condition);
+    this->check(*w.body);
+}
+
+void Checker::operator()(const Ast::Declaration& d)
+{
+    // Declarations inside a function are always its own
+    if (d.initializer) this->check(**d.initializer);
+}
+
+void Checker::operator()(const Ast::Import&)
+{
+    result.pure = false;
+}
+
+void Checker::operator()(const Ast::Assign& a)
+{
+    this->check(*a.expression);
+    Ast::for_each_variable(*a.variable, [this](const Ast::Variable& v) {
+        if (!this->is_own(v)) result.pure = false;
+    });
+}
+
+void Checker::operator()(const Ast::AssignMember&)
+{
+    result.pure = false;
+}
+
+void Checker::operator()(const Ast::Binary& b)
+{
+    this->check(*b.left);
+    this->check(*b.right);
+}
+
+void Checker::operator()(const Ast::Call& c)
+{
+    const auto callee = dynamic_cast<const Ast::Variable*>(&ungrouped(*c.callee));
+    if (callee && is_global_variable(locations_, *callee)) {
+        result.callees.push_back(callee->name.lexeme());
+    } else {
+        result.pure = false;
+    }
+    for (std::size_t i = 0; i < c.input.size(); ++i) this->check(*c.input[i]);
+}
+
+void Checker::operator()(const Ast::Function&)
+{
+    // Functions created inside it could share its variables
+    result.pure = false;
+}
+
+void Checker::operator()(const Ast::Get&)
+{
+    // Modules could be lazy
+    result.pure = false;
+}
+
+void Checker::operator()(const Ast::Grouping& g)
+{
+    this->check(*g.expression);
+}
+
+void Checker::operator()(const Ast::Inlined& i)
+{
+    for (std::size_t j = 0; j < i.arguments.size(); ++j) this->check(*i.arguments[j]);
+    ++depth_;
+    for (const auto& statement : i.body->statements) this->check(*statement);
+    if (i.result) this->check(**i.result);
+    --depth_;
+}
+
+void Checker::operator()(const Ast::Literal&)
+{
+}
+
+void Checker::operator()(const Ast::Logical& l)
+{
+    this->check(*l.left);
+    this->check(*l.right);
+}
+
+void Checker::operator()(const Ast::Tuple& t)
+{
+    for (const auto& element : t.elements) this->check(*element);
+}
+
+void Checker::operator()(const Ast::Unary& u)
+{
+    this->check(*u.right);
+}
+
+void Checker::operator()(const Ast::Variable& v)
+{
+    const auto location = locations_.find(v.id);
+    if (location == locations_.end() || (!is_captured(location->second) && !this->is_own(v))) {
+        result.pure = false;
+    }
+}
+
+void Checker::operator()(const Ast::VariableTuple&)
+{
+    result.pure = false;
+}
+
+}  // Namespace
+
+void infer_purity(const Ast::Ast& ast, const Locations& locations)
+{
+    Collector collector{locations};
+    collector.collect(ast);
+
+    const auto memo_is_builtin = collector.globals.count("memo") == 0;
+
+    std::unordered_map<const Ast::Function*, bool> pure;
+    for (const auto& [function, local] : collector.functions) pure[function] = local.pure;
+
+    const auto is_bound_to_pure = [&](std::string_view name) {
+        if (collector.unknown) return false;
+        const auto bindings = collector.globals.find(name);
+        if (bindings == collector.globals.end()) return false;
+        for (const auto& binding : bindings->second) {
+            if (!binding.function || (binding.memoized && !memo_is_builtin)) return false;
+            const auto function = pure.find(binding.function);
+            if (function == pure.end() || !function->second) return false;
+        }
+        return true;
+    };
+
+    // Functions that are pure on their own start out pure, and are made impure if they call a
+    // global bound to an impure function, until none do, so that functions calling each other
+    // stay pure
+    for (bool changed = true; changed; ) {
+        changed = false;
+        for (auto& [function, is_pure] : pure) {
+            if (!is_pure) continue;
+            for (const auto callee : collector.functions.at(function).callees) {
+                if (!is_bound_to_pure(callee)) {
+                    is_pure = false;
+                    changed = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    for (const auto& [function, is_pure] : pure) function->pure = is_pure;
+}
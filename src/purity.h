@@ -0,0 +1,17 @@
+#pragma once
+
+#include "ast.h"
+#include "resolver.h"
+
+// Marks the functions defined in the ast that are pure, once it's resolved, so that the memo
+// builtin can cache their results. A function is pure if it only assigns its own variables, only
+// reads those and the variables it captures, and only calls globals that every binding in the ast
+// binds to a pure function, which lets functions call themselves through the globals they're
+// defined as. Functions that are created inside it, member accesses and imports make it impure.
+//
+// Globals are only known to be bound to pure functions if the ast binds them, and nothing else
+// in it does, so an ast that imports a file without a name has no pure functions calling globals,
+// and nor do functions in imported files, which aren't marked. A later line of the prompt can
+// still bind them to something else. Captured variables that can change after they're captured
+// are checked for when a function is memoized.
+void infer_purity(const Ast::Ast&, const Locations&);
@@ -0,0 +1,152 @@
+#include "record.h"
+#include "object.h"
+#include "error.h"
+
+#include <cassert>
+
+struct RecordType::Layout {
+    std::string name;
+    std::vector<Field> fields;
+    std::vector<ObjectReference> initial;
+    const Shape* shape;
+};
+
+namespace {
+
+bool holds(const ObjectReference& o, FieldType type)
+{
+    switch (type) {
+        case FieldType::any: return true;
+        case FieldType::number: return o.holds<double>();
+        case FieldType::boolean: return o.holds<bool>();
+        case FieldType::string: return o.holds<std::string>();
+    }
+    return false;
+}
+
+}  // Namespace
+
+RecordType::RecordType(std::string name, std::vector<Field> fields,
+                       std::vector<ObjectReference> initial)
+{
+    assert(fields.size() == initial.size() && "Every field needs an initial value");
+
+    std::vector<std::string> names;
+    names.reserve(fields.size());
+    for (const auto& field : fields) names.push_back(field.name);
+    const auto& shape = Shape::of(std::move(names));
+
+    layout_ = std::make_shared<const Layout>(
+        Layout{std::move(name), std::move(fields), std::move(initial), &shape});
+}
+
+const std::string& RecordType::name() const
+{
+    return layout_->name;
+}
+
+const std::vector<RecordType::Field>& RecordType::fields() const
+{
+    return layout_->fields;
+}
+
+const std::vector<ObjectReference>& RecordType::initial() const
+{
+    return layout_->initial;
+}
+
+const Shape& RecordType::shape() const
+{
+    return *layout_->shape;
+}
+
+ObjectReference RecordType::construct(const FunctionInput<ObjectReference>& input,
+                                      const Token& token) const
+{
+    auto values = layout_->initial;
+
+    const auto set = [&](std::size_t field, const ObjectReference& o) {
+        if (field >= values.size()) {
+            throw RuntimeError(token, "too many values for type '" + layout_->name + "'");
+        }
+        this->check(field, o, token);
+        values[field] = o;
+    };
+    if (input.size() == 1 && input[0].holds<Tuple>()) {
+        const auto& tuple = input[0].get_unchecked<Tuple>();
+        for (std::size_t i = 0; i < tuple.size(); ++i) set(i, tuple[i]);
+    } else {
+        for (std::size_t i = 0; i < input.size(); ++i) set(i, input[i]);
+    }
+    return Record{*this, std::move(values)};
+}
+
+void RecordType::check(std::size_t field, const ObjectReference& o, const Token& token) const
+{
+    const auto& f = layout_->fields[field];
+    if (holds(o, f.type)) return;
+    throw RuntimeError(token, "field '" + f.name + "' of type '" + layout_->name + "' can only "
+                              "hold a " + to_string(f.type));
+}
+
+bool operator==(const RecordType& a, const RecordType& b)
+{
+    return a.layout_ == b.layout_;
+}
+
+Record::Record(RecordType type, std::vector<ObjectReference> values)
+    : type_{std::move(type)},
+      values_{std::make_shared<std::vector<ObjectReference>>(std::move(values))}
+{}
+
+const RecordType& Record::type() const
+{
+    return type_;
+}
+
+const std::vector<ObjectReference>& Record::values() const
+{
+    return *values_;
+}
+
+const ObjectReference* Record::find(std::string_view name, MemberCache& cache) const
+{
+    const auto& shape = type_.shape();
+    if (cache.shape == &shape) return &(*values_)[cache.slot];
+
+    const auto slot = shape.slot(name);
+    if (!slot) return nullptr;
+    cache = {&shape, *slot};
+    return &(*values_)[*slot];
+}
+
+void Record::assign(const Token& name, ObjectReference o, MemberCache& cache) const
+{
+    const auto& shape = type_.shape();
+    if (cache.shape != &shape) {
+        const auto slot = shape.slot(name.lexeme());
+        if (!slot) {
+            throw RuntimeError(name, "type '" + type_.name() + "' has no field '" +
+                                     std::string{name.lexeme()} + "'");
+        }
+        cache = {&shape, *slot};
+    }
+    type_.check(cache.slot, o, name);
+    (*values_)[cache.slot] = std::move(o);
+}
+
+bool operator==(const Record& a, const Record& b)
+{
+    return a.values_ == b.values_;
+}
+
+std::string to_string(FieldType type)
+{
+    switch (type) {
+        case FieldType::any: return "any";
+        case FieldType::number: return "double";
+        case FieldType::boolean: return "bool";
+        case FieldType::string: return "string";
+    }
+    return "";
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "function_input.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct ObjectReference;
+struct MemberCache;
+struct Shape;
+struct Token;
+
+// What a field of a record type can hold, written after a '|' in its declaration
+enum class FieldType : std::uint8_t { any, number, boolean, string };
+
+// A type declared with `type T { x|double@0, ... }`, which is called to make records of the type.
+// The fields are laid out in the order they're declared, and every copy of the type is the same
+// type, so a type is only equal to itself.
+struct RecordType {
+    struct Field {
+        std::string name;
+        FieldType type;
+    };
+
+    // There must be an initial value for each field, of its type
+    RecordType(std::string name, std::vector<Field> fields, std::vector<ObjectReference> initial);
+
+    const std::string& name() const;
+    const std::vector<Field>& fields() const;
+    const std::vector<ObjectReference>& initial() const;
+    const Shape& shape() const;
+
+    // (x, y).T sets the first two fields and leaves the others at their initial values
+    ObjectReference construct(const FunctionInput<ObjectReference>&, const Token&) const;
+    // Throws unless the object can be stored in the field
+    void check(std::size_t field, const ObjectReference&, const Token&) const;
+
+    friend bool operator==(const RecordType&, const RecordType&);
+private:
+    struct Layout;
+    std::shared_ptr<const Layout> layout_;
+};
+
+// A value of a record type. Its fields are kept next to each other, in the order of the type's
+// shape, and, like a list's elements, are shared by every copy of the record, so a record is only
+// equal to itself.
+struct Record {
+    Record(RecordType, std::vector<ObjectReference> values);
+
+    const RecordType& type() const;
+    const std::vector<ObjectReference>& values() const;
+
+    // Null if there's no field with the name
+    const ObjectReference* find(std::string_view name, MemberCache&) const;
+    // Throws if there's no field with the name or it can't hold the object
+    void assign(const Token& name, ObjectReference, MemberCache&) const;
+
+    friend bool operator==(const Record&, const Record&);
+private:
+    RecordType type_;
+    std::shared_ptr<std::vector<ObjectReference>> values_;
+};
+
+std::string to_string(FieldType);
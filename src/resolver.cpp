@@ -1,39 +1,143 @@
 #include "resolver.h"
-#include <stack>
 #include <vector>
 #include <cassert>
-#include <unordered_set>
 
-void Scope::define(const Ast::VariableTuple& vt)
+void ScopeStack::pop(Locations& locations)
 {
-    for_each_variable(vt, [this](const Ast::Variable& v) { data_.insert(v.name.lexeme); });
+    assert(scopes_.size() > 1 && "The outermost scope is never popped");
+
+    for (auto i = bindings_.size(); i-- > scopes_.back(); ) {
+        const auto& binding = bindings_[i];
+        if (binding.captured && binding.changed && binding.declaration != no_declaration) {
+            locations[binding.declaration] = boxed_location;
+        }
+        innermost_[binding.symbol] = binding.shadowed;
+    }
+    bindings_.resize(scopes_.back());
+    scopes_.pop_back();
+}
+
+void ScopeStack::push_function()
+{
+    functions_.push_back({static_cast<std::uint32_t>(scopes_.size()), {}, {}});
+    this->push();
+}
+
+std::vector<Ast::Capture> ScopeStack::pop_function(Locations& locations)
+{
+    this->pop(locations);
+    auto captures = std::move(functions_.back().captures);
+    functions_.pop_back();
+    return captures;
 }
 
-bool Scope::has_defined(const Ast::Variable& v) const
+void ScopeStack::define(const Ast::VariableTuple& vt)
 {
-    return data_.find(v.name.lexeme) != data_.end();
+    for_each_variable(vt, [this](const Ast::Variable& v) { this->bind(v.name.lexeme(), v.id); });
 }
 
-void Scope::combine_with(const Scope& scope)
+std::uint32_t ScopeStack::bind(std::string_view name, std::uint64_t declaration)
 {
-    for (const auto& str : scope.data_) {
-        data_.insert(str);
+    auto it = symbols_.find(name);
+    if (it == symbols_.end()) {
+        // Keyed by a copy of the name, rather than by the source it was found in
+        names_.emplace_back(name);
+        it = symbols_.emplace(names_.back(), static_cast<Symbol>(innermost_.size())).first;
+        innermost_.push_back(none);
+    }
+
+    const auto symbol = it->second;
+    const auto scope = static_cast<std::uint32_t>(scopes_.size() - 1);
+    const auto shadowed = innermost_[symbol];
+
+    // Defining a variable again in the same scope leaves it bound to that scope, with a new value
+    if (shadowed != none && bindings_[shadowed].scope == scope) {
+        bindings_[shadowed].changed = true;
+        return shadowed;
     }
+
+    innermost_[symbol] = static_cast<std::uint32_t>(bindings_.size());
+    bindings_.push_back({symbol, scope, shadowed, declaration});
+    return innermost_[symbol];
 }
 
-std::optional<int> ScopeStack::resolve(const Ast::Variable& v) const
+void ScopeStack::combine_with(const ScopeStack& other)
 {
-    for (std::size_t i = 0; i < this->size(); ++i) {
-        if (this->at(i).has_defined(v)) {
-            return i;
-        }
+    assert(other.size() == 1 && "Only a stack that has been fully resolved can be combined");
+
+    for (const auto& binding : other.bindings_) {
+        // The file's functions can change its variables without it being seen here
+        const auto combined = this->bind(other.names_[binding.symbol], binding.declaration);
+        bindings_[combined].changed = true;
     }
-    return {};
+}
+
+int ScopeStack::resolve(const Ast::Variable& v, Uses* uses)
+{
+    return this->locate(v, uses, false);
+}
+
+int ScopeStack::resolve_assignment(const Ast::Variable& v, Uses* uses)
+{
+    return this->locate(v, uses, true);
+}
+
+int ScopeStack::locate(const Ast::Variable& v, Uses* uses, bool assigned)
+{
+    const auto name = v.name.lexeme();
+
+    const auto it = symbols_.find(name);
+    const auto binding = it == symbols_.end() ? none : innermost_[it->second];
+
+    // Not defined anywhere, so bound when it's defined at the top level or never
+    if (binding == none) return global_location(globals_.slot(name));
+
+    const auto scope = bindings_[binding].scope;
+    if (scope == 0 && top_level_is_global_) return global_location(globals_.slot(name));
+
+    if (uses && bindings_[binding].declaration != no_declaration) {
+        ++(*uses)[bindings_[binding].declaration];
+    }
+    if (assigned) bindings_[binding].changed = true;
+
+    const auto current = static_cast<int>(scopes_.size() - 1);
+
+    // Variables defined inside the innermost function, or with no function in between, are found
+    // by depth
+    if (functions_.empty() || functions_.back().scope <= scope) {
+        return current - static_cast<int>(scope);
+    }
+
+    // A call's scope encloses just the top level of the file the function was defined in
+    if (scope == 0) return current - static_cast<int>(functions_.back().scope) + 1;
+
+    // Anything else is captured by each function it's used inside of
+    auto outermost = functions_.size() - 1;
+    while (outermost > 0 && functions_[outermost - 1].scope > scope) --outermost;
+
+    bindings_[binding].captured = true;
+    return captured_location(this->capture(binding, outermost, v.name));
+}
+
+std::size_t ScopeStack::capture(std::uint32_t binding, std::size_t function, const Token& name)
+{
+    // The outermost function finds the variable by depth from where it's created, each function
+    // inside it among the captures of the one it's created in
+    auto location = static_cast<int>(functions_[function].scope - 1 - bindings_[binding].scope);
+    std::size_t index = 0;
+    for (auto i = function; i < functions_.size(); ++i) {
+        auto& f = functions_[i];
+        const auto [it, inserted] = f.captured.try_emplace(binding, f.captures.size());
+        if (inserted) f.captures.push_back({name, location});
+        index = it->second;
+        location = captured_location(index);
+    }
+    return index;
 }
 
 struct Resolver : Ast::Expression::Visitor<void>, Ast::Statement::Visitor<void> {
-    Resolver(ScopeStack& ss, Locations& l)
-        : scopes_{ss}, locations_{l}
+    Resolver(ScopeStack& ss, Locations& l, Uses* u)
+        : scopes_{ss}, locations_{l}, uses_{u}
     {}
 
     Resolver(const Resolver&) = delete;
@@ -42,10 +146,13 @@ struct Resolver : Ast::Expression::Visitor<void>, Ast::Statement::Visitor<void>
     void resolve(const Ast::Ast& ast);
 
     void operator()(const Ast::Assign&) override;
+    void operator()(const Ast::AssignMember&) override;
     void operator()(const Ast::Binary&) override;
     void operator()(const Ast::Call&) override;
     void operator()(const Ast::Function&) override;
+    void operator()(const Ast::Get&) override;
     void operator()(const Ast::Grouping&) override;
+    void operator()(const Ast::Inlined&) override;
     void operator()(const Ast::Literal&) override;
     void operator()(const Ast::Logical&) override;
     void operator()(const Ast::Tuple&) override;
@@ -64,18 +171,23 @@ struct Resolver : Ast::Expression::Visitor<void>, Ast::Statement::Visitor<void>
 private:
     ScopeStack& scopes_;
     Locations& locations_;
+    Uses* uses_;
 };
 
 void Resolver::operator()(const Ast::Assign& a)
 {
     a.expression->accept(*this);
     for_each_variable(*a.variable, [this](const Ast::Variable& v) {
-        if (const auto location = scopes_.resolve(v)) {
-            locations_[v.id] = *location;
-        }
+        locations_[v.id] = scopes_.resolve_assignment(v, uses_);
     });
 }
 
+void Resolver::operator()(const Ast::AssignMember& a)
+{
+    a.object->accept(*this);
+    a.expression->accept(*this);
+}
+
 void Resolver::operator()(const Ast::Binary& b)
 {
     b.left->accept(*this);
@@ -93,12 +205,19 @@ void Resolver::operator()(const Ast::Call& c)
 
 void Resolver::operator()(const Ast::Function& f)
 {
-    scopes_.push();
+    scopes_.push_function();
     for (std::size_t i = 0; i < f.input.size(); ++i) {
-        scopes_.top().define(*f.input[i]);
+        scopes_.define(*f.input[i]);
     }
     f.body->accept(*this);
-    scopes_.pop();
+    f.captures = std::make_shared<const std::vector<Ast::Capture>>(
+        scopes_.pop_function(locations_));
+}
+
+void Resolver::operator()(const Ast::Get& g)
+{
+    // Members are looked up by name at runtime, only the object needs resolving
+    g.object->accept(*this);
 }
 
 void Resolver::operator()(const Ast::Grouping& g)
@@ -106,6 +225,22 @@ void Resolver::operator()(const Ast::Grouping& g)
     g.expression->accept(*this);
 }
 
+void Resolver::operator()(const Ast::Inlined& i)
+{
+    for (std::size_t j = 0; j < i.arguments.size(); ++j) {
+        i.arguments[j]->accept(*this);
+    }
+
+    // The inputs share a scope with the body's statements, unlike a function's
+    scopes_.push();
+    for (std::size_t j = 0; j < i.input.size(); ++j) {
+        scopes_.define(*i.input[j]);
+    }
+    this->resolve(i.body->statements);
+    if (i.result) (*i.result)->accept(*this);
+    scopes_.pop(locations_);
+}
+
 void Resolver::operator()(const Ast::Literal&)
 {
     // A literal expression doesn't mention any variables, nor does it contain
@@ -132,9 +267,7 @@ void Resolver::operator()(const Ast::Unary& u)
 
 void Resolver::operator()(const Ast::Variable& v)
 {
-    if (const auto location = scopes_.resolve(v)) {
-        locations_[v.id] = *location;
-    }
+    locations_[v.id] = scopes_.resolve(v, uses_);
 }
 
 void Resolver::operator()(const Ast::VariableTuple&)
@@ -147,7 +280,7 @@ void Resolver::operator()(const Ast::Block& b)
 {
     scopes_.push();
     this->resolve(b.statements);
-    scopes_.pop();
+    scopes_.pop(locations_);
 }
 
 void Resolver::operator()(const Ast::ExpressionStatement& es)
@@ -185,23 +318,37 @@ void Resolver::operator()(const Ast::Declaration& d)
         (*d.initializer)->accept(*this);
     }
 
-    scopes_.top().define(*d.variable);
+    scopes_.define(*d.variable);
+
+    // Variables declared at the top level are defined in their global slots, others are defined
+    // by name in the current environment
+    for_each_variable(*d.variable, [this](const Ast::Variable& v) {
+        if (const auto location = scopes_.resolve(v); is_global(location)) {
+            locations_[v.id] = location;
+        }
+    });
 }
 
 void Resolver::operator()(const Ast::Import& i)
 {
-    ScopeStack new_scopestack;
+    if (i.lazy) {
+        // The file hasn't been loaded yet, it is resolved on its own once it is
+        scopes_.define(**i.variable);
+        return;
+    }
+
+    ScopeStack new_scopestack{scopes_.globals(), false};
 
-    Resolver new_resolver{new_scopestack, locations_};
-    new_resolver.resolve(i.ast);
+    Resolver new_resolver{new_scopestack, locations_, uses_};
+    new_resolver.resolve(*i.ast);
 
     if (i.variable) {
         // If we are setting this to a variable, then all we need to do is define that variable
-        scopes_.top().define(**i.variable);
+        scopes_.define(**i.variable);
     } else {
         // If we are just straight up importing, then we need to add the root of the new scopestack
         // to the current scope
-        scopes_.top().combine_with(new_scopestack.bottom());
+        scopes_.combine_with(new_scopestack);
     }
 }
 
@@ -212,9 +359,9 @@ void Resolver::resolve(const Ast::Ast& ast)
     }
 }
 
-void resolve(const Ast::Ast& ast, ScopeStack& scopes, Locations& locations)
+void resolve(const Ast::Ast& ast, ScopeStack& scopes, Locations& locations, Uses* uses)
 {
-    Resolver r{scopes, locations};
+    Resolver r{scopes, locations, uses};
     r.resolve(ast);
 }
 
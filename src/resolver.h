@@ -1,46 +1,137 @@
 #pragma once
 
 #include "ast.h"
+#include "globals.h"
 #include <unordered_map>
 #include <string>
-#include <unordered_set>
-
-struct ScopeStack;
+#include <string_view>
+#include <deque>
+#include <vector>
+#include <cstdint>
+#include <climits>
 
+// Where each resolved variable lives, by the id of its Ast::Variable: either how many scopes out
+// from its use it's defined, for a global, its slot in the global table, or for a variable that a
+// function has captured from an enclosing scope, its index among the function's captures. Local
+// variables that closures share with the scope they're defined in are declared as boxed.
 using Locations = std::unordered_map<std::uint64_t, int>;
 
-struct Scope {
-    Scope() = default;
+// How many times each local variable is used, read or assigned, by the id of the Ast::Variable that
+// declares it. Variables that are never used have no entry.
+using Uses = std::unordered_map<std::uint64_t, int>;
 
-    void define(const Ast::VariableTuple&);
-    bool has_defined(const Ast::Variable&) const;
+// Global slots are stored as negative locations
+constexpr int global_location(std::size_t slot) { return -1 - static_cast<int>(slot); }
+constexpr bool is_global(int location) { return location < 0; }
+constexpr std::size_t global_slot(int location) { return static_cast<std::size_t>(-1 - location); }
 
-    void combine_with(const Scope&);
-private:
-    std::unordered_set<std::string> data_;
-};
+// Captures are stored above any depth a variable can be found at
+constexpr int first_captured_location = 1 << 24;
+constexpr int captured_location(std::size_t index)
+{
+    return first_captured_location + static_cast<int>(index);
+}
+constexpr bool is_captured(int location) { return location >= first_captured_location; }
+constexpr std::size_t captured_index(int location)
+{
+    return static_cast<std::size_t>(location - first_captured_location);
+}
+
+// The location of the declaration of a local variable that closures capture, but that can still
+// change afterwards, so that the closures share a box holding its value with the scope it's
+// defined in instead of copying the value
+constexpr int boxed_location = INT_MAX;
+
+// Names are interned as symbols, so that resolving a variable hashes its name once, however deeply
+// scopes are nested
+using Symbol = std::uint32_t;
 
 struct ScopeStack {
-    ScopeStack() { this->push(); }
+    // Names that aren't defined in any scope are given global slots. So are the variables defined
+    // in the outermost scope, if it's the program's top level rather than a file's own.
+    explicit ScopeStack(Globals& globals, bool top_level_is_global = true)
+        : globals_{globals}, top_level_is_global_{top_level_is_global}
+    {
+        this->push();
+    }
 
-    auto size() const { return data_.size(); }
+    Globals& globals() { return globals_; }
 
-    void push() { data_.emplace_back(); }
-    void pop() { data_.pop_back(); }
+    auto size() const { return scopes_.size(); }
 
-    Scope& top() { assert((!data_.empty())); return data_.back(); }
-    const Scope& top() const { assert((!data_.empty())); return data_.back(); }
+    void push() { scopes_.push_back(bindings_.size()); }
+    // Variables of the scope that have to be boxed are declared as boxed in the locations
+    void pop(Locations&);
 
-    Scope& bottom() { assert((!data_.empty())); return data_.front(); }
-    const Scope& bottom() const { assert((!data_.empty())); return data_.front(); }
+    // Functions push a scope for their inputs. Leaving the function returns the variables from
+    // enclosing scopes it uses.
+    void push_function();
+    std::vector<Ast::Capture> pop_function(Locations&);
 
-    std::optional<int> resolve(const Ast::Variable&) const;
+    // Defines the variables in the innermost scope
+    void define(const Ast::VariableTuple&);
+
+    // Defines everything defined in the outermost scope of another stack in the innermost scope,
+    // which is how a file imported without a name is brought into scope
+    void combine_with(const ScopeStack&);
+
+    // The variable's location, see Locations. If it's a local variable, the use is counted.
+    int resolve(const Ast::Variable&, Uses* uses = nullptr);
+    // The same, for a variable that's assigned to
+    int resolve_assignment(const Ast::Variable&, Uses* uses = nullptr);
 private:
-    Scope& at(std::size_t i) { return data_[data_.size() - i - 1]; }
-    const Scope& at(std::size_t i) const { return data_[data_.size() - i - 1]; }
+    static constexpr std::uint32_t none = UINT32_MAX;
 
-    std::vector<Scope> data_;
-};
+    struct Binding {
+        Symbol symbol;
+        std::uint32_t scope;
+        // The binding of the same symbol in an enclosing scope, or none
+        std::uint32_t shadowed;
+        // The id of the variable the binding was declared by, or no_declaration
+        std::uint64_t declaration;
+        // A variable that's captured by a closure and can change after it's defined is boxed
+        bool captured = false;
+        bool changed = false;
+    };
+
+    struct FunctionScope {
+        // The scope of the function's inputs
+        std::uint32_t scope;
+        std::vector<Ast::Capture> captures;
+        // The index of each captured binding among the captures
+        std::unordered_map<std::uint32_t, std::size_t> captured;
+    };
 
-void resolve(const Ast::Ast&, ScopeStack&, Locations&);
+    static constexpr std::uint64_t no_declaration = UINT64_MAX;
+
+    // Returns the index of the binding, which is the binding already there if the name is defined
+    // again in the same scope
+    std::uint32_t bind(std::string_view name, std::uint64_t declaration = no_declaration);
+
+    int locate(const Ast::Variable&, Uses*, bool assigned);
+
+    // The index of the binding in the captures of each function from the given one inwards, which
+    // are added as needed
+    std::size_t capture(std::uint32_t binding, std::size_t function, const Token& name);
+
+    Globals& globals_;
+    bool top_level_is_global_;
+
+    // The index of the first binding of each scope
+    std::vector<std::size_t> scopes_;
+
+    // Every binding in scope, outermost scope first
+    std::vector<Binding> bindings_;
+
+    // The innermost binding of each symbol, or none
+    std::vector<std::uint32_t> innermost_;
+
+    // The functions being resolved, outermost first
+    std::vector<FunctionScope> functions_;
+
+    // The names are copied, since the stack outlives the sources of some of the names it resolves
+    std::deque<std::string> names_;
+    std::unordered_map<std::string_view, Symbol> symbols_;
+};
 
+void resolve(const Ast::Ast&, ScopeStack&, Locations&, Uses* = nullptr);
@@ -3,41 +3,226 @@
 #include "error.h"
 
 #include <vector>
+#include <istream>
+#include <string>
+#include <algorithm>
+#include <array>
+#include <cstdint>
 #include <optional>
-#include <unordered_map>
 #include <utility>
 #include <cassert>
 
+// Runs of characters (whitespace, comments, strings, identifiers and numbers) are classified 16 at
+// a time with SSE2 where it's available. Define ALBION_NO_SIMD to only use the scalar code, which
+// produces the same tokens.
+#if defined(__SSE2__) && !defined(ALBION_NO_SIMD)
+#define ALBION_SCANNER_SSE2
+#include <emmintrin.h>
+#endif
+
 namespace {
 
-std::optional<Token::Type> keyword_to_token_type(const std::string_view s)
+// Keywords are found with a perfect hash of an identifier's length and its first, second and last
+// characters. The multiplier is searched for at compile time, so adding a keyword to the list in
+// token.h just works, or fails to compile if no multiplier is found.
+constexpr unsigned keyword_table_bits = 6;
+constexpr std::size_t keyword_table_size = std::size_t{1} << keyword_table_bits;
+
+constexpr std::size_t min_keyword_length = [] {
+    std::size_t length = Token::max_length;
+    for (const auto& keyword : keywords) length = std::min(length, keyword.lexeme.size());
+    return length;
+}();
+
+constexpr std::size_t max_keyword_length = [] {
+    std::size_t length = 0;
+    for (const auto& keyword : keywords) length = std::max(length, keyword.lexeme.size());
+    return length;
+}();
+
+static_assert(min_keyword_length >= 2, "The hash reads the first two characters");
+
+constexpr std::size_t keyword_hash(const std::string_view s, const std::uint32_t multiplier)
+{
+    const auto key = static_cast<std::uint32_t>(static_cast<unsigned char>(s[0])) |
+                     static_cast<std::uint32_t>(static_cast<unsigned char>(s[1])) << 8 |
+                     static_cast<std::uint32_t>(static_cast<unsigned char>(s.back())) << 16 |
+                     static_cast<std::uint32_t>(s.size()) << 24;
+    return static_cast<std::uint32_t>(key * multiplier) >> (32 - keyword_table_bits);
+}
+
+// Zero if there isn't one within a reasonable number of tries
+constexpr std::uint32_t find_keyword_multiplier()
+{
+    for (std::uint32_t multiplier = 0x9e3779b1; multiplier < 0x9e3779b1 + 2 * 10000;
+         multiplier += 2) {
+        std::array<bool, keyword_table_size> used{};
+        bool perfect = true;
+        for (const auto& keyword : keywords) {
+            auto& slot = used[keyword_hash(keyword.lexeme, multiplier)];
+            if (slot) {
+                perfect = false;
+                break;
+            }
+            slot = true;
+        }
+        if (perfect) return multiplier;
+    }
+    return 0;
+}
+
+constexpr std::uint32_t keyword_multiplier = find_keyword_multiplier();
+static_assert(keyword_multiplier != 0, "No perfect hash found for the keywords");
+
+struct KeywordTable {
+    // Empty lexemes in unused slots, which never equal an identifier
+    std::array<std::string_view, keyword_table_size> lexemes{};
+    std::array<Token::Type, keyword_table_size> types{};
+};
+
+constexpr KeywordTable keyword_table = [] {
+    KeywordTable table;
+    for (const auto& keyword : keywords) {
+        const auto slot = keyword_hash(keyword.lexeme, keyword_multiplier);
+        table.lexemes[slot] = keyword.lexeme;
+        table.types[slot] = keyword.type;
+    }
+    return table;
+}();
+
+// Identifier if the string isn't a keyword, after at most one string comparison
+Token::Type identifier_type(const std::string_view s) noexcept
 {
-    static const std::unordered_map<std::string_view, Token::Type> map{
-        {"and", Token::Type::k_and},       {"class", Token::Type::k_class},
-        {"else", Token::Type::k_else},     {"false", Token::Type::k_false},
-        {"fun", Token::Type::k_fun},       {"for", Token::Type::k_for},
-        {"if", Token::Type::k_if},         {"nil", Token::Type::k_nil},
-        {"or", Token::Type::k_or},         {"return", Token::Type::k_return},
-        {"super", Token::Type::k_super},   {"this", Token::Type::k_this},
-        {"true", Token::Type::k_true},     {"var", Token::Type::k_var},
-        {"while", Token::Type::k_while},   {"import", Token::Type::k_import},
-        {"as", Token::Type::k_as}
-    };
-
-    const auto it = map.find(s);
-
-    if (it == map.end()) {
-        return {};
-    } else {
-        return it->second;
+    if (s.size() < min_keyword_length || s.size() > max_keyword_length) {
+        return Token::Type::identifier;
     }
+
+    const auto slot = keyword_hash(s, keyword_multiplier);
+    return keyword_table.lexemes[slot] == s ? keyword_table.types[slot] : Token::Type::identifier;
+}
+
+#ifdef ALBION_SCANNER_SSE2
+
+using Block = __m128i;
+constexpr std::size_t block_size = sizeof(Block);
+
+Block load_block(const char* p) noexcept
+{
+    return _mm_loadu_si128(reinterpret_cast<const Block*>(p));
+}
+
+// A bit per character of the block, set where the character is c
+unsigned equal_mask(Block b, char c) noexcept
+{
+    return static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(b, _mm_set1_epi8(c))));
 }
 
+// Bytes outside of ASCII are negative as signed chars, so they're never in an ASCII range
+Block in_range(Block b, char low, char high) noexcept
+{
+    return _mm_and_si128(_mm_cmpgt_epi8(b, _mm_set1_epi8(static_cast<char>(low - 1))),
+                         _mm_cmplt_epi8(b, _mm_set1_epi8(static_cast<char>(high + 1))));
 }
 
+#endif
+
+// Classes of characters that make up runs. Each tests a single character, and with SSE2 a block
+// of characters at once, giving a bit per character. None depend on the locale, and every byte
+// outside of ASCII is outside of every class.
+
+struct Whitespace {
+    static bool contains(char c) noexcept {
+        return c == ' ' || c == '\r' || c == '\t' || c == '\n';
+    }
+#ifdef ALBION_SCANNER_SSE2
+    static unsigned contains(Block b) noexcept {
+        return equal_mask(b, ' ') | equal_mask(b, '\r') | equal_mask(b, '\t') |
+               equal_mask(b, '\n');
+    }
+#endif
+};
+
+struct Digit {
+    static bool contains(char c) noexcept {
+        return c >= '0' && c <= '9';
+    }
+#ifdef ALBION_SCANNER_SSE2
+    static unsigned contains(Block b) noexcept {
+        return static_cast<unsigned>(_mm_movemask_epi8(in_range(b, '0', '9')));
+    }
+#endif
+};
+
+struct Alpha {
+    static bool contains(char c) noexcept {
+        const char lower = c | 0x20;
+        return lower >= 'a' && lower <= 'z';
+    }
+};
+
+struct Alphanumeric {
+    static bool contains(char c) noexcept {
+        return Digit::contains(c) || Alpha::contains(c);
+    }
+#ifdef ALBION_SCANNER_SSE2
+    static unsigned contains(Block b) noexcept {
+        const auto lower = _mm_or_si128(b, _mm_set1_epi8(0x20));
+        return static_cast<unsigned>(
+            _mm_movemask_epi8(_mm_or_si128(in_range(b, '0', '9'), in_range(lower, 'a', 'z'))));
+    }
+#endif
+};
+
+// Anything but the given character
+template <char C>
+struct AllBut {
+    static bool contains(char c) noexcept {
+        return c != C;
+    }
+#ifdef ALBION_SCANNER_SSE2
+    static unsigned contains(Block b) noexcept {
+        return ~equal_mask(b, C) & 0xffffu;
+    }
+#endif
+};
+
+// The position of the first character from the given one that isn't in the class
+template <typename Class>
+std::size_t span(std::string_view s, std::size_t position) noexcept
+{
+#ifdef ALBION_SCANNER_SSE2
+    // Many runs, such as the whitespace between tokens, are empty or a single character long
+    if (position < s.size() && !Class::contains(s[position])) return position;
+
+    for (; position + block_size <= s.size(); position += block_size) {
+        const auto outside = ~Class::contains(load_block(s.data() + position)) & 0xffffu;
+        if (outside != 0) return position + __builtin_ctz(outside);
+    }
+#endif
+    while (position < s.size() && Class::contains(s[position])) ++position;
+    return position;
+}
+
+unsigned count_newlines(std::string_view s) noexcept
+{
+    unsigned count = 0;
+    std::size_t i = 0;
+#ifdef ALBION_SCANNER_SSE2
+    for (; i + block_size <= s.size(); i += block_size) {
+        count += __builtin_popcount(equal_mask(load_block(s.data() + i), '\n'));
+    }
+#endif
+    for (; i < s.size(); ++i) count += s[i] == '\n';
+    return count;
+}
+
+}  // Namespace
+
 struct ScanData {
-    ScanData(std::string_view source, std::function<void(const ScanError&)> report_error)
-        : source_{source}, report_error_{report_error}
+    ScanData(std::string_view source, std::function<void(const ScanError&)> report_error,
+             unsigned position = 0, unsigned line_number = 1)
+        : source_{source}, report_error_{report_error}, line_number_{line_number},
+          position_{position}
     {}
     ScanData(const ScanData&) = delete;
     ScanData(ScanData&&) = delete;
@@ -48,20 +233,30 @@ struct ScanData {
     char advance() noexcept;
     void retreat() noexcept;
 
-    void increment_line_number() noexcept;
     unsigned line_number() const noexcept;
 
+    unsigned position() const noexcept;
+
+    // The source from the given position up to the current one
+    std::string_view text_from(unsigned start) const;
+
     bool match(char expected) const noexcept;
     bool match_advance(char expected) noexcept;
 
+    // Advances past a run of characters of the class, which mustn't contain new lines
+    template <typename Class> void skip() noexcept;
+
+    // Advances past a run of characters of the class, counting new lines in it
+    template <typename Class> void skip_lines() noexcept;
+
     void report_error(const ScanError& e) const;
 private:
     bool increment_position(int i = 1) noexcept;
 
     const std::string_view source_;
     const std::function<void(const ScanError&)> report_error_;
-    unsigned line_number_ = 1;
-    unsigned position_ = 0;
+    unsigned line_number_;
+    unsigned position_;
 };
 
 char ScanData::read() const noexcept
@@ -93,14 +288,22 @@ void ScanData::retreat() noexcept
     this->increment_position(-1);
 }
 
-void ScanData::increment_line_number() noexcept
+unsigned ScanData::line_number() const noexcept
 {
-    ++line_number_;
+    return line_number_;
 }
 
-unsigned ScanData::line_number() const noexcept
+unsigned ScanData::position() const noexcept
 {
-    return line_number_;
+    return position_;
+}
+
+std::string_view ScanData::text_from(unsigned start) const
+{
+    if (position_ - start > Token::max_length) {
+        throw ScanError{line_number_, "token is too long"};
+    }
+    return source_.substr(start, position_ - start);
 }
 
 bool ScanData::match(char expected) const noexcept
@@ -125,6 +328,22 @@ void ScanData::report_error(const ScanError& e) const
     report_error_(e);
 }
 
+template <typename Class>
+void ScanData::skip() noexcept
+{
+    position_ = static_cast<unsigned>(span<Class>(source_, position_));
+}
+
+template <typename Class>
+void ScanData::skip_lines() noexcept
+{
+    const auto end = span<Class>(source_, position_);
+    if (end == position_) return;
+
+    line_number_ += count_newlines(source_.substr(position_, end - position_));
+    position_ = static_cast<unsigned>(end);
+}
+
 bool ScanData::increment_position(int i) noexcept
 {
     if (position_ + i > source_.length()) return false;
@@ -136,14 +355,9 @@ Token scan_string(ScanData& data)
 {
     assert(data.match('"') && "Strings must start with \"");
 
+    const auto start = data.position();
     data.match_advance('"');
-
-    std::string str;
-
-    while (!data.match('"') && !data.is_at_end()) {
-        if (data.match('\n')) data.increment_line_number();
-        str.push_back(data.advance());
-    }
+    data.skip_lines<AllBut<'"'>>();
 
     if (data.is_at_end()) {
         throw ScanError{data.line_number(), "unterminated string"};
@@ -151,129 +365,108 @@ Token scan_string(ScanData& data)
 
     data.match_advance('"');
 
-    return Token{Token::Type::string, "\"" + str + "\"", str, data.line_number()};
+    return Token{Token::Type::string, data.text_from(start), data.line_number()};
 }
 
 Token scan_number(ScanData& data)
 {
-    assert(std::isdigit(data.read()) && "Numbers must start with digits");
+    assert(Digit::contains(data.read()) && "Numbers must start with digits");
 
-    std::string str;
-    str.push_back(data.advance());
-
-    while (std::isdigit(data.read())) {
-        str.push_back(data.advance());
-    }
+    const auto start = data.position();
+    data.advance();
+    data.skip<Digit>();
 
     // Look for fractional part
-    if (data.match('.') && std::isdigit(data.read_next())) {
-        str.push_back(data.advance());
-        while (std::isdigit(data.read())) {
-            str.push_back(data.advance());
-        }
+    if (data.match('.') && Digit::contains(data.read_next())) {
+        data.advance();
+        data.skip<Digit>();
     }
 
-    const double literal = std::stod(str);
-    return Token{Token::Type::number, std::move(str), literal, data.line_number()};
+    return Token{Token::Type::number, data.text_from(start), data.line_number()};
 }
 
 Token scan_identifier(ScanData& data)
 {
-    assert(std::isalpha(data.read()) && "Identifiers must start with a letter");
+    assert(Alpha::contains(data.read()) && "Identifiers must start with a letter");
 
-    std::string str;
-    str.push_back(data.advance());
+    const auto start = data.position();
+    data.advance();
+    data.skip<Alphanumeric>();
 
-    while (std::isalnum(data.read())) {
-        str.push_back(data.advance());
-    }
-
-    const auto type = keyword_to_token_type(str).value_or(Token::Type::identifier);
-
-    const auto literal = [type]() -> std::optional<ObjectReference> {
-        switch (type) {
-            case Token::Type::k_nil: return nullptr;
-            case Token::Type::k_true: return true;
-            case Token::Type::k_false: return false;
-            default: return {};
-        };
-    }();
-
-    return Token{type, str, literal, data.line_number()};
+    const auto str = data.text_from(start);
+    return Token{identifier_type(str), str, data.line_number()};
 }
 
 Token scan_token(ScanData& data)
 {
-    const auto make_token = [&data](Token::Type tt, std::string str) {
-        return Token{tt, std::move(str), {}, data.line_number()};
-    };
+    // Whitespace and comments are skipped until a token is found
+    while (true) {
+        data.skip_lines<Whitespace>();
 
-    if (data.is_at_end()) {
-        return Token(Token::Type::eof, "", {}, data.line_number());
-    }
+        if (data.is_at_end()) {
+            return Token(Token::Type::eof, {}, data.line_number());
+        }
 
-    const char ch = data.advance();
-
-    switch (ch) {
-        case '(': return make_token(Token::Type::left_paren,  "(");
-        case ')': return make_token(Token::Type::right_paren, ")");
-        case '{': return make_token(Token::Type::left_brace,  "{");
-        case '}': return make_token(Token::Type::right_brace, "}");
-        case ',': return make_token(Token::Type::comma,       ",");
-        case '.': return make_token(Token::Type::dot,         ".");
-        case '+': return make_token(Token::Type::plus,        "+");
-        case ';': return make_token(Token::Type::semicolon,   ";");
-        case '*': return make_token(Token::Type::star,        "*");
-        case '-':
-            return data.match_advance('>') ? make_token(Token::Type::send, "->")
-                                           : make_token(Token::Type::minus, "-");
-        case '!':
-            return data.match_advance('=') ? make_token(Token::Type::bang_equal, "!=")
-                                           : make_token(Token::Type::bang, "!");
-        case '=':
-            return data.match_advance('=') ? make_token(Token::Type::equal_equal, "==")
-                                           : make_token(Token::Type::equal, "=");
-        case '<':
-            return data.match_advance('=') ? make_token(Token::Type::less_equal, "<=")
-                                           : make_token(Token::Type::less, "<");
-        case '>':
-            return data.match_advance('=') ? make_token(Token::Type::greater_equal, ">=")
-                                           : make_token(Token::Type::greater, ">");
-        case '/': {
-            if (data.match_advance('/')) {
-                // A comment goes until the end of the line
-                while (!data.match('\n') && !data.is_at_end()) data.advance();
-                break;
-            } else {
-                return make_token(Token::Type::slash, "/");
+        const auto start = data.position();
+        const auto make_token = [&data, start](Token::Type tt) {
+            return Token{tt, data.text_from(start), data.line_number()};
+        };
+
+        const char ch = data.advance();
+
+        switch (ch) {
+            case '(': return make_token(Token::Type::left_paren);
+            case ')': return make_token(Token::Type::right_paren);
+            case '{': return make_token(Token::Type::left_brace);
+            case '}': return make_token(Token::Type::right_brace);
+            case ',': return make_token(Token::Type::comma);
+            case '.': return make_token(Token::Type::dot);
+            case '+': return make_token(Token::Type::plus);
+            case ';': return make_token(Token::Type::semicolon);
+            case '*': return make_token(Token::Type::star);
+            case ':': return make_token(Token::Type::colon);
+            case '|': return make_token(Token::Type::pipe);
+            case '@': return make_token(Token::Type::at);
+            case '-':
+                return data.match_advance('>') ? make_token(Token::Type::send)
+                                               : make_token(Token::Type::minus);
+            case '!':
+                return data.match_advance('=') ? make_token(Token::Type::bang_equal)
+                                               : make_token(Token::Type::bang);
+            case '=':
+                return data.match_advance('=') ? make_token(Token::Type::equal_equal)
+                                               : make_token(Token::Type::equal);
+            case '<':
+                return data.match_advance('=') ? make_token(Token::Type::less_equal)
+                                               : make_token(Token::Type::less);
+            case '>':
+                return data.match_advance('=') ? make_token(Token::Type::greater_equal)
+                                               : make_token(Token::Type::greater);
+            case '/': {
+                if (data.match_advance('/')) {
+                    // A comment goes until the end of the line
+                    data.skip<AllBut<'\n'>>();
+                    continue;
+                } else {
+                    return make_token(Token::Type::slash);
+                }
             }
-        }
-        case ' ':
-        case '\r':
-        case '\t':
-            break;
-        case '\n':
-            data.increment_line_number();
-            break;
-        case '"':
-            data.retreat();
-            return scan_string(data);
-        default: {
-            if (std::isdigit(ch)) {
-                data.retreat();
-                return scan_number(data);
-            } else if (std::isalpha(ch)) {
+            case '"':
                 data.retreat();
-                return scan_identifier(data);
-            } else {
-                throw ScanError(data.line_number(), "unexpected character");
+                return scan_string(data);
+            default: {
+                if (Digit::contains(ch)) {
+                    data.retreat();
+                    return scan_number(data);
+                } else if (Alpha::contains(ch)) {
+                    data.retreat();
+                    return scan_identifier(data);
+                } else {
+                    throw ScanError(data.line_number(), "unexpected character");
+                }
             }
         }
     }
-
-    // If we get here, it means we couldn't scan a token but encountered something like a comment
-    // or a new line. Therefore we try again.
-    return scan_token(data);
 }
 
 std::vector<Token> scan(const std::string_view source,
@@ -284,16 +477,82 @@ std::vector<Token> scan(const std::string_view source,
 
     while (true) {
         try {
-            const auto token = scan_token(data);
-
-            tokens.push_back(token);
-            if (token.type == Token::Type::eof) break;
+            tokens.push_back(scan_token(data));
+            if (tokens.back().type == Token::Type::eof) break;
         }
         catch (const ScanError& e) {
             data.report_error(e);
         }
     }
 
+    // The tokens of a large file take up more memory than its source, and are kept until it's
+    // parsed, so the slack left from growing the vector is given back
+    tokens.shrink_to_fit();
     return tokens;
 }
 
+
+TokenStream::TokenStream(std::istream& input, std::function<void(const ScanError&)> report_error)
+    : input_{input}, report_error_{report_error}
+{
+    this->read_chunk();
+}
+
+Token TokenStream::next()
+{
+    while (true) {
+        // Errors are only reported once it's known that the token isn't cut short by the end of
+        // the chunk
+        std::optional<ScanError> error;
+        ScanData data{*chunk_, {}, position_, line_number_};
+        std::optional<Token> token;
+        try {
+            token = scan_token(data);
+        }
+        catch (const ScanError& e) {
+            error = e;
+        }
+
+        // The scanner looks up to two characters past the end of a token, for a number's
+        // fractional part
+        if (data.position() + 2 > chunk_->size() && !input_done_) {
+            this->read_chunk();
+            continue;
+        }
+
+        position_ = data.position();
+        line_number_ = data.line_number();
+
+        if (error) {
+            report_error_(*error);
+            continue;
+        }
+        return *token;
+    }
+}
+
+std::vector<Source> TokenStream::take_sources()
+{
+    auto sources = std::move(sources_);
+    sources_ = {chunk_};
+    return sources;
+}
+
+void TokenStream::read_chunk()
+{
+    // The rest of the current chunk is copied to the start of the next, so that tokens are never
+    // split between chunks. Long tokens make the chunks grow, doubling each time.
+    std::string text;
+    if (chunk_) text = chunk_->substr(position_);
+    const auto read_size = std::max(chunk_size, text.size());
+    const auto kept_size = text.size();
+
+    text.resize(kept_size + read_size);
+    input_.read(text.data() + kept_size, static_cast<std::streamsize>(read_size));
+    text.resize(kept_size + static_cast<std::size_t>(input_.gcount()));
+    input_done_ = !input_;
+
+    chunk_ = std::make_shared<const std::string>(std::move(text));
+    position_ = 0;
+    sources_.push_back(chunk_);
+}
@@ -3,9 +3,40 @@
 #include "token.h"
 #include "error.h"
 
-#include <vector>
+#include <cstddef>
 #include <functional>
+#include <istream>
+#include <vector>
 
+// The tokens refer to the source rather than copying it, so it must outlive them
 std::vector<Token> scan(const std::string_view source,
                         std::function<void(const ScanError&)> report_error);
 
+// Scans tokens one at a time, reading the input in chunks as they're needed, so that the whole
+// input is never in memory at once. Errors are reported as they're found.
+struct TokenStream {
+    TokenStream(std::istream& input, std::function<void(const ScanError&)> report_error);
+    TokenStream(const TokenStream&) = delete;
+    TokenStream(TokenStream&&) = delete;
+
+    // Returns eof tokens once the input is used up
+    Token next();
+
+    // The chunks of input that the tokens returned since the last call refer to. The stream only
+    // keeps the current chunk, so the others are freed once the caller is done with them.
+    std::vector<Source> take_sources();
+private:
+    static constexpr std::size_t chunk_size = 64 * 1024;
+
+    void read_chunk();
+
+    std::istream& input_;
+    const std::function<void(const ScanError&)> report_error_;
+    bool input_done_ = false;
+
+    std::shared_ptr<const std::string> chunk_;
+    unsigned position_ = 0;
+    unsigned line_number_ = 1;
+
+    std::vector<Source> sources_;
+};
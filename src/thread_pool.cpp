@@ -0,0 +1,55 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(std::size_t thread_count)
+{
+    threads_.reserve(thread_count);
+    for (std::size_t i = 0; i < thread_count; ++i) {
+        threads_.emplace_back([this] { this->work(); });
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        const std::lock_guard<std::mutex> lock{mutex_};
+        stopping_ = true;
+    }
+    task_available_.notify_all();
+
+    for (auto& thread : threads_) {
+        thread.join();
+    }
+}
+
+void ThreadPool::submit(std::function<void()> task)
+{
+    {
+        const std::lock_guard<std::mutex> lock{mutex_};
+        tasks_.push_back(std::move(task));
+    }
+    task_available_.notify_one();
+}
+
+std::size_t ThreadPool::default_thread_count() noexcept
+{
+    // Zero if it can't be determined
+    return std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+void ThreadPool::work()
+{
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock{mutex_};
+            task_available_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+            if (stopping_) return;
+
+            task = std::move(tasks_.front());
+            tasks_.pop_front();
+        }
+        task();
+    }
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed number of threads running submitted tasks in the order they were submitted. Tasks that
+// haven't started when the pool is destroyed are dropped.
+struct ThreadPool {
+    explicit ThreadPool(std::size_t thread_count = default_thread_count());
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool(ThreadPool&&) = delete;
+    ~ThreadPool();
+
+    // Can be called from within a task
+    void submit(std::function<void()> task);
+
+    static std::size_t default_thread_count() noexcept;
+private:
+    void work();
+
+    std::mutex mutex_;
+    std::condition_variable task_available_;
+    std::deque<std::function<void()>> tasks_;
+    bool stopping_ = false;
+
+    std::vector<std::thread> threads_;
+};
@@ -2,18 +2,21 @@
 
 #include "object.h"
 
+#include <memory>
 #include <string>
+#include <string_view>
 #include <sstream>
 #include <cassert>
 #include <algorithm>
 #include <variant>
 #include <optional>
+#include <cstdint>
 
 struct Token {
-    enum class Type {
+    enum class Type : std::uint8_t {
         // Single character tokens
         left_paren, right_paren, left_brace, right_brace,
-        comma, dot, minus, plus, semicolon, slash, star,
+        comma, dot, minus, plus, semicolon, slash, star, colon, pipe, at,
 
         // One or two character tokens
         bang, bang_equal, equal, equal_equal,
@@ -30,16 +33,65 @@ struct Token {
         eof
     };
 
-    Token(Type t, std::string lex, std::optional<ObjectReference> lit, unsigned l)
-        : type{t}, lexeme{std::move(lex)}, literal{std::move(lit)}, line{l}
-    {}
+    // The scanner reports an error for longer lexemes
+    static constexpr std::size_t max_length = (1u << 24) - 1;
 
-    Type type;
-    std::string lexeme;
-    std::optional<ObjectReference> literal;
+    Token(Type t, std::string_view lex, unsigned l) noexcept
+        : type{t}, length{static_cast<std::uint32_t>(lex.size())}, line{l}, text{lex.data()}
+    {
+        assert(lex.size() <= max_length && "Lexeme is too long to be represented");
+    }
+
+    std::string_view lexeme() const noexcept {
+        return {text, length};
+    }
+
+    // Tokens are copied into every ast node that needs one, so they're kept to 16 bytes. The
+    // lexeme refers to the text the token was scanned from rather than copying it, see Source.
+    Type type : 8;
+    std::uint32_t length : 24;
     unsigned line;
+    const char* text;
+};
+
+static_assert(sizeof(void*) != 8 || sizeof(Token) == 16);
+
+struct Keyword {
+    std::string_view lexeme;
+    Token::Type type;
+};
+
+// Every identifier the scanner turns into a keyword token
+constexpr Keyword keywords[] = {
+    {"and", Token::Type::k_and},       {"class", Token::Type::k_class},
+    {"else", Token::Type::k_else},     {"false", Token::Type::k_false},
+    {"fun", Token::Type::k_fun},       {"for", Token::Type::k_for},
+    {"if", Token::Type::k_if},         {"nil", Token::Type::k_nil},
+    {"or", Token::Type::k_or},         {"return", Token::Type::k_return},
+    {"super", Token::Type::k_super},   {"this", Token::Type::k_this},
+    {"true", Token::Type::k_true},     {"var", Token::Type::k_var},
+    {"while", Token::Type::k_while},   {"import", Token::Type::k_import},
+    {"as", Token::Type::k_as}
 };
 
+// Owns text that tokens are scanned from, such as a string or a mapped file. Tokens (and so asts)
+// refer to the text rather than copying it, so it has to be kept alive for as long as they are
+// used.
+using Source = std::shared_ptr<const void>;
+
+// The value of a string, number, true, false or nil token, decoded from its lexeme
+inline std::optional<ObjectReference> literal_value(const Token& token) {
+    switch (token.type) {
+        case Token::Type::string:
+            return std::string{token.lexeme().substr(1, token.lexeme().size() - 2)};
+        case Token::Type::number: return std::stod(std::string{token.lexeme()});
+        case Token::Type::k_true: return true;
+        case Token::Type::k_false: return false;
+        case Token::Type::k_nil: return nullptr;
+        default: return {};
+    }
+}
+
 inline std::string to_string(const Token::Type tt) {
     switch (tt) {
         case Token::Type::left_paren: return "left paren";
@@ -53,6 +105,9 @@ inline std::string to_string(const Token::Type tt) {
         case Token::Type::semicolon: return "semicolon";
         case Token::Type::slash: return "slash";
         case Token::Type::star: return "star";
+        case Token::Type::colon: return "colon";
+        case Token::Type::pipe: return "pipe";
+        case Token::Type::at: return "at";
         case Token::Type::bang: return "bang";
         case Token::Type::bang_equal: return "bang_equal";
         case Token::Type::equal: return "equal";
@@ -93,11 +148,11 @@ inline std::string to_string(const Token& token) {
     const auto token_type_str = to_string(token.type);
     const auto spaces = std::string(13 - token_type_str.size(), ' ');
 
-    auto str = token_type_str + spaces + " -- " + token.lexeme;
+    auto str = token_type_str + spaces + " -- " + std::string{token.lexeme()};
 
-    if (token.literal) {
-        str += std::string(std::max(5 - static_cast<int>(token.lexeme.size()), 0), ' ') + " -- " +
-               to_string(*token.literal);
+    if (const auto literal = literal_value(token)) {
+        const auto padding = std::max(5 - static_cast<int>(token.length), 0);
+        str += std::string(padding, ' ') + " -- " + to_string(*literal);
     }
     return str;
 }
@@ -0,0 +1,559 @@
+#include "type_inference.h"
+#include "pass_helpers.h"
+#include "object.h"
+
+#include <algorithm>
+#include <cassert>
+#include <string_view>
+#include <unordered_set>
+
+namespace {
+
+const char* type_name(Ast::Type type)
+{
+    switch (type) {
+        case Ast::Type::number: return "number";
+        case Ast::Type::boolean: return "boolean";
+        case Ast::Type::string: return "string";
+        default: return "unknown";
+    }
+}
+
+Ast::Type type_of(const ObjectReference& o)
+{
+    if (o.holds<double>()) return Ast::Type::number;
+    if (o.holds<bool>()) return Ast::Type::boolean;
+    if (o.holds<std::string>()) return Ast::Type::string;
+    return Ast::Type::unknown;
+}
+
+// The types of the variables in scope at one point of the program. Variables are bound by name,
+// the same way the resolver binds them.
+struct State {
+    struct Binding {
+        std::string_view name;
+        Ast::Type type;
+        // Variables closures can change are bound, so that they shadow others, but not followed
+        bool tracked;
+    };
+
+    struct Scope {
+        std::size_t first_binding;
+        // A file imported into the scope without a name can have defined any name in it
+        bool opaque;
+    };
+
+    std::vector<Binding> bindings;
+    std::vector<Scope> scopes;
+};
+
+bool operator==(const State& a, const State& b)
+{
+    const auto same_binding = [](const State::Binding& x, const State::Binding& y) {
+        return x.name == y.name && x.type == y.type && x.tracked == y.tracked;
+    };
+    const auto same_scope = [](const State::Scope& x, const State::Scope& y) {
+        return x.first_binding == y.first_binding && x.opaque == y.opaque;
+    };
+    return std::equal(a.bindings.begin(), a.bindings.end(), b.bindings.begin(), b.bindings.end(),
+                      same_binding) &&
+           std::equal(a.scopes.begin(), a.scopes.end(), b.scopes.begin(), b.scopes.end(),
+                      same_scope);
+}
+
+// The state after taking either of two ways from the same point, which only keeps what's true
+// after both. Either way can only have added bindings to the innermost scope, by importing a file
+// with a name, and those are kept without being followed.
+State merge(const State& a, const State& b)
+{
+    assert(a.scopes.size() == b.scopes.size());
+
+    State merged;
+    merged.scopes = a.scopes;
+    for (std::size_t i = 0; i < merged.scopes.size(); ++i) {
+        merged.scopes[i].opaque = a.scopes[i].opaque || b.scopes[i].opaque;
+    }
+
+    std::size_t i = 0;
+    for (; i < a.bindings.size() && i < b.bindings.size(); ++i) {
+        if (a.bindings[i].name != b.bindings[i].name) break;
+        auto binding = a.bindings[i];
+        binding.tracked = binding.tracked && b.bindings[i].tracked;
+        if (binding.type != b.bindings[i].type) binding.type = Ast::Type::unknown;
+        merged.bindings.push_back(binding);
+    }
+    for (const auto* added : {&a.bindings, &b.bindings}) {
+        for (auto j = i; j < added->size(); ++j) {
+            merged.bindings.push_back({(*added)[j].name, Ast::Type::unknown, false});
+        }
+    }
+    return merged;
+}
+
+struct TypeInference : Ast::Expression::Visitor<void>, Ast::Statement::Visitor<void> {
+    TypeInference(const Locations& l, std::vector<std::string>* r, LoopEntryTypes* loops)
+        : locations_{l}, report_{r}, loops_{loops}
+    {}
+
+    // Infers the types in the top level of a file
+    void infer(const Ast::Ast&);
+
+    void write_report() const;
+
+    void operator()(const Ast::Assign&) override;
+    void operator()(const Ast::AssignMember&) override;
+    void operator()(const Ast::Binary&) override;
+    void operator()(const Ast::Call&) override;
+    void operator()(const Ast::Function&) override;
+    void operator()(const Ast::Get&) override;
+    void operator()(const Ast::Grouping&) override;
+    void operator()(const Ast::Inlined&) override;
+    void operator()(const Ast::Literal&) override;
+    void operator()(const Ast::Logical&) override;
+    void operator()(const Ast::Tuple&) override;
+    void operator()(const Ast::Unary&) override;
+    void operator()(const Ast::Variable&) override;
+    void operator()(const Ast::VariableTuple&) override;
+
+    void operator()(const Ast::Block&) override;
+    void operator()(const Ast::ExpressionStatement&) override;
+    void operator()(const Ast::If&) override;
+    void operator()(const Ast::Return&) override;
+    void operator()(const Ast::While&) override;
+    void operator()(const Ast::Declaration&) override;
+    void operator()(const Ast::Import&) override;
+private:
+    void push() { state_.scopes.push_back({state_.bindings.size(), false}); }
+    void pop();
+
+    // Returns whether the variable is followed
+    bool declare(const Ast::Variable&, Ast::Type);
+    // The binding of a variable that's followed, or null
+    State::Binding* find(const Ast::Variable&);
+    // The operand of an operator that only accepts the given type has that type after it's used
+    void refine(const Ast::Expression& operand, Ast::Type);
+
+    void add_to_report(const Ast::Expression&, unsigned line, std::string_view label);
+    void record_entry(const Ast::While&);
+
+    const Locations& locations_;
+    std::vector<std::string>* report_;
+    LoopEntryTypes* loops_;
+
+    State state_;
+
+    // The scopes before this one are the top level of the file, whose variables can be changed by
+    // any call, or belong to the functions enclosing the one being inferred
+    std::size_t first_local_scope_ = 1;
+
+    // Counts the assignments inferred so far, to tell whether an operand was assigned by the other
+    std::size_t assignments_ = 0;
+
+    // Files imported from several places share one ast, which only needs inferring once
+    std::unordered_set<const Ast::Ast*> imports_;
+
+    // Each expression that's reported, in the order they're first reached. Since loops are
+    // inferred until their types settle, the types are only read once everything is inferred.
+    struct Reported {
+        const Ast::Expression* expression;
+        unsigned line;
+        std::string_view label;
+    };
+    std::vector<Reported> reported_;
+    std::unordered_set<const Ast::Expression*> reported_expressions_;
+};
+
+void TypeInference::infer(const Ast::Ast& statements)
+{
+    auto state = std::move(state_);
+    const auto first_local_scope = first_local_scope_;
+    state_ = State{};
+    first_local_scope_ = 1;
+
+    this->push();
+    for (const auto& statement : statements) statement->accept(*this);
+
+    state_ = std::move(state);
+    first_local_scope_ = first_local_scope;
+}
+
+void TypeInference::write_report() const
+{
+    for (const auto& [expression, line, label] : reported_) {
+        if (expression->type == Ast::Type::unknown) continue;
+        report_->push_back("[line " + std::to_string(line) + "] '" + std::string{label} +
+                           "' is " + type_name(expression->type));
+    }
+}
+
+void TypeInference::pop()
+{
+    state_.bindings.resize(state_.scopes.back().first_binding);
+    state_.scopes.pop_back();
+}
+
+bool TypeInference::declare(const Ast::Variable& v, Ast::Type type)
+{
+    if (state_.scopes.size() == 1) return false;
+
+    const auto location = locations_.find(v.id);
+    const bool boxed = location != locations_.end() && location->second == boxed_location;
+    const auto name = v.name.lexeme();
+
+    // Declaring a variable again in the same scope gives the same variable a new value
+    for (auto i = state_.bindings.size(); i-- > state_.scopes.back().first_binding; ) {
+        auto& binding = state_.bindings[i];
+        if (binding.name != name) continue;
+        binding.type = type;
+        binding.tracked = binding.tracked && !boxed;
+        return binding.tracked;
+    }
+    state_.bindings.push_back({name, type, !boxed});
+    return !boxed;
+}
+
+State::Binding* TypeInference::find(const Ast::Variable& v)
+{
+    const auto location = locations_.find(v.id);
+    if (location == locations_.end() || is_global(location->second) ||
+        is_captured(location->second))
+    {
+        return nullptr;
+    }
+
+    const auto name = v.name.lexeme();
+    auto last_binding = state_.bindings.size();
+    for (auto scope = state_.scopes.size(); scope-- > first_local_scope_; ) {
+        const auto first_binding = state_.scopes[scope].first_binding;
+        for (auto i = last_binding; i-- > first_binding; ) {
+            auto& binding = state_.bindings[i];
+            if (binding.name == name) return binding.tracked ? &binding : nullptr;
+        }
+        if (state_.scopes[scope].opaque) return nullptr;
+        last_binding = first_binding;
+    }
+    return nullptr;
+}
+
+void TypeInference::refine(const Ast::Expression& operand, Ast::Type type)
+{
+    const auto v = dynamic_cast<const Ast::Variable*>(&ungrouped(operand));
+    if (!v) return;
+    if (const auto binding = this->find(*v)) binding->type = type;
+}
+
+void TypeInference::add_to_report(const Ast::Expression& e, unsigned line, std::string_view label)
+{
+    if (!report_ || !reported_expressions_.insert(&e).second) return;
+    reported_.push_back({&e, line, label});
+}
+
+void TypeInference::record_entry(const Ast::While& w)
+{
+    if (!loops_) return;
+
+    // Loops inside other loops are inferred again each time those are, and the last time holds
+    auto& entry = (*loops_)[&w];
+    entry.clear();
+
+    // The innermost binding of each name hides the others, even if it isn't followed
+    std::unordered_set<std::string_view> seen;
+    auto last_binding = state_.bindings.size();
+    for (auto scope = state_.scopes.size(); scope-- > first_local_scope_; ) {
+        const auto first_binding = state_.scopes[scope].first_binding;
+        for (auto i = last_binding; i-- > first_binding; ) {
+            const auto& binding = state_.bindings[i];
+            if (seen.insert(binding.name).second && binding.tracked) {
+                entry.emplace(binding.name, binding.type);
+            }
+        }
+        if (state_.scopes[scope].opaque) return;
+        last_binding = first_binding;
+    }
+}
+
+void TypeInference::operator()(const Ast::Assign& a)
+{
+    a.expression->accept(*this);
+    ++assignments_;
+
+    a.type = a.expression->type;
+    if (const auto v = std::get_if<Ast::Variable>(&a.variable->contents)) {
+        if (const auto binding = this->find(*v)) binding->type = a.type;
+        return;
+    }
+    Ast::for_each_variable(*a.variable, [this](const Ast::Variable& v) {
+        if (const auto binding = this->find(v)) binding->type = Ast::Type::unknown;
+    });
+}
+
+void TypeInference::operator()(const Ast::AssignMember& a)
+{
+    a.object->accept(*this);
+    a.expression->accept(*this);
+    a.type = a.expression->type;
+}
+
+void TypeInference::operator()(const Ast::Binary& b)
+{
+    b.left->accept(*this);
+    const auto assignments = assignments_;
+    b.right->accept(*this);
+
+    // The left operand is read before the right one is evaluated, which could assign it
+    const auto refine_operands = [&](Ast::Type type) {
+        if (assignments_ == assignments) this->refine(*b.left, type);
+        this->refine(*b.right, type);
+    };
+
+    const auto left = b.left->type;
+    const auto right = b.right->type;
+    switch (b.op.type) {
+        case Token::Type::minus:
+        case Token::Type::slash:
+        case Token::Type::star:
+            b.type = Ast::Type::number;
+            refine_operands(Ast::Type::number);
+            break;
+        case Token::Type::greater:
+        case Token::Type::greater_equal:
+        case Token::Type::less:
+        case Token::Type::less_equal:
+            b.type = Ast::Type::boolean;
+            refine_operands(Ast::Type::number);
+            break;
+        case Token::Type::plus:
+            // Both operands have to be numbers, or both strings
+            if (left == Ast::Type::number || right == Ast::Type::number) {
+                b.type = Ast::Type::number;
+            } else if (left == Ast::Type::string || right == Ast::Type::string) {
+                b.type = Ast::Type::string;
+            } else {
+                b.type = Ast::Type::unknown;
+            }
+            if (b.type != Ast::Type::unknown) refine_operands(b.type);
+            break;
+        case Token::Type::bang_equal:
+        case Token::Type::equal_equal:
+            b.type = Ast::Type::boolean;
+            break;
+        default:
+            b.type = Ast::Type::unknown;
+    }
+    this->add_to_report(b, b.op.line, b.op.lexeme());
+}
+
+void TypeInference::operator()(const Ast::Call& c)
+{
+    c.callee->accept(*this);
+    for (std::size_t i = 0; i < c.input.size(); ++i) {
+        c.input[i]->accept(*this);
+    }
+    c.type = Ast::Type::unknown;
+}
+
+void TypeInference::operator()(const Ast::Function& f)
+{
+    // The function's scopes can only see the variables of enclosing functions through captures,
+    // so nothing it does changes the state around it
+    const auto first_local_scope = first_local_scope_;
+    first_local_scope_ = state_.scopes.size();
+    this->push();
+
+    for (std::size_t i = 0; i < f.input.size(); ++i) {
+        Ast::for_each_variable(*f.input[i], [this](const Ast::Variable& v) {
+            this->declare(v, Ast::Type::unknown);
+        });
+    }
+    (*this)(*f.body);
+
+    this->pop();
+    first_local_scope_ = first_local_scope;
+    f.type = Ast::Type::unknown;
+}
+
+void TypeInference::operator()(const Ast::Get& g)
+{
+    g.object->accept(*this);
+    g.type = Ast::Type::unknown;
+}
+
+void TypeInference::operator()(const Ast::Grouping& g)
+{
+    g.expression->accept(*this);
+    g.type = g.expression->type;
+}
+
+void TypeInference::operator()(const Ast::Inlined& i)
+{
+    for (std::size_t j = 0; j < i.arguments.size(); ++j) {
+        i.arguments[j]->accept(*this);
+    }
+
+    // Unlike a function's, the inputs' types are known from the arguments, and missing ones are nil
+    this->push();
+    for (std::size_t j = 0; j < i.input.size(); ++j) {
+        const auto v = std::get_if<Ast::Variable>(&i.input[j]->contents);
+        if (v && j < i.arguments.size()) {
+            this->declare(*v, i.arguments[j]->type);
+            continue;
+        }
+        Ast::for_each_variable(*i.input[j], [this](const Ast::Variable& v) {
+            this->declare(v, Ast::Type::unknown);
+        });
+    }
+    for (const auto& statement : i.body->statements) statement->accept(*this);
+
+    i.type = Ast::Type::unknown;
+    if (i.result) {
+        (*i.result)->accept(*this);
+        i.type = (*i.result)->type;
+    }
+    this->pop();
+}
+
+void TypeInference::operator()(const Ast::Literal& l)
+{
+    l.type = type_of(l.value);
+}
+
+void TypeInference::operator()(const Ast::Logical& l)
+{
+    l.left->accept(*this);
+
+    // The right operand is only evaluated sometimes
+    const auto skipped = state_;
+    l.right->accept(*this);
+    state_ = merge(skipped, state_);
+
+    // The result is either a boolean, when the right operand is skipped, or the right operand
+    l.type = l.right->type == Ast::Type::boolean ? Ast::Type::boolean : Ast::Type::unknown;
+}
+
+void TypeInference::operator()(const Ast::Tuple& t)
+{
+    for (const auto& element : t.elements) element->accept(*this);
+    t.type = Ast::Type::unknown;
+}
+
+void TypeInference::operator()(const Ast::Unary& u)
+{
+    u.right->accept(*this);
+
+    if (u.op.type == Token::Type::minus) {
+        u.type = Ast::Type::number;
+        this->refine(*u.right, Ast::Type::number);
+    } else if (u.op.type == Token::Type::bang) {
+        u.type = Ast::Type::boolean;
+    } else {
+        u.type = Ast::Type::unknown;
+    }
+    this->add_to_report(u, u.op.line, u.op.lexeme());
+}
+
+void TypeInference::operator()(const Ast::Variable& v)
+{
+    const auto binding = this->find(v);
+    v.type = binding ? binding->type : Ast::Type::unknown;
+    this->add_to_report(v, v.name.line, v.name.lexeme());
+}
+
+void TypeInference::operator()(const Ast::VariableTuple&)
+{
+    assert(false && "Variable tuples are only part of assignments and declarations, which are "
+                    "inferred without them");
+}
+
+void TypeInference::operator()(const Ast::Block& b)
+{
+    this->push();
+    for (const auto& statement : b.statements) statement->accept(*this);
+    this->pop();
+}
+
+void TypeInference::operator()(const Ast::ExpressionStatement& es)
+{
+    if (es.expression) (*es.expression)->accept(*this);
+}
+
+void TypeInference::operator()(const Ast::If& i)
+{
+    i.condition->accept(*this);
+
+    const auto before = state_;
+    i.then_branch->accept(*this);
+    auto after_then = std::move(state_);
+
+    state_ = before;
+    if (i.else_branch) (*i.else_branch)->accept(*this);
+    state_ = merge(after_then, state_);
+}
+
+void TypeInference::operator()(const Ast::Return& r)
+{
+    if (r.expression) (*r.expression)->accept(*this);
+}
+
+void TypeInference::operator()(const Ast::While& w)
+{
+    // The loop is inferred again, from what's true both before it and after its body, until that
+    // stops changing. Types only ever become unknown, so it settles after a few times at most.
+    auto start = state_;
+    for (bool first = true; ; first = false) {
+        state_ = start;
+        w.condition->accept(*this);
+        const auto after_condition = state_;
+        if (first) this->record_entry(w);
+
+        w.body->accept(*this);
+        auto next_start = merge(start, state_);
+        if (next_start == start) {
+            state_ = after_condition;
+            return;
+        }
+        start = std::move(next_start);
+    }
+}
+
+void TypeInference::operator()(const Ast::Declaration& d)
+{
+    if (d.initializer) (*d.initializer)->accept(*this);
+
+    if (const auto v = std::get_if<Ast::Variable>(&d.variable->contents)) {
+        // A variable declared without a value is nil
+        const auto type = d.initializer ? (*d.initializer)->type : Ast::Type::unknown;
+        v->type = this->declare(*v, type) ? type : Ast::Type::unknown;
+        this->add_to_report(*v, v->name.line, v->name.lexeme());
+        return;
+    }
+    Ast::for_each_variable(*d.variable, [this](const Ast::Variable& v) {
+        this->declare(v, Ast::Type::unknown);
+    });
+}
+
+void TypeInference::operator()(const Ast::Import& i)
+{
+    if (i.ast && imports_.insert(i.ast.get()).second) this->infer(*i.ast);
+
+    if (i.variable) {
+        this->declare(**i.variable, Ast::Type::unknown);
+        return;
+    }
+
+    // The file can define variables of any type with any name in this scope
+    auto& scope = state_.scopes.back();
+    scope.opaque = true;
+    for (auto j = scope.first_binding; j < state_.bindings.size(); ++j) {
+        state_.bindings[j].tracked = false;
+    }
+}
+
+}
+
+void infer_types(const Ast::Ast& ast, const Locations& locations, std::vector<std::string>* report,
+                 LoopEntryTypes* loops)
+{
+    TypeInference inference{locations, report, loops};
+    inference.infer(ast);
+    if (report) inference.write_report();
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "ast.h"
+#include "resolver.h"
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// The types of the local variables that are followed, by name, where each while loop's body is
+// first entered, once its condition has been evaluated
+using LoopEntryTypes =
+    std::unordered_map<const Ast::While*, std::unordered_map<std::string_view, Ast::Type>>;
+
+// Works out which expressions of a resolved ast always evaluate to a number, a boolean or a string,
+// and sets their types, so that the interpreter can skip checking them. The types of local
+// variables are followed through the code in order: a variable's type can change with each
+// assignment, and is only known after an if or a loop if it's the same on every way through it.
+// Using a variable as a number, as an operand of minus or less for example, proves that it is one
+// from then on, since the operator would have failed otherwise.
+//
+// Variables at the top level of a file, globals and variables closures can assign are never known,
+// since a call can change them. Imported files are included. Each expression whose type is known
+// is described by a line in the report, if there is one, and the types known on entering each loop
+// are recorded in the loop entry types, if there are some.
+void infer_types(const Ast::Ast&, const Locations&, std::vector<std::string>* report = nullptr,
+                 LoopEntryTypes* loops = nullptr);